@@ -0,0 +1,164 @@
+#include "stdafx.h"
+#include "BackgroundWorkPool.h"
+
+using namespace std;
+
+BackgroundWorkPool *BackgroundWorkPool::instance = nullptr;
+
+//
+// Identity and priority of the calling thread, for attributing the work it queues.
+//
+
+static atomic<unsigned> nextOwner(1);
+static thread_local unsigned callerOwner = 0;
+static thread_local BackgroundWorkPriority callerPriority = BackgroundWorkPriorityNormal;
+
+BackgroundWorkPool::BackgroundWorkPool(unsigned threadCount) :
+	queued(0),
+	running(0),
+	completed(0),
+	submitted(0),
+	stopping(false)
+{
+	for (unsigned index = 0; index < threadCount; index++)
+	{
+		threads.emplace_back(&BackgroundWorkPool::Work, this);
+	}
+}
+
+BackgroundWorkPool::~BackgroundWorkPool()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+
+	workAvailable.notify_all();
+
+	for (thread &worker : threads)
+	{
+		worker.join();
+	}
+}
+
+void BackgroundWorkPool::SetCallerPriority(BackgroundWorkPriority priority)
+{
+	callerPriority = priority;
+}
+
+bool CALLBACK BackgroundWorkPool::ThreadService(JsBackgroundWorkItemCallback callback, void *callbackState)
+{
+	//
+	// Returning false makes the engine run the work itself.
+	//
+
+	if (instance == nullptr)
+	{
+		return false;
+	}
+
+	if (callerOwner == 0)
+	{
+		callerOwner = nextOwner++;
+	}
+
+	instance->Submit(callerOwner, callerPriority, callback, callbackState);
+	return true;
+}
+
+void BackgroundWorkPool::Submit(unsigned owner, BackgroundWorkPriority priority, JsBackgroundWorkItemCallback callback, void *callbackState)
+{
+	WorkItem item;
+	item.callback = callback;
+	item.callbackState = callbackState;
+
+	{
+		lock_guard<mutex> guard(lock);
+		PriorityLevel &level = levels[priority];
+		OwnerQueue &ownerQueue = level.owners[owner];
+
+		if (ownerQueue.items.empty())
+		{
+			level.turns.push_back(owner);
+		}
+
+		ownerQueue.items.push_back(item);
+		queued++;
+		submitted++;
+	}
+
+	workAvailable.notify_one();
+}
+
+//
+// Take the next item: highest priority first, and within a priority the owner whose turn it is.
+// Called with the lock held.
+//
+
+bool BackgroundWorkPool::Take(WorkItem *item)
+{
+	for (PriorityLevel &level : levels)
+	{
+		if (level.turns.empty())
+		{
+			continue;
+		}
+
+		unsigned owner = level.turns.front();
+		level.turns.pop_front();
+
+		auto ownerQueue = level.owners.find(owner);
+		*item = ownerQueue->second.items.front();
+		ownerQueue->second.items.pop_front();
+
+		if (ownerQueue->second.items.empty())
+		{
+			level.owners.erase(ownerQueue);
+		}
+		else
+		{
+			level.turns.push_back(owner);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+void BackgroundWorkPool::Work()
+{
+	for (;;)
+	{
+		WorkItem item;
+		item.callback = nullptr;
+
+		{
+			unique_lock<mutex> guard(lock);
+			workAvailable.wait(guard, [&] { return Take(&item) || stopping; });
+
+			//
+			// Take only fails here when we're stopping with nothing left to do.
+			//
+
+			if (item.callback == nullptr)
+			{
+				return;
+			}
+
+			queued--;
+			running++;
+		}
+
+		item.callback(item.callbackState);
+
+		running--;
+		completed++;
+	}
+}
+
+void BackgroundWorkPool::PrintStatistics()
+{
+	fwprintf(stderr, L"chakrahost: background work: %u threads, %u submitted, %u completed, %u running, %u queued.\n",
+		(unsigned) threads.size(), (unsigned) submitted, (unsigned) completed, (unsigned) running, (unsigned) queued);
+}
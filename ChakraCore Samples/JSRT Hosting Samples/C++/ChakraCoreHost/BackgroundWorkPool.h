@@ -0,0 +1,92 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
+enum BackgroundWorkPriority
+{
+	BackgroundWorkPriorityHigh,
+	BackgroundWorkPriorityNormal,
+	BackgroundWorkPriorityLow,
+	BackgroundWorkPriorityCount
+};
+
+//
+// A fixed-size pool of threads that runs the engine's background work (concurrent GC and
+// background JIT) for every runtime the host creates, passed to JsCreateRuntime as the
+// JsThreadServiceCallback. Without it each runtime starts threads of its own, which
+// oversubscribes the machine when the host runs a runtime per core.
+//
+// The callback doesn't say which runtime is asking, and no JSRT calls are allowed inside it, so
+// work is attributed to the thread that queued it; a host thread runs one runtime at a time. Each
+// thread's work is queued at that thread's priority, and within a priority the pool takes one item
+// from each thread in turn, so one busy runtime can't starve the others.
+//
+
+class BackgroundWorkPool
+{
+public:
+	explicit BackgroundWorkPool(unsigned threadCount);
+	~BackgroundWorkPool();
+
+	//
+	// The pool that ThreadService hands work to, or nullptr to let each runtime use its own threads.
+	//
+
+	static BackgroundWorkPool *instance;
+	static bool CALLBACK ThreadService(JsBackgroundWorkItemCallback callback, void *callbackState);
+
+	//
+	// Set the priority of background work queued from the calling thread.
+	//
+
+	static void SetCallerPriority(BackgroundWorkPriority priority);
+
+	void PrintStatistics();
+
+	std::atomic<unsigned> queued;
+	std::atomic<unsigned> running;
+	std::atomic<unsigned> completed;
+	std::atomic<unsigned> submitted;
+
+private:
+	struct WorkItem
+	{
+		JsBackgroundWorkItemCallback callback;
+		void *callbackState;
+	};
+
+	//
+	// Work queued by one host thread at one priority.
+	//
+
+	struct OwnerQueue
+	{
+		std::deque<WorkItem> items;
+	};
+
+	//
+	// Per priority: the owners with queued work, in the order they get their next turn.
+	//
+
+	struct PriorityLevel
+	{
+		std::map<unsigned, OwnerQueue> owners;
+		std::deque<unsigned> turns;
+	};
+
+	PriorityLevel levels[BackgroundWorkPriorityCount];
+	std::vector<std::thread> threads;
+	std::mutex lock;
+	std::condition_variable workAvailable;
+	bool stopping;
+
+	void Submit(unsigned owner, BackgroundWorkPriority priority, JsBackgroundWorkItemCallback callback, void *callbackState);
+	bool Take(WorkItem *item);
+	void Work();
+};
@@ -0,0 +1,387 @@
+#include "stdafx.h"
+#include "ChakraCoreHost.h"
+#include "ScriptLoader.h"
+#include "BatchRunner.h"
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+using namespace std;
+using namespace std::chrono;
+
+//
+// A script in the batch, and what happened when it ran.
+//
+
+struct BatchScript
+{
+	wstring path;
+	unsigned long long size;
+
+	bool threwException;
+	int exitValue;
+	wstring error;
+	double time;
+	unsigned worker;
+};
+
+//
+// A worker's queue. The owner takes scripts from the front (largest first); other workers steal
+// from the back.
+//
+
+class BatchQueue
+{
+public:
+	BatchQueue() :
+		queuedBytes(0)
+	{
+	}
+
+	void Push(BatchScript *script)
+	{
+		lock_guard<mutex> guard(lock);
+		scripts.push_back(script);
+		queuedBytes += script->size;
+	}
+
+	bool Pop(BatchScript **script)
+	{
+		lock_guard<mutex> guard(lock);
+		if (scripts.empty())
+		{
+			return false;
+		}
+
+		*script = scripts.front();
+		scripts.pop_front();
+		queuedBytes -= (*script)->size;
+		return true;
+	}
+
+	bool Steal(BatchScript **script)
+	{
+		lock_guard<mutex> guard(lock);
+		if (scripts.empty())
+		{
+			return false;
+		}
+
+		*script = scripts.back();
+		scripts.pop_back();
+		queuedBytes -= (*script)->size;
+		return true;
+	}
+
+	unsigned long long QueuedBytes()
+	{
+		lock_guard<mutex> guard(lock);
+		return scripts.empty() ? 0 : queuedBytes + 1;
+	}
+
+private:
+	mutex lock;
+	deque<BatchScript *> scripts;
+	unsigned long long queuedBytes;
+};
+
+static unsigned long long GetFileLength(const wstring &path)
+{
+	WIN32_FIND_DATAW findData;
+	HANDLE find = FindFirstFileW(path.c_str(), &findData);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		return 0;
+	}
+
+	FindClose(find);
+	return ((unsigned long long) findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+}
+
+static bool IsAbsolutePath(const wstring &path)
+{
+	return (path.size() > 0 && (path[0] == L'\\' || path[0] == L'/')) || (path.size() > 1 && path[1] == L':');
+}
+
+//
+// Collect the scripts in a directory, or the scripts named in a list file. Relative paths in a list
+// file are relative to the list file.
+//
+
+static bool ListScripts(const wstring &source, vector<BatchScript> &scripts)
+{
+	DWORD attributes = GetFileAttributesW(source.c_str());
+	if (attributes == INVALID_FILE_ATTRIBUTES)
+	{
+		fwprintf(stderr, L"chakrahost: unable to open batch: %s.\n", source.c_str());
+		return false;
+	}
+
+	BatchScript script = {};
+
+	if (attributes & FILE_ATTRIBUTE_DIRECTORY)
+	{
+		wstring directory = source;
+		if (directory.back() != L'\\' && directory.back() != L'/')
+		{
+			directory += L'\\';
+		}
+
+		WIN32_FIND_DATAW findData;
+		HANDLE find = FindFirstFileW((directory + L"*.js").c_str(), &findData);
+		if (find == INVALID_HANDLE_VALUE)
+		{
+			return true;
+		}
+
+		do
+		{
+			if (!(findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			{
+				script.path = directory + findData.cFileName;
+				script.size = ((unsigned long long) findData.nFileSizeHigh << 32) | findData.nFileSizeLow;
+				scripts.push_back(script);
+			}
+		} while (FindNextFileW(find, &findData));
+
+		FindClose(find);
+		return true;
+	}
+
+	MappedFile *listFile = MappedFile::Open(source.c_str());
+	if (listFile == nullptr)
+	{
+		return false;
+	}
+
+	size_t separator = source.find_last_of(L"\\/");
+	wstring listDirectory = separator == wstring::npos ? wstring() : source.substr(0, separator + 1);
+
+	const char *text = (const char *) listFile->Data();
+	size_t length = (size_t) listFile->Length();
+
+	for (size_t lineStart = 0; lineStart < length;)
+	{
+		size_t lineEnd = lineStart;
+		while (lineEnd < length && text[lineEnd] != '\n')
+		{
+			lineEnd++;
+		}
+
+		size_t next = lineEnd + 1;
+		if (lineEnd > lineStart && text[lineEnd - 1] == '\r')
+		{
+			lineEnd--;
+		}
+
+		int lineLength = (int) (lineEnd - lineStart);
+		if (lineLength > 0)
+		{
+			script.path.resize(lineLength);
+			script.path.resize(MultiByteToWideChar(CP_UTF8, 0, text + lineStart, lineLength, &script.path[0], lineLength));
+			if (!IsAbsolutePath(script.path))
+			{
+				script.path = listDirectory + script.path;
+			}
+
+			script.size = GetFileLength(script.path);
+			scripts.push_back(script);
+		}
+
+		lineStart = next;
+	}
+
+	delete listFile;
+	return true;
+}
+
+//
+// Run one script in a runtime from the pool.
+//
+
+static void RunBatchScript(RuntimePool &pool, BatchScript *script, unsigned worker)
+{
+	script->worker = worker;
+	script->exitValue = EXIT_FAILURE;
+
+	PooledRuntime *pooledRuntime = pool.Acquire();
+	if (pooledRuntime == nullptr)
+	{
+		script->error = L"failed to get a runtime";
+		return;
+	}
+
+	steady_clock::time_point start = steady_clock::now();
+
+	wchar_t *path = &script->path[0];
+	JsValueRef result;
+	JsErrorCode errorCode = SetHostArguments(1, &path, 0);
+	if (errorCode == JsNoError)
+	{
+		errorCode = RunScriptJob(path, watchdog.defaultBudget, &result);
+	}
+
+	if (errorCode == JsErrorScriptTerminated)
+	{
+		script->error = L"timed out";
+	}
+	else if (errorCode == JsErrorOutOfMemory)
+	{
+		script->error = L"out of memory";
+	}
+	else if (errorCode == JsErrorScriptException)
+	{
+		script->threwException = true;
+		if (GetAndClearExceptionMessage(script->error) != JsNoError)
+		{
+			script->error = L"exception";
+		}
+	}
+	else if (errorCode != JsNoError || GetExitValue(result, &script->exitValue) != JsNoError)
+	{
+		script->error = L"failed to run script";
+	}
+
+	script->time = duration<double, milli>(steady_clock::now() - start).count();
+
+	gcScheduler.RunBetweenJobs();
+	pool.Release(pooledRuntime);
+}
+
+int RunBatch(const wstring &source, unsigned jobs, unsigned maxReuse, RuntimeResetStrategy resetStrategy)
+{
+	vector<BatchScript> scripts;
+	if (jobs == 0 || !ListScripts(source, scripts))
+	{
+		return EXIT_FAILURE;
+	}
+
+	RuntimePool pool(jobs, maxReuse, resetStrategy);
+	if (pool.Initialize() != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: failed to create runtime pool.\n");
+		return EXIT_FAILURE;
+	}
+
+	//
+	// Deal the scripts out largest first, so every worker starts on its biggest job.
+	//
+
+	vector<BatchScript *> order;
+	for (BatchScript &script : scripts)
+	{
+		order.push_back(&script);
+	}
+
+	stable_sort(order.begin(), order.end(), [](BatchScript *left, BatchScript *right) { return left->size > right->size; });
+
+	vector<BatchQueue> queues(jobs);
+	for (size_t index = 0; index < order.size(); index++)
+	{
+		queues[index % jobs].Push(order[index]);
+	}
+
+	atomic<unsigned> steals(0);
+	vector<thread> workers;
+
+	steady_clock::time_point start = steady_clock::now();
+
+	for (unsigned worker = 0; worker < jobs; worker++)
+	{
+		workers.emplace_back([&, worker]
+		{
+			for (;;)
+			{
+				BatchScript *script;
+				if (!queues[worker].Pop(&script))
+				{
+					//
+					// Out of work: steal from whoever has the most left. Nothing is queued after
+					// the start, so once every queue is empty we're done.
+					//
+
+					bool stole = false;
+					while (!stole)
+					{
+						unsigned victim = worker;
+						unsigned long long victimBytes = 0;
+						for (unsigned index = 0; index < jobs; index++)
+						{
+							unsigned long long queuedBytes = queues[index].QueuedBytes();
+							if (index != worker && queuedBytes > victimBytes)
+							{
+								victim = index;
+								victimBytes = queuedBytes;
+							}
+						}
+
+						if (victim == worker)
+						{
+							break;
+						}
+
+						stole = queues[victim].Steal(&script);
+					}
+
+					if (!stole)
+					{
+						return;
+					}
+
+					steals++;
+				}
+
+				RunBatchScript(pool, script, worker);
+			}
+		});
+	}
+
+	for (thread &worker : workers)
+	{
+		worker.join();
+	}
+
+	double wallTime = duration<double, milli>(steady_clock::now() - start).count();
+
+	//
+	// Report every script, then the totals.
+	//
+
+	unsigned succeeded = 0;
+	unsigned nonzeroExitValues = 0;
+	unsigned exceptions = 0;
+	unsigned failures = 0;
+	double scriptTime = 0;
+
+	for (BatchScript &script : scripts)
+	{
+		wprintf(L"%d\t%10.3f ms\t%u\t%s\t%s\n", script.exitValue, script.time, script.worker, script.path.c_str(), script.error.c_str());
+
+		scriptTime += script.time;
+		if (script.threwException)
+		{
+			exceptions++;
+		}
+		else if (!script.error.empty())
+		{
+			failures++;
+		}
+		else
+		{
+			succeeded++;
+			if (script.exitValue != 0)
+			{
+				nonzeroExitValues++;
+			}
+		}
+	}
+
+	wprintf(L"batch: %u scripts on %u workers: %u succeeded (%u with a nonzero exit value), %u exceptions, %u failed\n",
+		(unsigned) scripts.size(), jobs, succeeded, nonzeroExitValues, exceptions, failures);
+	wprintf(L"batch: %.3f ms wall time, %.3f ms script time (%.2fx parallelism), %u steals\n",
+		wallTime, scriptTime, wallTime > 0 ? scriptTime / wallTime : 0, (unsigned) steals);
+
+	return (exceptions == 0 && failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "RuntimePool.h"
+#include <string>
+
+//
+// Batch mode: run every script in a directory (*.js) or listed in a file (one path per line) on
+// `jobs` worker threads, each running scripts in its own runtime from a RuntimePool.
+//
+// Scripts are dealt out to per-worker queues largest first; a worker that runs out of work steals
+// from the worker with the most queued bytes, so a few large scripts don't leave the other cores
+// idle. One line per script (exit value, time, worker, path, exception) and a summary are written
+// to stdout.
+//
+
+int RunBatch(const std::wstring &source, unsigned jobs, unsigned maxReuse, RuntimeResetStrategy resetStrategy);
@@ -0,0 +1,846 @@
+#include "stdafx.h"
+#include "ChakraCoreHost.h"
+#include "Benchmarks.h"
+#include "ScriptLoader.h"
+#include "HostOutput.h"
+#include "NativeFunction.h"
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <cmath>
+#include <climits>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+using namespace std::chrono;
+
+//
+// Run a job in the current context, clearing any exception so the runtime can be reused.
+//
+
+static bool RunBenchmarkJob(const wchar_t *scriptName)
+{
+	JsValueRef result;
+	JsErrorCode errorCode = RunScriptJob(scriptName, ScriptBudget(), &result);
+
+	if (errorCode == JsErrorScriptException)
+	{
+		JsValueRef exception;
+		JsGetAndClearException(&exception);
+	}
+
+	return errorCode == JsNoError;
+}
+
+//
+// Spread `jobs` calls to `job` over `threads` threads and return the elapsed time in milliseconds.
+//
+
+template <class Job>
+static double RunOnThreads(unsigned jobs, unsigned threads, atomic<unsigned> &failures, Job job)
+{
+	atomic<unsigned> nextJob(0);
+	vector<thread> workers;
+
+	steady_clock::time_point start = steady_clock::now();
+
+	for (unsigned index = 0; index < threads; index++)
+	{
+		workers.emplace_back([&]
+		{
+			while (nextJob++ < jobs)
+			{
+				if (!job())
+				{
+					failures++;
+				}
+			}
+		});
+	}
+
+	for (thread &worker : workers)
+	{
+		worker.join();
+	}
+
+	return duration<double, milli>(steady_clock::now() - start).count();
+}
+
+int RunPoolBenchmark(const wchar_t *scriptName, unsigned jobs, unsigned threads, unsigned maxReuse, RuntimeResetStrategy resetStrategy)
+{
+	if (jobs == 0 || threads == 0)
+	{
+		fwprintf(stderr, L"chakrahost: invalid benchmark settings.\n");
+		return EXIT_FAILURE;
+	}
+
+	//
+	// Baseline: every job pays for a runtime and a host context.
+	//
+
+	atomic<unsigned> runtimeFailures(0);
+	double runtimePerJobTime = RunOnThreads(jobs, threads, runtimeFailures, [scriptName]
+	{
+		JsRuntimeHandle runtime;
+		JsContextRef context;
+		bool succeeded = false;
+
+		if (CreateHostRuntime(&runtime) == JsNoError)
+		{
+			if (CreateHostContext(runtime, 0, nullptr, 0, &context) == JsNoError &&
+				JsSetCurrentContext(context) == JsNoError)
+			{
+				succeeded = RunBenchmarkJob(scriptName);
+				JsSetCurrentContext(JS_INVALID_REFERENCE);
+			}
+
+			DisposeHostRuntime(runtime);
+		}
+
+		return succeeded;
+	});
+
+	//
+	// Pooled: one runtime per thread, set up front and reset between jobs.
+	//
+
+	RuntimePool pool(threads, maxReuse, resetStrategy);
+
+	steady_clock::time_point poolStart = steady_clock::now();
+	if (pool.Initialize() != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: failed to create runtime pool.\n");
+		return EXIT_FAILURE;
+	}
+	double poolSetupTime = duration<double, milli>(steady_clock::now() - poolStart).count();
+
+	atomic<unsigned> poolFailures(0);
+	double poolTime = RunOnThreads(jobs, threads, poolFailures, [scriptName, &pool]
+	{
+		PooledRuntime *pooledRuntime = pool.Acquire();
+		if (pooledRuntime == nullptr)
+		{
+			return false;
+		}
+
+		bool succeeded = RunBenchmarkJob(scriptName);
+		pool.Release(pooledRuntime);
+		return succeeded;
+	});
+
+	wprintf(L"pool benchmark: %s, %u jobs on %u threads\n", scriptName, jobs, threads);
+	wprintf(L"  runtime per job:   %10.3f ms total, %8.3f ms/job, %u failed\n",
+		runtimePerJobTime, runtimePerJobTime / jobs, (unsigned) runtimeFailures);
+	wprintf(L"  pool:              %10.3f ms total, %8.3f ms/job, %u failed (reset %s, reuse %u, %.3f ms setup)\n",
+		poolTime, poolTime / jobs, (unsigned) poolFailures, RuntimePool::GetResetStrategyName(resetStrategy), maxReuse, poolSetupTime);
+	wprintf(L"  speedup:           %10.2fx\n", runtimePerJobTime / poolTime);
+
+	return EXIT_SUCCESS;
+}
+
+//
+// Timings of one phase over all iterations, in milliseconds.
+//
+
+struct PhaseStatistics
+{
+	double min;
+	double median;
+	double p95;
+	double p99;
+	double mean;
+};
+
+//
+// Nearest-rank percentile of sorted samples.
+//
+
+static double GetPercentile(const vector<double> &samples, double percentile)
+{
+	size_t rank = (size_t) ceil(percentile / 100 * samples.size());
+	return samples[rank > 0 ? rank - 1 : 0];
+}
+
+static PhaseStatistics GetPhaseStatistics(vector<double> samples)
+{
+	sort(samples.begin(), samples.end());
+
+	double total = 0;
+	for (double sample : samples)
+	{
+		total += sample;
+	}
+
+	PhaseStatistics statistics;
+	statistics.min = samples.front();
+	statistics.median = GetPercentile(samples, 50);
+	statistics.p95 = GetPercentile(samples, 95);
+	statistics.p99 = GetPercentile(samples, 99);
+	statistics.mean = total / samples.size();
+	return statistics;
+}
+
+//
+// One load, parse and run of the script in the current context.
+//
+
+static JsErrorCode RunBenchmarkIteration(const wchar_t *scriptName, double *loadTime, double *parseTime, double *runTime)
+{
+	steady_clock::time_point start = steady_clock::now();
+
+	JsValueRef script;
+	IfFailRet(LoadScript(scriptName, &script));
+
+	steady_clock::time_point loaded = steady_clock::now();
+
+	JsValueRef sourceUrl;
+	IfFailRet(JsPointerToString(scriptName, wcslen(scriptName), &sourceUrl));
+
+	JsValueRef function;
+	IfFailRet(JsParse(script, currentSourceContext++, sourceUrl, JsParseScriptAttributeNone, &function));
+
+	steady_clock::time_point parsed = steady_clock::now();
+
+	JsValueRef undefined;
+	JsValueRef result;
+	IfFailRet(JsGetUndefinedValue(&undefined));
+	IfFailRet(RunJob(scriptName, ScriptBudget(), [&] { return JsCallFunction(function, &undefined, 1, &result); }));
+
+	steady_clock::time_point finished = steady_clock::now();
+
+	*loadTime = duration<double, milli>(loaded - start).count();
+	*parseTime = duration<double, milli>(parsed - loaded).count();
+	*runTime = duration<double, milli>(finished - parsed).count();
+	return JsNoError;
+}
+
+static wstring EscapeJsonString(const wchar_t *value)
+{
+	wstring escaped;
+	for (; *value != L'\0'; value++)
+	{
+		if (*value == L'"' || *value == L'\\')
+		{
+			escaped += L'\\';
+		}
+
+		escaped += *value;
+	}
+
+	return escaped;
+}
+
+int RunScriptBenchmark(int argc, wchar_t *argv[], int argumentsStart, unsigned iterations, unsigned warmup, bool json)
+{
+	const wchar_t *scriptName = argv[argumentsStart];
+
+	if (iterations == 0)
+	{
+		fwprintf(stderr, L"chakrahost: invalid benchmark settings.\n");
+		return EXIT_FAILURE;
+	}
+
+	JsRuntimeHandle runtime;
+	if (CreateHostRuntime(&runtime) != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: failed to create runtime.\n");
+		return EXIT_FAILURE;
+	}
+
+	unsigned long long measuredCollections = 0;
+
+	vector<double> loadTimes, parseTimes, runTimes, totalTimes;
+	bool succeeded = true;
+
+	for (unsigned iteration = 0; iteration < warmup + iterations && succeeded; iteration++)
+	{
+		//
+		// A fresh context for every iteration, so one run can't leave state behind for the next.
+		// Setting it up isn't part of the measurement.
+		//
+
+		JsContextRef context;
+		if (CreateHostContext(runtime, argc, argv, argumentsStart, &context) != JsNoError || JsSetCurrentContext(context) != JsNoError)
+		{
+			fwprintf(stderr, L"chakrahost: failed to create execution context.\n");
+			succeeded = false;
+			break;
+		}
+
+		unsigned long long collectionsBefore = gcScheduler.GetCollections(runtime);
+		double loadTime, parseTime, runTime;
+		JsErrorCode errorCode = RunBenchmarkIteration(scriptName, &loadTime, &parseTime, &runTime);
+
+		if (errorCode == JsErrorScriptException || errorCode == JsErrorScriptCompile)
+		{
+			PrintScriptException();
+			succeeded = false;
+		}
+		else if (errorCode != JsNoError)
+		{
+			if (errorCode != JsErrorInvalidArgument)
+			{
+				fwprintf(stderr, L"chakrahost: failed to run script.\n");
+			}
+
+			succeeded = false;
+		}
+		else if (iteration >= warmup)
+		{
+			loadTimes.push_back(loadTime);
+			parseTimes.push_back(parseTime);
+			runTimes.push_back(runTime);
+			totalTimes.push_back(loadTime + parseTime + runTime);
+			measuredCollections += gcScheduler.GetCollections(runtime) - collectionsBefore;
+		}
+
+		JsSetCurrentContext(JS_INVALID_REFERENCE);
+	}
+
+	DisposeHostRuntime(runtime);
+
+	if (!succeeded)
+	{
+		return EXIT_FAILURE;
+	}
+
+	HostOutput::Flush();
+
+	const wchar_t *phaseNames[] = { L"load", L"parse", L"run", L"total" };
+	PhaseStatistics phases[] =
+	{
+		GetPhaseStatistics(loadTimes),
+		GetPhaseStatistics(parseTimes),
+		GetPhaseStatistics(runTimes),
+		GetPhaseStatistics(totalTimes)
+	};
+
+	if (json)
+	{
+		wprintf(L"{\n");
+		wprintf(L"  \"script\": \"%s\",\n", EscapeJsonString(scriptName).c_str());
+		wprintf(L"  \"iterations\": %u,\n", iterations);
+		wprintf(L"  \"warmup\": %u,\n", warmup);
+		wprintf(L"  \"collections\": %llu,\n", measuredCollections);
+
+		for (int phase = 0; phase < 4; phase++)
+		{
+			wprintf(L"  \"%s\": { \"min\": %.6f, \"median\": %.6f, \"p95\": %.6f, \"p99\": %.6f, \"mean\": %.6f }%s\n",
+				phaseNames[phase], phases[phase].min, phases[phase].median, phases[phase].p95, phases[phase].p99, phases[phase].mean, phase < 3 ? L"," : L"");
+		}
+
+		wprintf(L"}\n");
+	}
+	else
+	{
+		wprintf(L"benchmark: %s, %u iterations after %u warm-up, %llu collections (%.2f per iteration)\n",
+			scriptName, iterations, warmup, measuredCollections, (double) measuredCollections / iterations);
+		wprintf(L"  %-8s %10s %10s %10s %10s %10s (ms)\n", L"phase", L"min", L"median", L"p95", L"p99", L"mean");
+
+		for (int phase = 0; phase < 4; phase++)
+		{
+			wprintf(L"  %-8s %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+				phaseNames[phase], phases[phase].min, phases[phase].median, phases[phase].p95, phases[phase].p99, phases[phase].mean);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+//
+// Time `iterations` calls to `lookup` and return nanoseconds per call, or a negative value if a
+// lookup failed.
+//
+
+template <class Lookup>
+static double TimeLookups(unsigned iterations, Lookup lookup)
+{
+	steady_clock::time_point start = steady_clock::now();
+
+	for (unsigned iteration = 0; iteration < iterations; iteration++)
+	{
+		if (lookup() != JsNoError)
+		{
+			return -1;
+		}
+	}
+
+	return duration<double, nano>(steady_clock::now() - start).count() / iterations;
+}
+
+int RunPropertyIdBenchmark(unsigned iterations)
+{
+	if (iterations == 0)
+	{
+		fwprintf(stderr, L"chakrahost: invalid benchmark settings.\n");
+		return EXIT_FAILURE;
+	}
+
+	JsRuntimeHandle runtime;
+	if (CreateHostRuntime(&runtime) != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: failed to create runtime.\n");
+		return EXIT_FAILURE;
+	}
+
+	JsContextRef context;
+	if (CreateHostContext(runtime, 0, nullptr, 0, &context) != JsNoError || JsSetCurrentContext(context) != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: failed to create execution context.\n");
+		DisposeHostRuntime(runtime);
+		return EXIT_FAILURE;
+	}
+
+	//
+	// Look up `message`, alone and followed by a read of it from an error object, the way exception
+	// reporting does.
+	//
+
+	JsValueRef messageValue;
+	JsValueRef error;
+	JsValueRef value;
+	JsPropertyIdRef propertyId;
+	JsPointerToString(L"benchmark", wcslen(L"benchmark"), &messageValue);
+	JsCreateError(messageValue, &error);
+
+	const wchar_t *name = PropertyIds::GetName(PropertyIdMessage);
+
+	double engineLookup = TimeLookups(iterations, [&] { return JsGetPropertyIdFromName(name, &propertyId); });
+	double wellKnownLookup = TimeLookups(iterations, [&] { return PropertyIds::Get(PropertyIdMessage, &propertyId); });
+	double namedLookup = TimeLookups(iterations, [&] { return PropertyIds::Get(name, &propertyId); });
+
+	double engineGet = TimeLookups(iterations, [&]
+	{
+		JsErrorCode errorCode = JsGetPropertyIdFromName(name, &propertyId);
+		return errorCode == JsNoError ? JsGetProperty(error, propertyId, &value) : errorCode;
+	});
+
+	double wellKnownGet = TimeLookups(iterations, [&]
+	{
+		JsErrorCode errorCode = PropertyIds::Get(PropertyIdMessage, &propertyId);
+		return errorCode == JsNoError ? JsGetProperty(error, propertyId, &value) : errorCode;
+	});
+
+	JsSetCurrentContext(JS_INVALID_REFERENCE);
+	DisposeHostRuntime(runtime);
+
+	if (engineLookup < 0 || wellKnownLookup < 0 || namedLookup < 0 || engineGet < 0 || wellKnownGet < 0)
+	{
+		fwprintf(stderr, L"chakrahost: property lookup failed.\n");
+		return EXIT_FAILURE;
+	}
+
+	wprintf(L"property ID benchmark: %u lookups of \"%s\"\n", iterations, name);
+	wprintf(L"  %-32s %8.1f ns\n", L"JsGetPropertyIdFromName", engineLookup);
+	wprintf(L"  %-32s %8.1f ns (%.2fx)\n", L"registry, well-known ID", wellKnownLookup, engineLookup / wellKnownLookup);
+	wprintf(L"  %-32s %8.1f ns (%.2fx)\n", L"registry, by name", namedLookup, engineLookup / namedLookup);
+	wprintf(L"  %-32s %8.1f ns\n", L"engine lookup and JsGetProperty", engineGet);
+	wprintf(L"  %-32s %8.1f ns (%.1f ns saved per access)\n", L"registry and JsGetProperty", wellKnownGet, engineGet - wellKnownGet);
+
+	return EXIT_SUCCESS;
+}
+
+//
+// The same native function, add(a, b, c), written by hand and through NATIVE_FUNCTION, and an
+// empty callback for the cost of the call itself.
+//
+
+static JsValueRef CALLBACK HandWrittenAdd(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+{
+	if (argumentCount < 4)
+	{
+		ThrowException(L"not enough arguments");
+		return JS_INVALID_REFERENCE;
+	}
+
+	double values[3];
+	for (int index = 0; index < 3; index++)
+	{
+		IfFailThrow(JsNumberToDouble(arguments[index + 1], &values[index]), L"invalid argument");
+	}
+
+	JsValueRef result;
+	IfFailThrow(JsDoubleToNumber(values[0] + values[1] + values[2], &result), L"invalid result");
+	return result;
+}
+
+static double Add(double a, double b, double c)
+{
+	return a + b + c;
+}
+
+static JsValueRef CALLBACK EmptyCallback(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+{
+	return JS_INVALID_REFERENCE;
+}
+
+//
+// Call `callback` `calls` times from a script loop and return nanoseconds per call, or a negative
+// value if the loop failed.
+//
+
+static double TimeNativeCalls(JsValueRef loop, JsNativeFunction callback, unsigned calls)
+{
+	JsValueRef arguments[3];
+	JsValueRef result;
+
+	if (JsGetUndefinedValue(&arguments[0]) != JsNoError ||
+		JsCreateFunction(callback, nullptr, &arguments[1]) != JsNoError ||
+		JsDoubleToNumber(calls, &arguments[2]) != JsNoError)
+	{
+		return -1;
+	}
+
+	steady_clock::time_point start = steady_clock::now();
+
+	if (JsCallFunction(loop, arguments, 3, &result) != JsNoError)
+	{
+		return -1;
+	}
+
+	return duration<double, nano>(steady_clock::now() - start).count() / calls;
+}
+
+int RunNativeFunctionBenchmark(unsigned calls)
+{
+	if (calls == 0)
+	{
+		fwprintf(stderr, L"chakrahost: invalid benchmark settings.\n");
+		return EXIT_FAILURE;
+	}
+
+	JsRuntimeHandle runtime;
+	if (CreateHostRuntime(&runtime) != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: failed to create runtime.\n");
+		return EXIT_FAILURE;
+	}
+
+	JsContextRef context;
+	if (CreateHostContext(runtime, 0, nullptr, 0, &context) != JsNoError || JsSetCurrentContext(context) != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: failed to create execution context.\n");
+		DisposeHostRuntime(runtime);
+		return EXIT_FAILURE;
+	}
+
+	const wchar_t *loopSource = L"(function (f, n) { var total = 0; for (var i = 0; i < n; i++) { total += f(i, 1, 2); } return total; })";
+
+	JsValueRef source;
+	JsValueRef sourceUrl;
+	JsValueRef loop = JS_INVALID_REFERENCE;
+	double emptyTime = -1;
+	double handWrittenTime = -1;
+	double typedTime = -1;
+
+	if (JsPointerToString(loopSource, wcslen(loopSource), &source) == JsNoError &&
+		JsPointerToString(L"bench", wcslen(L"bench"), &sourceUrl) == JsNoError &&
+		JsRun(source, currentSourceContext++, sourceUrl, JsParseScriptAttributeNone, &loop) == JsNoError)
+	{
+		//
+		// Run each once first, so all three are timed with the loop already jitted.
+		//
+
+		TimeNativeCalls(loop, HandWrittenAdd, 1000);
+		emptyTime = TimeNativeCalls(loop, EmptyCallback, calls);
+		handWrittenTime = TimeNativeCalls(loop, HandWrittenAdd, calls);
+		typedTime = TimeNativeCalls(loop, NATIVE_FUNCTION(Add), calls);
+	}
+
+	JsSetCurrentContext(JS_INVALID_REFERENCE);
+	DisposeHostRuntime(runtime);
+
+	if (emptyTime < 0 || handWrittenTime < 0 || typedTime < 0)
+	{
+		fwprintf(stderr, L"chakrahost: failed to run benchmark.\n");
+		return EXIT_FAILURE;
+	}
+
+	wprintf(L"native function benchmark: %u calls of add(a, b, c) from script\n", calls);
+	wprintf(L"  %-32s %8.1f ns\n", L"empty callback", emptyTime);
+	wprintf(L"  %-32s %8.1f ns\n", L"hand-written", handWrittenTime);
+	wprintf(L"  %-32s %8.1f ns (%+.1f ns against hand-written)\n", L"NATIVE_FUNCTION", typedTime, typedTime - handWrittenTime);
+
+	return EXIT_SUCCESS;
+}
+
+//
+// Scripts for the shared memory benchmark. The buffer starts with two Int32 control words, the
+// number of threads done with the current round and the round last started (-1 to stop), then
+// holds a Float64 partial sum per thread, then the data.
+//
+
+static const wchar_t *fillSource =
+	L"(function (threads, elements) {"
+	L"  var shared = new SharedArrayBuffer(8 + 8 * threads + 4 * elements);"
+	L"  var data = new Int32Array(shared, 8 + 8 * threads, elements);"
+	L"  for (var i = 0; i < elements; i++) { data[i] = i & 1023; }"
+	L"  return shared;"
+	L"})";
+
+static const wchar_t *sumSource =
+	L"(function (shared, threads, elements) {"
+	L"  var data = new Int32Array(shared, 8 + 8 * threads, elements);"
+	L"  var total = 0;"
+	L"  for (var i = 0; i < elements; i++) { total += data[i]; }"
+	L"  return total;"
+	L"})";
+
+static const wchar_t *reduceSource =
+	L"(function (shared, index, threads, elements, rounds) {"
+	L"  var control = new Int32Array(shared, 0, 2);"
+	L"  var partials = new Float64Array(shared, 8, threads);"
+	L"  var data = new Int32Array(shared, 8 + 8 * threads, elements);"
+	L"  var start = Math.floor(elements * index / threads), end = Math.floor(elements * (index + 1) / threads);"
+	L"  for (var round = 1; round <= rounds; round++) {"
+	L"    for (var started; (started = Atomics.load(control, 1)) < round;) {"
+	L"      if (started < 0) { return; }"
+	L"      Atomics.wait(control, 1, started);"
+	L"    }"
+	L"    var total = 0;"
+	L"    for (var i = start; i < end; i++) { total += data[i]; }"
+	L"    partials[index] = total;"
+	L"    Atomics.add(control, 0, 1);"
+	L"    Atomics.notify(control, 0);"
+	L"  }"
+	L"})";
+
+static const wchar_t *roundSource =
+	L"(function (shared, threads, round) {"
+	L"  var control = new Int32Array(shared, 0, 2);"
+	L"  var partials = new Float64Array(shared, 8, threads);"
+	L"  Atomics.store(control, 0, 0);"
+	L"  Atomics.store(control, 1, round);"
+	L"  Atomics.notify(control, 1);"
+	L"  if (round < 0) { return 0; }"
+	L"  for (var done; (done = Atomics.load(control, 0)) < threads;) { Atomics.wait(control, 0, done); }"
+	L"  var total = 0;"
+	L"  for (var i = 0; i < threads; i++) { total += partials[i]; }"
+	L"  return total;"
+	L"})";
+
+static JsErrorCode CompileFunction(const wchar_t *functionSource, JsValueRef *function)
+{
+	JsValueRef source;
+	JsValueRef sourceUrl;
+	IfFailRet(JsPointerToString(functionSource, wcslen(functionSource), &source));
+	IfFailRet(JsPointerToString(L"bench", wcslen(L"bench"), &sourceUrl));
+	return JsRun(source, currentSourceContext++, sourceUrl, JsParseScriptAttributeNone, function);
+}
+
+//
+// Call a benchmark function with an optional buffer followed by integer arguments.
+//
+
+static JsErrorCode CallWithNumbers(JsValueRef function, JsValueRef buffer, const vector<int> &numbers, JsValueRef *result)
+{
+	vector<JsValueRef> arguments(1);
+	IfFailRet(JsGetUndefinedValue(&arguments[0]));
+
+	if (buffer != JS_INVALID_REFERENCE)
+	{
+		arguments.push_back(buffer);
+	}
+
+	for (int number : numbers)
+	{
+		JsValueRef value;
+		IfFailRet(JsIntToNumber(number, &value));
+		arguments.push_back(value);
+	}
+
+	return JsCallFunction(function, arguments.data(), (unsigned short) arguments.size(), result);
+}
+
+static JsErrorCode CallForNumber(JsValueRef function, JsValueRef buffer, const vector<int> &numbers, double *result)
+{
+	JsValueRef value;
+	IfFailRet(CallWithNumbers(function, buffer, numbers, &value));
+	return JsNumberToDouble(value, result);
+}
+
+//
+// A reduction thread: a runtime of its own, with a SharedArrayBuffer over the benchmark's memory.
+// It says when it's ready, then runs each round as the main thread starts it.
+//
+
+struct ReductionThreads
+{
+	mutex lock;
+	condition_variable ready;
+	unsigned readyCount;
+	unsigned failures;
+};
+
+static void RunReductionThread(JsSharedArrayBufferContentHandle content, int index, int threads, int elements, int rounds, ReductionThreads &state)
+{
+	JsRuntimeHandle runtime;
+	JsContextRef context;
+	JsValueRef reduce;
+	JsValueRef shared;
+	bool succeeded = false;
+
+	bool created = CreateHostRuntime(&runtime) == JsNoError;
+	if (created)
+	{
+		succeeded = CreateHostContext(runtime, 0, nullptr, 0, &context) == JsNoError &&
+			JsSetCurrentContext(context) == JsNoError &&
+			CompileFunction(reduceSource, &reduce) == JsNoError &&
+			JsCreateSharedArrayBufferWithSharedContent(content, &shared) == JsNoError;
+	}
+
+	{
+		lock_guard<mutex> guard(state.lock);
+		state.readyCount++;
+		state.failures += succeeded ? 0 : 1;
+		state.ready.notify_all();
+	}
+
+	if (succeeded)
+	{
+		JsValueRef result;
+		CallWithNumbers(reduce, shared, { index, threads, elements, rounds }, &result);
+	}
+
+	if (created)
+	{
+		JsSetCurrentContext(JS_INVALID_REFERENCE);
+		DisposeHostRuntime(runtime);
+	}
+}
+
+int RunSharedMemoryBenchmark(unsigned threads, unsigned elements)
+{
+	const int rounds = 5;
+
+	if (threads == 0 || threads > 1024 || elements == 0 || elements > (INT_MAX - 8 - 8 * threads) / 4)
+	{
+		fwprintf(stderr, L"chakrahost: invalid benchmark settings.\n");
+		return EXIT_FAILURE;
+	}
+
+	enableSharedMemory = true;
+
+	JsRuntimeHandle runtime;
+	if (CreateHostRuntime(&runtime) != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: failed to create runtime.\n");
+		return EXIT_FAILURE;
+	}
+
+	JsContextRef context;
+	JsValueRef fill;
+	JsValueRef sum;
+	JsValueRef round;
+	JsValueRef shared;
+	JsSharedArrayBufferContentHandle content = nullptr;
+
+	if (CreateHostContext(runtime, 0, nullptr, 0, &context) != JsNoError ||
+		JsSetCurrentContext(context) != JsNoError ||
+		CompileFunction(fillSource, &fill) != JsNoError ||
+		CompileFunction(sumSource, &sum) != JsNoError ||
+		CompileFunction(roundSource, &round) != JsNoError ||
+		CallWithNumbers(fill, JS_INVALID_REFERENCE, { (int) threads, (int) elements }, &shared) != JsNoError ||
+		JsGetSharedArrayBufferContent(shared, &content) != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: failed to set up benchmark (SharedArrayBuffer may not be available).\n");
+		JsSetCurrentContext(JS_INVALID_REFERENCE);
+		DisposeHostRuntime(runtime);
+		return EXIT_FAILURE;
+	}
+
+	//
+	// Baseline: the whole sum in this runtime.
+	//
+
+	double singleTime = -1;
+	double singleTotal = -1;
+
+	for (int index = 0; index < rounds; index++)
+	{
+		steady_clock::time_point start = steady_clock::now();
+		if (CallForNumber(sum, shared, { (int) threads, (int) elements }, &singleTotal) != JsNoError)
+		{
+			singleTime = -1;
+			break;
+		}
+
+		double time = duration<double, milli>(steady_clock::now() - start).count();
+		singleTime = singleTime < 0 ? time : min(singleTime, time);
+	}
+
+	//
+	// Parallel: each thread sums its slice into its own slot, and this thread adds up the slots. The
+	// threads are set up before any round is timed.
+	//
+
+	ReductionThreads state;
+	state.readyCount = 0;
+	state.failures = 0;
+
+	vector<thread> reducers;
+	for (unsigned index = 0; index < threads; index++)
+	{
+		reducers.emplace_back(RunReductionThread, content, (int) index, (int) threads, (int) elements, rounds, ref(state));
+	}
+
+	{
+		unique_lock<mutex> guard(state.lock);
+		state.ready.wait(guard, [&] { return state.readyCount == threads; });
+	}
+
+	//
+	// The reduction threads hold references of their own now.
+	//
+
+	JsReleaseSharedArrayBufferContentHandle(content);
+
+	double parallelTime = -1;
+	double parallelTotal = -1;
+
+	for (int index = 1; index <= rounds && state.failures == 0; index++)
+	{
+		steady_clock::time_point start = steady_clock::now();
+		if (CallForNumber(round, shared, { (int) threads, index }, &parallelTotal) != JsNoError)
+		{
+			parallelTime = -1;
+			break;
+		}
+
+		double time = duration<double, milli>(steady_clock::now() - start).count();
+		parallelTime = parallelTime < 0 ? time : min(parallelTime, time);
+	}
+
+	//
+	// Threads still waiting for a round, after a failure, are told to stop.
+	//
+
+	if (parallelTime < 0)
+	{
+		double ignored;
+		CallForNumber(round, shared, { (int) threads, -1 }, &ignored);
+	}
+
+	for (thread &reducer : reducers)
+	{
+		reducer.join();
+	}
+
+	JsSetCurrentContext(JS_INVALID_REFERENCE);
+	DisposeHostRuntime(runtime);
+
+	if (singleTime < 0 || parallelTime < 0 || singleTotal != parallelTotal)
+	{
+		fwprintf(stderr, L"chakrahost: failed to run benchmark.\n");
+		return EXIT_FAILURE;
+	}
+
+	wprintf(L"shared memory benchmark: sum of %u int32 elements, best of %d rounds\n", elements, rounds);
+	wprintf(L"  %-32s %10.3f ms\n", L"one runtime", singleTime);
+	wprintf(L"  %-32s %10.3f ms (%.2fx)\n", (to_wstring(threads) + L" runtimes on shared memory").c_str(), parallelTime, singleTime / parallelTime);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "RuntimePool.h"
+
+//
+// Built-in benchmarks for the host's own machinery. Results go to stdout.
+//
+
+//
+// Run a script the given number of times on `threads` threads, once with a new runtime per job
+// and once through a RuntimePool with the given settings.
+//
+
+int RunPoolBenchmark(const wchar_t *scriptName, unsigned jobs, unsigned threads, unsigned maxReuse, RuntimeResetStrategy resetStrategy);
+
+//
+// Run a script `warmup` times untimed, then `iterations` times, each in a fresh context of one
+// runtime, and report the load (mapping the file), parse (JsParse) and run (JsCallFunction and the
+// event loop) times as min, median, p95, p99 and mean, with the number of garbage collections.
+// With `json`, the report is a JSON object instead of text.
+//
+
+int RunScriptBenchmark(int argc, wchar_t *argv[], int argumentsStart, unsigned iterations, unsigned warmup, bool json);
+
+//
+// Time property ID lookups through the engine (JsGetPropertyIdFromName) against the host's
+// registry (PropertyIds), by well-known ID and by name, alone and with a JsGetProperty.
+//
+
+int RunPropertyIdBenchmark(unsigned iterations);
+
+//
+// Time calls from script to a native add(a, b, c) written by hand against the same function bound
+// with NATIVE_FUNCTION, next to an empty callback.
+//
+
+int RunNativeFunctionBenchmark(unsigned calls);
+
+//
+// Sum `elements` integers in a SharedArrayBuffer, once in one runtime and once split over `threads`
+// runtimes on threads of their own, which share the buffer's memory and are started and waited for
+// with Atomics.wait and Atomics.notify.
+//
+
+int RunSharedMemoryBenchmark(unsigned threads, unsigned elements);
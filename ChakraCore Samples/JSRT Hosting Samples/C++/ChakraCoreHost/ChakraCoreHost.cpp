@@ -1,6 +1,21 @@
 #include "stdafx.h"
+#include "ChakraCoreHost.h"
+#include "ScriptLoader.h"
+#include "ScriptServer.h"
+#include "Benchmarks.h"
+#include "BatchRunner.h"
+#include "BackgroundWorkPool.h"
+#include "ModuleLoader.h"
+#include "HostOutput.h"
+#include "EventLoop.h"
+#include "StreamRunner.h"
+#include "Worker.h"
+#include "NativeFunction.h"
 #include <string>
 #include <iostream>
+#include <climits>
+#include <thread>
+#include <memory>
 
 using namespace std;
 
@@ -12,9 +27,56 @@ class CommandLineArguments
 {
 public:
 	int argumentsStart;
+	wstring cacheDirectory;
+	bool printCacheStatistics;
+	wstring serverName;
+	wstring submitName;
+	wstring warmupScript;
+	unsigned poolBenchmarkJobs;
+	unsigned propertyBenchmarkIterations;
+	unsigned nativeBenchmarkCalls;
+	unsigned sharedBenchmarkThreads;
+	unsigned sharedBenchmarkElements;
+	unsigned poolSize;
+	unsigned poolMaxReuse;
+	RuntimeResetStrategy poolResetStrategy;
+	wstring batchSource;
+	unsigned jobs;
+	unsigned backgroundThreads;
+	bool printBackgroundStatistics;
+	bool module;
+	bool printMemoryStatistics;
+	bool printGcStatistics;
+	wstring memoryReport;
+	OutputFlushPolicy outputFlushPolicy;
+	unsigned benchIterations;
+	unsigned benchWarmup;
+	bool benchJson;
+	wstring streamInput;
+	unsigned streamBatchSize;
 
 	CommandLineArguments() :
-		argumentsStart(1)
+		argumentsStart(1),
+		printCacheStatistics(false),
+		poolBenchmarkJobs(0),
+		propertyBenchmarkIterations(0),
+		nativeBenchmarkCalls(0),
+		sharedBenchmarkThreads(0),
+		sharedBenchmarkElements(16 * 1024 * 1024),
+		poolSize(1),
+		poolMaxReuse(0),
+		poolResetStrategy(RuntimeResetContext),
+		jobs(thread::hardware_concurrency()),
+		backgroundThreads(0),
+		printBackgroundStatistics(false),
+		module(false),
+		printMemoryStatistics(false),
+		printGcStatistics(false),
+		outputFlushPolicy(OutputFlushAuto),
+		benchIterations(0),
+		benchWarmup(0),
+		benchJson(false),
+		streamBatchSize(1024)
 	{
 	}
 };
@@ -23,7 +85,37 @@ public:
 // Source context counter.
 //
 
-unsigned currentSourceContext = 0;
+atomic<unsigned> currentSourceContext(0);
+
+//
+// Bytecode cache shared by the entry script and host.runScript.
+//
+
+ScriptCache scriptCache;
+
+//
+// Watchdog that stops scripts running over their budget.
+//
+
+Watchdog watchdog;
+
+//
+// Memory limits and accounting for every runtime.
+//
+
+MemoryMonitor memoryMonitor;
+
+//
+// When runtimes collect garbage.
+//
+
+GcScheduler gcScheduler;
+
+//
+// SharedArrayBuffer and Atomics, off unless asked for.
+//
+
+bool enableSharedMemory = false;
 
 //
 // This "throws" an exception in the Chakra space. Useful routine for callbacks
@@ -41,137 +133,277 @@ void ThrowException(wstring errorString)
 }
 
 //
-// Helper to load a script from disk.
+// Callback to echo something to the command-line.
 //
 
-wstring LoadScript(wstring fileName)
+static void Echo(NativeRestArguments values)
 {
-	FILE *file;
-	if (_wfopen_s(&file, fileName.c_str(), L"rb"))
+	for (unsigned int index = 0; index < values.count; index++)
 	{
-		fwprintf(stderr, L"chakrahost: unable to open file: %s.\n", fileName.c_str());
-		return wstring();
+		if (index > 0)
+		{
+			HostOutput::Write(" ", 1);
+		}
+
+		JsValueRef stringValue;
+		IfFailScriptError(JsConvertValueToString(values.values[index], &stringValue), L"invalid argument");
+		IfFailScriptError(HostOutput::WriteString(stringValue), L"invalid argument");
 	}
 
-	unsigned int current = ftell(file);
-	fseek(file, 0, SEEK_END);
-	unsigned int end = ftell(file);
-	fseek(file, current, SEEK_SET);
-	unsigned int lengthBytes = end - current;
-	char *rawBytes = (char *) calloc(lengthBytes + 1, sizeof(char) );
+	HostOutput::EndLine();
+}
 
-	if (rawBytes == nullptr)
+//
+// Callback to write bytes (an ArrayBuffer, typed array or DataView) or a string to the
+// command-line as is.
+//
+
+static void Write(NativeRestArguments values)
+{
+	for (unsigned int index = 0; index < values.count; index++)
 	{
-		fwprintf(stderr, L"chakrahost: fatal error.\n");
-		return wstring();
-	}
+		JsValueRef value = values.values[index];
 
-	fread((void *) rawBytes, sizeof(char) , lengthBytes, file);
+		JsValueType type;
+		IfFailScriptError(JsGetValueType(value, &type), L"invalid argument");
 
-	wchar_t *contents = (wchar_t *) calloc(lengthBytes + 1, sizeof(wchar_t) );
-	if (contents == nullptr)
-	{
-		free(rawBytes);
-		fwprintf(stderr, L"chakrahost: fatal error.\n");
-		return wstring();
-	}
+		ChakraBytePtr buffer;
+		unsigned int length;
 
-	if (MultiByteToWideChar(CP_UTF8, 0, rawBytes, lengthBytes + 1, contents, lengthBytes + 1) == 0)
-	{
-        free(rawBytes);
-        free(contents);
-		fwprintf(stderr, L"chakrahost: fatal error.\n");
-		return wstring();
+		switch (type)
+		{
+		case JsArrayBuffer:
+			IfFailScriptError(JsGetArrayBufferStorage(value, &buffer, &length), L"invalid argument");
+			break;
+
+		case JsTypedArray:
+			IfFailScriptError(JsGetTypedArrayStorage(value, &buffer, &length, nullptr, nullptr), L"invalid argument");
+			break;
+
+		case JsDataView:
+			IfFailScriptError(JsGetDataViewStorage(value, &buffer, &length), L"invalid argument");
+			break;
+
+		case JsString:
+			IfFailScriptError(HostOutput::WriteString(value), L"invalid argument");
+			continue;
+
+		default:
+			throw NativeScriptError(L"invalid argument");
+		}
+
+		HostOutput::Write((const char *) buffer, length);
 	}
+}
 
-	wstring result = contents;
-    free(rawBytes);
-    free(contents);
-	return result;
+//
+// Callback to map a file into an ArrayBuffer, so large data files can be scanned without reading
+// them into strings. The mapping is private: writes from the script never reach the file.
+//
+
+static JsValueRef MapFile(const wstring &path)
+{
+	JsValueRef arrayBuffer;
+	IfFailScriptError(MapFileToArrayBuffer(path.c_str(), true, &arrayBuffer), L"unable to map file");
+	return arrayBuffer;
 }
 
 //
-// Callback to echo something to the command-line.
+// Callback to read part of a file straight into a typed array: readFileInto(path, typedArray,
+// offset) fills the array from the given file offset and returns the number of bytes read, which
+// is less than the array's length only at the end of the file.
 //
 
-JsValueRef CALLBACK Echo(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+static double ReadFileInto(const wstring &fileName, JsValueRef typedArray, NativeOptional<double> offsetArgument)
 {
-	for (unsigned int index = 1; index < argumentCount; index++)
+	ChakraBytePtr buffer;
+	unsigned int bufferLength;
+	IfFailScriptError(JsGetTypedArrayStorage(typedArray, &buffer, &bufferLength, nullptr, nullptr), L"invalid typed array argument");
+
+	unsigned long long offset = 0;
+	if (offsetArgument.present)
 	{
-		if (index > 1)
+		if (!(offsetArgument.value >= 0 && offsetArgument.value <= 9007199254740992.0))
 		{
-			wprintf(L" ");
+			throw NativeScriptError(L"invalid offset argument");
 		}
 
-		JsValueRef stringValue;
-		IfFailThrow(JsConvertValueToString(arguments[index], &stringValue), L"invalid argument");
+		offset = (unsigned long long) offsetArgument.value;
+	}
 
-		const wchar_t *string;
-		size_t length;
-		IfFailThrow(JsStringToPointer(stringValue, &string, &length), L"invalid argument");
+	HANDLE file = CreateFileW(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		throw NativeScriptError(L"unable to open file: " + fileName);
+	}
 
-		wprintf(L"%s", string);
+	//
+	// A synchronous read at an explicit offset; keep reading until the array is full or the file
+	// ends.
+	//
+
+	unsigned int totalRead = 0;
+	bool failed = false;
+
+	while (totalRead < bufferLength)
+	{
+		OVERLAPPED overlapped = {};
+		overlapped.Offset = (DWORD) (offset + totalRead);
+		overlapped.OffsetHigh = (DWORD) ((offset + totalRead) >> 32);
+
+		DWORD bytesRead;
+		if (!ReadFile(file, buffer + totalRead, bufferLength - totalRead, &bytesRead, &overlapped))
+		{
+			failed = GetLastError() != ERROR_HANDLE_EOF;
+			break;
+		}
+
+		if (bytesRead == 0)
+		{
+			break;
+		}
+
+		totalRead += bytesRead;
 	}
 
-	wprintf(L"\n");
+	CloseHandle(file);
 
-	return JS_INVALID_REFERENCE;
+	if (failed)
+	{
+		throw NativeScriptError(L"unable to read file: " + fileName);
+	}
+
+	return totalRead;
 }
 
 //
-// Callback to load a script and run it.
+// Read a time limit in milliseconds from an options object. A missing option leaves no limit.
 //
 
-JsValueRef CALLBACK RunScript(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+static JsErrorCode GetBudgetOption(JsValueRef options, PropertyId id, unsigned *timeoutMs)
 {
-	JsValueRef result = JS_INVALID_REFERENCE;
+	JsPropertyIdRef propertyId;
+	IfFailRet(PropertyIds::Get(id, &propertyId));
 
-	if (argumentCount < 2)
+	JsValueRef value;
+	IfFailRet(JsGetProperty(options, propertyId, &value));
+
+	JsValueType type;
+	IfFailRet(JsGetValueType(value, &type));
+	if (type == JsUndefined)
 	{
-		ThrowException(L"not enough arguments");
-		return result;
+		return JsNoError;
+	}
+
+	JsValueRef numberValue;
+	double number;
+	IfFailRet(JsConvertValueToNumber(value, &numberValue));
+	IfFailRet(JsNumberToDouble(numberValue, &number));
+
+	if (!(number >= 0 && number <= UINT_MAX))
+	{
+		return JsErrorInvalidArgument;
 	}
 
+	*timeoutMs = (unsigned) number;
+	return JsNoError;
+}
+
+//
+// Callback to load a script and run it.
+//
+
+static JsValueRef RunScript(const wchar_t *fileName, NativeOptional<JsValueRef> options)
+{
+	JsValueRef result = JS_INVALID_REFERENCE;
+
 	//
-	// Convert filename.
+	// Options: { timeoutMs, cpuTimeoutMs } limit how long the script may run.
 	//
-	const wchar_t *filename;
-	size_t length;
 
-	IfFailThrow(JsStringToPointer(arguments[1], &filename, &length), L"invalid filename argument");
+	ScriptBudget budget;
+
+	if (options.present)
+	{
+		JsValueType type;
+		IfFailScriptError(JsGetValueType(options.value, &type), L"invalid options argument");
+
+		if (type == JsObject)
+		{
+			IfFailScriptError(GetBudgetOption(options.value, PropertyIdTimeoutMs, &budget.timeoutMs), L"invalid timeoutMs option");
+			IfFailScriptError(GetBudgetOption(options.value, PropertyIdCpuTimeoutMs, &budget.cpuTimeoutMs), L"invalid cpuTimeoutMs option");
+		}
+	}
 
 	//
 	// Load the script from the disk.
 	//
 
-	wstring script = LoadScript(filename);
-	if (script.empty())
+	JsErrorCode errorCode = RunScriptFile(fileName, budget, &result);
+	if (errorCode == JsErrorInvalidArgument)
 	{
-		ThrowException(L"invalid script");
-		return result;
+		throw NativeScriptError(L"invalid script");
 	}
 
 	//
-	// Run the script.
+	// When the script's own budget runs out the caller can carry on; when an enclosing budget runs
+	// out, execution stays disabled and the caller is unwound as well.
 	//
 
-	IfFailThrow(JsRunScript(script.c_str(), currentSourceContext++, filename, &result), L"failed to run script.");
+	if (errorCode == JsErrorScriptTerminated)
+	{
+		throw NativeScriptError(L"script timed out");
+	}
+
+	if (errorCode == JsErrorInDisabledState)
+	{
+		return result;
+	}
+
+	if (errorCode == JsErrorOutOfMemory)
+	{
+		throw NativeScriptError(L"out of memory");
+	}
+
+	IfFailScriptError(errorCode, L"failed to run script.");
 
 	return result;
 }
 
+//
+// Callback for a full garbage collection of the script's runtime, for scripts that know a good
+// moment better than the engine does.
+//
+
+static void CollectGarbage()
+{
+	IfFailScriptError(gcScheduler.Collect(), L"unable to collect garbage");
+}
+
+//
+// Callback returning the script's runtime's collections so far: counts, pause times, heap size and
+// the most recent collections.
+//
+
+static JsValueRef GcStats()
+{
+	JsValueRef stats;
+	IfFailScriptError(gcScheduler.GetStats(&stats), L"unable to get GC statistics");
+	return stats;
+}
+
 //
 // Helper to define a host callback method on the global host object.
 //
 
-JsErrorCode DefineHostCallback(JsValueRef globalObject, const wchar_t *callbackName, JsNativeFunction callback, void *callbackState)
+JsErrorCode DefineHostCallback(JsValueRef globalObject, PropertyId callbackId, JsNativeFunction callback, void *callbackState)
 {
 	//
 	// Get property ID.
 	//
 
 	JsPropertyIdRef propertyId;
-	IfFailRet(JsGetPropertyIdFromName(callbackName, &propertyId));
+	IfFailRet(PropertyIds::Get(callbackId, &propertyId));
 
 	//
 	// Create a function
@@ -189,6 +421,136 @@ JsErrorCode DefineHostCallback(JsValueRef globalObject, const wchar_t *callbackN
 	return JsNoError;
 }
 
+//
+// Sets host.arguments in the current context.
+//
+
+JsErrorCode SetHostArguments(int argc, wchar_t *argv [], int argumentsStart)
+{
+	//
+	// Get the host object.
+	//
+
+	JsValueRef globalObject;
+	IfFailRet(JsGetGlobalObject(&globalObject));
+
+	JsPropertyIdRef hostPropertyId;
+	IfFailRet(PropertyIds::Get(PropertyIdHost, &hostPropertyId));
+
+	JsValueRef hostObject;
+	IfFailRet(JsGetProperty(globalObject, hostPropertyId, &hostObject));
+
+	//
+	// Create an array for arguments.
+	//
+
+	JsValueRef arguments;
+	IfFailRet(JsCreateArray(argc - argumentsStart, &arguments));
+
+	for (int index = argumentsStart; index < argc; index++)
+	{
+		//
+		// Create the argument value.
+		//
+
+		JsValueRef argument;
+		IfFailRet(JsPointerToString(argv[index], wcslen(argv[index]), &argument));
+
+		//
+		// Create the index.
+		//
+
+		JsValueRef indexValue;
+		IfFailRet(JsIntToNumber(index - argumentsStart, &indexValue));
+
+		//
+		// Set the value.
+		//
+
+		IfFailRet(JsSetIndexedProperty(arguments, indexValue, argument));
+	}
+
+	//
+	// Get the name of the property that we're going to set on the host object.
+	//
+
+	JsPropertyIdRef argumentsPropertyId;
+	IfFailRet(PropertyIds::Get(PropertyIdArguments, &argumentsPropertyId));
+
+	//
+	// Set the arguments property.
+	//
+
+	IfFailRet(JsSetProperty(hostObject, argumentsPropertyId, arguments, true));
+
+	return JsNoError;
+}
+
+//
+// Creates a runtime with the host's settings.
+//
+
+JsErrorCode CreateHostRuntime(JsRuntimeHandle *runtime)
+{
+	//
+	// With a background work pool, the engine's background work runs on the pool's threads
+	// instead of threads of the runtime's own. Script interrupts let the watchdog stop scripts that
+	// run over their budget, and with a memory limit, running out of memory has to fail the script
+	// rather than the process. SharedArrayBuffer is one of the engine's experimental features, and
+	// a GC policy other than none has the engine hand its idle work to JsIdle.
+	//
+
+	JsRuntimeAttributes attributes = JsRuntimeAttributeAllowScriptInterrupt;
+	if (memoryMonitor.limit > 0)
+	{
+		attributes = (JsRuntimeAttributes) (attributes | JsRuntimeAttributeDisableFatalOnOOM);
+	}
+
+	if (enableSharedMemory)
+	{
+		attributes = (JsRuntimeAttributes) (attributes | JsRuntimeAttributeEnableExperimentalFeatures);
+	}
+
+	if (gcScheduler.policy != GcPolicyNone)
+	{
+		attributes = (JsRuntimeAttributes) (attributes | JsRuntimeAttributeEnableIdleProcessing);
+	}
+
+	IfFailRet(JsCreateRuntime(attributes, BackgroundWorkPool::instance != nullptr ? BackgroundWorkPool::ThreadService : nullptr, runtime));
+
+	JsErrorCode errorCode = memoryMonitor.Attach(*runtime);
+	if (errorCode == JsNoError)
+	{
+		errorCode = gcScheduler.Attach(*runtime, memoryMonitor.GetUsage(*runtime));
+		if (errorCode != JsNoError)
+		{
+			memoryMonitor.Detach(*runtime);
+		}
+	}
+
+	if (errorCode != JsNoError)
+	{
+		JsDisposeRuntime(*runtime);
+		*runtime = JS_INVALID_RUNTIME_HANDLE;
+		return errorCode;
+	}
+
+	PropertyIds::Attach(*runtime);
+	return JsNoError;
+}
+
+//
+// Disposes a runtime created with CreateHostRuntime.
+//
+
+JsErrorCode DisposeHostRuntime(JsRuntimeHandle runtime)
+{
+	PropertyIds::Detach(runtime);
+	gcScheduler.Detach(runtime);
+	memoryMonitor.Detach(runtime);
+	return JsDisposeRuntime(runtime);
+}
+
 //
 // Creates a host execution context and sets up the host object in it.
 //
@@ -226,7 +588,7 @@ JsErrorCode CreateHostContext(JsRuntimeHandle runtime, int argc, wchar_t *argv [
 	//
 
 	JsPropertyIdRef hostPropertyId;
-	IfFailRet(JsGetPropertyIdFromName(L"host", &hostPropertyId));
+	IfFailRet(PropertyIds::Get(PropertyIdHost, &hostPropertyId));
 
 	//
 	// Set the property.
@@ -238,51 +600,26 @@ JsErrorCode CreateHostContext(JsRuntimeHandle runtime, int argc, wchar_t *argv [
 	// Now create the host callbacks that we're going to expose to the script.
 	//
 
-	IfFailRet(DefineHostCallback(hostObject, L"echo", Echo, nullptr));
-    IfFailRet(DefineHostCallback(hostObject, L"runScript", RunScript, nullptr));
-
-	//
-	// Create an array for arguments.
-	//
-
-	JsValueRef arguments;
-	IfFailRet(JsCreateArray(argc - argumentsStart, &arguments));
-
-	for (int index = argumentsStart; index < argc; index++)
-	{
-		//
-		// Create the argument value.
-		//
-
-		JsValueRef argument;
-		IfFailRet(JsPointerToString(argv[index], wcslen(argv[index]), &argument));
-
-		//
-		// Create the index.
-		//
-
-		JsValueRef indexValue;
-		IfFailRet(JsIntToNumber(index - argumentsStart, &indexValue));
-
-		//
-		// Set the value.
-		//
-
-		IfFailRet(JsSetIndexedProperty(arguments, indexValue, argument));
-	}
+	IfFailRet(DefineHostCallback(hostObject, PropertyIdEcho, NATIVE_FUNCTION(Echo), nullptr));
+	IfFailRet(DefineHostCallback(hostObject, PropertyIdWrite, NATIVE_FUNCTION(Write), nullptr));
+	IfFailRet(DefineHostCallback(hostObject, PropertyIdMapFile, NATIVE_FUNCTION(MapFile), nullptr));
+	IfFailRet(DefineHostCallback(hostObject, PropertyIdReadFileInto, NATIVE_FUNCTION(ReadFileInto), nullptr));
+    IfFailRet(DefineHostCallback(hostObject, PropertyIdRunScript, NATIVE_FUNCTION(RunScript), nullptr));
+	IfFailRet(DefineHostCallback(hostObject, PropertyIdCollectGarbage, NATIVE_FUNCTION(CollectGarbage), nullptr));
+	IfFailRet(DefineHostCallback(hostObject, PropertyIdGcStats, NATIVE_FUNCTION(GcStats), nullptr));
 
 	//
-	// Get the name of the property that we're going to set on the host object.
+	// Promise continuations, timers and asynchronous reads go through the event loop.
 	//
 
-	JsPropertyIdRef argumentsPropertyId;
-	IfFailRet(JsGetPropertyIdFromName(L"arguments", &argumentsPropertyId));
+	IfFailRet(EventLoop::Install(globalObject, hostObject));
+	IfFailRet(Worker::Install(hostObject));
 
 	//
-	// Set the arguments property.
+	// Set up host.arguments.
 	//
 
-	IfFailRet(JsSetProperty(hostObject, argumentsPropertyId, arguments, true));
+	IfFailRet(SetHostArguments(argc, argv, argumentsStart));
 
 	//
 	// Clean up the current execution context.
@@ -294,10 +631,10 @@ JsErrorCode CreateHostContext(JsRuntimeHandle runtime, int argc, wchar_t *argv [
 }
 
 //
-// Print out a script exception.
+// Get the message of the current script exception, clearing the exception.
 //
 
-JsErrorCode PrintScriptException()
+JsErrorCode GetAndClearExceptionMessage(wstring &message)
 {
 	//
 	// Get script exception.
@@ -311,37 +648,124 @@ JsErrorCode PrintScriptException()
 	//
 
 	JsPropertyIdRef messageName;
-	IfFailRet(JsGetPropertyIdFromName(L"message", &messageName));
+	IfFailRet(PropertyIds::Get(PropertyIdMessage, &messageName));
 
 	JsValueRef messageValue;
 	IfFailRet(JsGetProperty(exception, messageName, &messageValue));
 
-	const wchar_t *message;
+	const wchar_t *messageString;
 	size_t length;
-	IfFailRet(JsStringToPointer(messageValue, &message, &length));
+	IfFailRet(JsStringToPointer(messageValue, &messageString, &length));
 
-	fwprintf(stderr, L"chakrahost: exception: %s\n", message);
+	message.assign(messageString, length);
 
 	return JsNoError;
 }
 
 //
-// The main entry point for the host.
+// Print out a script exception.
 //
 
-int _cdecl wmain(int argc, wchar_t *argv[])
+JsErrorCode PrintScriptException()
 {
-	int returnValue = EXIT_FAILURE;
-	CommandLineArguments arguments;
-	
-	arguments.argumentsStart = 1;
+	wstring message;
+	IfFailRet(GetAndClearExceptionMessage(message));
+
+	fwprintf(stderr, L"chakrahost: exception: %s\n", message.c_str());
 
-	if (argc - arguments.argumentsStart < 1)
+	return JsNoError;
+}
+
+//
+// Load a script from disk and run it.
+//
+
+JsErrorCode RunScriptFile(const wchar_t *fileName, JsValueRef *result)
+{
+	//
+	// Load the script from the disk.
+	//
+
+	JsValueRef script;
+	IfFailRet(LoadScript(fileName, &script));
+
+	//
+	// Run the script.
+	//
+
+	return scriptCache.RunScript(script, currentSourceContext++, fileName, result);
+}
+
+JsErrorCode RunScriptFile(const wchar_t *fileName, const ScriptBudget &budget, JsValueRef *result)
+{
+	JsErrorCode errorCode = watchdog.Run(fileName, budget, [&] { return RunScriptFile(fileName, result); });
+	if (errorCode == JsErrorOutOfMemory)
 	{
-		fwprintf(stderr, L"usage: chakrahost <script name> <arguments>\n");
-		return returnValue;
+		fwprintf(stderr, L"chakrahost: out of memory: %s.\n", fileName);
+	}
+
+	return errorCode;
+}
+
+JsErrorCode RunJob(const wchar_t *name, const ScriptBudget &budget, const function<JsErrorCode()> &run)
+{
+	EventLoop *eventLoop = EventLoop::Current();
+
+	gcScheduler.EnterJob(name);
+	JsErrorCode errorCode = watchdog.Run(name, budget, [&]
+	{
+		IfFailRet(run());
+		return eventLoop->Run();
+	});
+	gcScheduler.LeaveJob();
+
+	if (errorCode != JsNoError)
+	{
+		eventLoop->Reset();
+	}
+
+	if (errorCode == JsErrorOutOfMemory)
+	{
+		fwprintf(stderr, L"chakrahost: out of memory: %s.\n", name);
 	}
 
+	return errorCode;
+}
+
+JsErrorCode RunScriptJob(const wchar_t *fileName, const ScriptBudget &budget, JsValueRef *result)
+{
+	return RunJob(fileName, budget, [&] { return RunScriptFile(fileName, result); });
+}
+
+//
+// Convert a script result to the host's exit value.
+//
+
+JsErrorCode GetExitValue(JsValueRef result, int *exitValue)
+{
+	JsValueRef numberResult;
+	double doubleResult;
+	IfFailRet(JsConvertValueToNumber(result, &numberResult));
+	IfFailRet(JsNumberToDouble(numberResult, &doubleResult));
+	*exitValue = (int) doubleResult;
+
+	return JsNoError;
+}
+
+//
+// Run the script named on the command line in a runtime of its own.
+//
+
+static int RunMainScript(int argc, wchar_t *argv[], int argumentsStart, bool module)
+{
+	int returnValue = EXIT_FAILURE;
+
+	//
+	// Background work for this runtime is the work someone is waiting on.
+	//
+
+	BackgroundWorkPool::SetCallerPriority(BackgroundWorkPriorityHigh);
+
 	try
 	{
 		JsRuntimeHandle runtime;
@@ -351,14 +775,14 @@ int _cdecl wmain(int argc, wchar_t *argv[])
 		// Create the runtime. We're only going to use one runtime for this host.
 		//
 
-		IfFailError(JsCreateRuntime(JsRuntimeAttributeNone, nullptr, &runtime), L"failed to create runtime.");
+		IfFailError(CreateHostRuntime(&runtime), L"failed to create runtime.");
 
 		//
 		// Similarly, create a single execution context. Note that we're putting it on the stack here,
 		// so it will stay alive through the entire run.
 		//
 
-		IfFailError(CreateHostContext(runtime, argc, argv, arguments.argumentsStart, &context), L"failed to create execution context.");
+		IfFailError(CreateHostContext(runtime, argc, argv, argumentsStart, &context), L"failed to create execution context.");
 
 		//
 		// Now set the execution context as being the current one on this thread.
@@ -367,42 +791,47 @@ int _cdecl wmain(int argc, wchar_t *argv[])
 		IfFailError(JsSetCurrentContext(context), L"failed to set current context.");
 
 		//
-		// Load the script from the disk.
+		// Load the script from the disk and run it. A module has no completion value, so it exits
+		// with zero unless it throws.
 		//
 
-		wstring script = LoadScript(argv[arguments.argumentsStart]);
-		if (script.empty())
+		JsValueRef result;
+		JsErrorCode errorCode;
+
+		if (module)
 		{
-			goto error;
+			ModuleLoader moduleLoader(thread::hardware_concurrency());
+			errorCode = RunJob(argv[argumentsStart], watchdog.defaultBudget, [&] { return moduleLoader.RunModule(argv[argumentsStart], &result); });
+		}
+		else
+		{
+			errorCode = RunScriptJob(argv[argumentsStart], watchdog.defaultBudget, &result);
 		}
 
-		//
-		// Run the script.
-		//
-
-		JsValueRef result;
-		JsErrorCode errorCode = JsRunScript(script.c_str(), currentSourceContext++, argv[arguments.argumentsStart], &result);
-		
 		if (errorCode == JsErrorScriptException)
 		{
 			IfFailError(PrintScriptException(), L"failed to print exception");
-			return EXIT_FAILURE;
 		}
-		else
+		else if (errorCode != JsErrorInvalidArgument && errorCode != JsErrorScriptTerminated && errorCode != JsErrorOutOfMemory)
 		{
 			IfFailError(errorCode, L"failed to run script.");
-		}
 
-		//
-		// Convert the return value.
-		//
-
-		JsValueRef numberResult;
-		double doubleResult;
-		IfFailError(JsConvertValueToNumber(result, &numberResult), L"failed to convert return value.");
-		IfFailError(JsNumberToDouble(numberResult, &doubleResult), L"failed to convert return value.");
-		returnValue = (int) doubleResult;
-		cout << returnValue << endl;
+			//
+			// Convert the return value.
+			//
+
+			if (module)
+			{
+				returnValue = EXIT_SUCCESS;
+			}
+			else
+			{
+				IfFailError(GetExitValue(result, &returnValue), L"failed to convert return value.");
+			}
+
+			HostOutput::Flush();
+			cout << returnValue << endl;
+		}
 
 		//
 		// Clean up the current execution context.
@@ -414,7 +843,7 @@ int _cdecl wmain(int argc, wchar_t *argv[])
 		// Clean up the runtime.
 		//
 
-		IfFailError(JsDisposeRuntime(runtime), L"failed to cleanup runtime.");
+		IfFailError(DisposeHostRuntime(runtime), L"failed to cleanup runtime.");
 	}
 	catch (...)
 	{
@@ -424,3 +853,294 @@ int _cdecl wmain(int argc, wchar_t *argv[])
 error:
 	return returnValue;
 }
+
+//
+// The main entry point for the host.
+//
+
+int _cdecl wmain(int argc, wchar_t *argv[])
+{
+	int returnValue = EXIT_FAILURE;
+	CommandLineArguments arguments;
+	
+	arguments.argumentsStart = 1;
+
+	//
+	// Parse host options, which come before the script name.
+	//
+
+	while (arguments.argumentsStart < argc && wcsncmp(argv[arguments.argumentsStart], L"--", 2) == 0)
+	{
+		wstring option = argv[arguments.argumentsStart++];
+
+		if (option == L"--cache-dir" && arguments.argumentsStart < argc)
+		{
+			arguments.cacheDirectory = argv[arguments.argumentsStart++];
+		}
+		else if (option == L"--cache-stats")
+		{
+			arguments.printCacheStatistics = true;
+		}
+		else if (option == L"--server" && arguments.argumentsStart < argc)
+		{
+			arguments.serverName = argv[arguments.argumentsStart++];
+		}
+		else if (option == L"--warmup" && arguments.argumentsStart < argc)
+		{
+			arguments.warmupScript = argv[arguments.argumentsStart++];
+		}
+		else if (option == L"--submit" && arguments.argumentsStart < argc)
+		{
+			arguments.submitName = argv[arguments.argumentsStart++];
+		}
+		else if (option == L"--bench" && arguments.argumentsStart < argc)
+		{
+			arguments.benchIterations = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--bench-warmup" && arguments.argumentsStart < argc)
+		{
+			arguments.benchWarmup = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--bench-json")
+		{
+			arguments.benchJson = true;
+		}
+		else if (option == L"--stream" && arguments.argumentsStart < argc)
+		{
+			arguments.streamInput = argv[arguments.argumentsStart++];
+		}
+		else if (option == L"--stream-batch" && arguments.argumentsStart < argc)
+		{
+			arguments.streamBatchSize = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--property-bench" && arguments.argumentsStart < argc)
+		{
+			arguments.propertyBenchmarkIterations = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--native-bench" && arguments.argumentsStart < argc)
+		{
+			arguments.nativeBenchmarkCalls = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--shared-bench" && arguments.argumentsStart < argc)
+		{
+			arguments.sharedBenchmarkThreads = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--shared-bench-elements" && arguments.argumentsStart < argc)
+		{
+			arguments.sharedBenchmarkElements = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--shared-memory")
+		{
+			enableSharedMemory = true;
+		}
+		else if (option == L"--pool-bench" && arguments.argumentsStart < argc)
+		{
+			arguments.poolBenchmarkJobs = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--pool-size" && arguments.argumentsStart < argc)
+		{
+			arguments.poolSize = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--pool-reuse" && arguments.argumentsStart < argc)
+		{
+			arguments.poolMaxReuse = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--batch" && arguments.argumentsStart < argc)
+		{
+			arguments.batchSource = argv[arguments.argumentsStart++];
+		}
+		else if (option == L"--jobs" && arguments.argumentsStart < argc)
+		{
+			arguments.jobs = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--background-threads" && arguments.argumentsStart < argc)
+		{
+			arguments.backgroundThreads = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--background-stats")
+		{
+			arguments.printBackgroundStatistics = true;
+		}
+		else if (option == L"--timeout" && arguments.argumentsStart < argc)
+		{
+			watchdog.defaultBudget.timeoutMs = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--cpu-timeout" && arguments.argumentsStart < argc)
+		{
+			watchdog.defaultBudget.cpuTimeoutMs = _wtoi(argv[arguments.argumentsStart++]);
+		}
+		else if (option == L"--memory-limit" && arguments.argumentsStart < argc)
+		{
+			memoryMonitor.limit = (size_t) _wtoi(argv[arguments.argumentsStart++]) * 1024 * 1024;
+		}
+		else if (option == L"--memory-stats")
+		{
+			arguments.printMemoryStatistics = true;
+		}
+		else if (option == L"--gc-policy" && arguments.argumentsStart < argc &&
+			GcScheduler::ParsePolicy(argv[arguments.argumentsStart], &gcScheduler.policy))
+		{
+			arguments.argumentsStart++;
+		}
+		else if (option == L"--gc-stats")
+		{
+			arguments.printGcStatistics = true;
+		}
+		else if (option == L"--gc-trace" && arguments.argumentsStart < argc)
+		{
+			gcScheduler.traceFile = argv[arguments.argumentsStart++];
+		}
+		else if (option == L"--memory-report" && arguments.argumentsStart < argc)
+		{
+			arguments.memoryReport = argv[arguments.argumentsStart++];
+		}
+		else if (option == L"--module")
+		{
+			arguments.module = true;
+		}
+		else if (option == L"--output-flush" && arguments.argumentsStart < argc &&
+			HostOutput::ParseFlushPolicy(argv[arguments.argumentsStart], &arguments.outputFlushPolicy))
+		{
+			arguments.argumentsStart++;
+		}
+		else if (option == L"--pool-reset" && arguments.argumentsStart < argc &&
+			RuntimePool::ParseResetStrategy(argv[arguments.argumentsStart], &arguments.poolResetStrategy))
+		{
+			arguments.argumentsStart++;
+		}
+		else
+		{
+			fwprintf(stderr, L"chakrahost: unknown option: %s.\n", option.c_str());
+			return returnValue;
+		}
+	}
+
+	if (!arguments.cacheDirectory.empty() && !scriptCache.SetDirectory(arguments.cacheDirectory))
+	{
+		return returnValue;
+	}
+
+	if (arguments.serverName.empty() && arguments.batchSource.empty() && arguments.propertyBenchmarkIterations == 0 && arguments.nativeBenchmarkCalls == 0 && arguments.sharedBenchmarkThreads == 0 && argc - arguments.argumentsStart < 1)
+	{
+		fwprintf(stderr, L"usage: chakrahost [--cache-dir <directory>] [--cache-stats] [--module] [--shared-memory] [--timeout <ms>] [--cpu-timeout <ms>] <script name> <arguments>\n");
+		fwprintf(stderr, L"       chakrahost [--cache-dir <directory>] --server <name> [--warmup <script name>]\n");
+		fwprintf(stderr, L"       chakrahost --submit <name> <script name> <arguments>    (output goes to the server's stdout)\n");
+		fwprintf(stderr, L"       chakrahost --batch <directory or list file> [--jobs <threads>] [--pool-reuse <jobs>] [--pool-reset none|context|runtime]\n");
+		fwprintf(stderr, L"       chakrahost --bench <iterations> [--bench-warmup <iterations>] [--bench-json] <script name> <arguments>\n");
+		fwprintf(stderr, L"       chakrahost --stream <input file or -> [--stream-batch <lines>] <script name> <arguments>\n");
+		fwprintf(stderr, L"       chakrahost --pool-bench <jobs> [--pool-size <runtimes>] [--pool-reuse <jobs>] [--pool-reset none|context|runtime] <script name>\n");
+		fwprintf(stderr, L"       chakrahost --property-bench <lookups>\n");
+		fwprintf(stderr, L"       chakrahost --native-bench <calls>\n");
+		fwprintf(stderr, L"       chakrahost --shared-bench <threads> [--shared-bench-elements <count>]\n");
+		return returnValue;
+	}
+
+	HostOutput::Initialize(arguments.outputFlushPolicy);
+
+	//
+	// Share one set of background threads between all the runtimes we create.
+	//
+
+	unique_ptr<BackgroundWorkPool> backgroundWorkPool;
+	if (arguments.backgroundThreads > 0)
+	{
+		backgroundWorkPool.reset(new BackgroundWorkPool(arguments.backgroundThreads));
+		BackgroundWorkPool::instance = backgroundWorkPool.get();
+	}
+
+	if (!arguments.serverName.empty())
+	{
+		//
+		// In server mode, scripts arrive over the pipe instead of the command line.
+		//
+
+		returnValue = RunScriptServer(arguments.serverName, arguments.warmupScript);
+	}
+	else if (!arguments.batchSource.empty())
+	{
+		returnValue = RunBatch(arguments.batchSource, arguments.jobs > 0 ? arguments.jobs : 1, arguments.poolMaxReuse, arguments.poolResetStrategy);
+	}
+	else if (!arguments.submitName.empty())
+	{
+		returnValue = SubmitScriptJob(arguments.submitName, argc, argv, arguments.argumentsStart);
+	}
+	else if (!arguments.streamInput.empty())
+	{
+		returnValue = RunStream(argc, argv, arguments.argumentsStart, arguments.streamInput, arguments.streamBatchSize);
+	}
+	else if (arguments.benchIterations > 0)
+	{
+		returnValue = RunScriptBenchmark(argc, argv, arguments.argumentsStart, arguments.benchIterations, arguments.benchWarmup, arguments.benchJson);
+	}
+	else if (arguments.propertyBenchmarkIterations > 0)
+	{
+		returnValue = RunPropertyIdBenchmark(arguments.propertyBenchmarkIterations);
+	}
+	else if (arguments.nativeBenchmarkCalls > 0)
+	{
+		returnValue = RunNativeFunctionBenchmark(arguments.nativeBenchmarkCalls);
+	}
+	else if (arguments.sharedBenchmarkThreads > 0)
+	{
+		returnValue = RunSharedMemoryBenchmark(arguments.sharedBenchmarkThreads, arguments.sharedBenchmarkElements);
+	}
+	else if (arguments.poolBenchmarkJobs > 0)
+	{
+		returnValue = RunPoolBenchmark(argv[arguments.argumentsStart], arguments.poolBenchmarkJobs, arguments.poolSize, arguments.poolMaxReuse, arguments.poolResetStrategy);
+	}
+	else
+	{
+		//
+		// Scripts named *.mjs are modules without being told.
+		//
+
+		wstring scriptName = argv[arguments.argumentsStart];
+		bool module = arguments.module || (scriptName.length() > 4 && _wcsicmp(scriptName.c_str() + scriptName.length() - 4, L".mjs") == 0);
+
+		returnValue = RunMainScript(argc, argv, arguments.argumentsStart, module);
+	}
+
+	//
+	// Workers a job gave up on may still be shutting down.
+	//
+
+	Worker::WaitForAll();
+	HostOutput::Flush();
+
+	if (arguments.printCacheStatistics)
+	{
+		scriptCache.PrintStatistics();
+	}
+
+	if (arguments.printMemoryStatistics)
+	{
+		memoryMonitor.PrintStatistics();
+	}
+
+	if (arguments.printGcStatistics)
+	{
+		gcScheduler.PrintStatistics();
+	}
+
+	if (!gcScheduler.traceFile.empty())
+	{
+		gcScheduler.WriteTrace();
+	}
+
+	if (!arguments.memoryReport.empty())
+	{
+		memoryMonitor.WriteReport(arguments.memoryReport);
+	}
+
+	if (backgroundWorkPool && arguments.printBackgroundStatistics)
+	{
+		backgroundWorkPool->PrintStatistics();
+	}
+
+	//
+	// All runtimes are gone by now, so no more background work can arrive.
+	//
+
+	BackgroundWorkPool::instance = nullptr;
+	return returnValue;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "ScriptCache.h"
+#include "Watchdog.h"
+#include "MemoryMonitor.h"
+#include "GcScheduler.h"
+#include "PropertyIds.h"
+#include <string>
+#include <atomic>
+#include <functional>
+
+//
+// Pieces of the host shared between its run modes.
+//
+
+extern std::atomic<unsigned> currentSourceContext;
+extern ScriptCache scriptCache;
+extern Watchdog watchdog;
+extern MemoryMonitor memoryMonitor;
+extern GcScheduler gcScheduler;
+
+//
+// Whether runtimes get SharedArrayBuffer and Atomics, which ChakraCore only has as an experimental
+// feature.
+//
+
+extern bool enableSharedMemory;
+
+void ThrowException(std::wstring errorString);
+JsErrorCode CreateHostRuntime(JsRuntimeHandle *runtime);
+JsErrorCode DisposeHostRuntime(JsRuntimeHandle runtime);
+JsErrorCode SetHostArguments(int argc, wchar_t *argv [], int argumentsStart);
+JsErrorCode DefineHostCallback(JsValueRef object, PropertyId callbackId, JsNativeFunction callback, void *callbackState);
+JsErrorCode CreateHostContext(JsRuntimeHandle runtime, int argc, wchar_t *argv [], int argumentsStart, JsContextRef *context);
+JsErrorCode GetAndClearExceptionMessage(std::wstring &message);
+JsErrorCode PrintScriptException();
+
+//
+// Loads a script from disk and runs it in the current context, through the bytecode cache.
+//
+
+JsErrorCode RunScriptFile(const wchar_t *fileName, JsValueRef *result);
+
+//
+// The same, under a budget enforced by the watchdog. See Watchdog::Run for what a timeout returns.
+// Timeouts and running out of memory (JsErrorOutOfMemory) are reported here.
+//
+
+JsErrorCode RunScriptFile(const wchar_t *fileName, const ScriptBudget &budget, JsValueRef *result);
+
+//
+// Run a job in the current context under a budget: `run` starts it, then the thread's event loop
+// runs until the job's asynchronous work is done. If the job fails, its remaining work is dropped.
+// RunScriptJob runs a script file this way.
+//
+
+JsErrorCode RunJob(const wchar_t *name, const ScriptBudget &budget, const std::function<JsErrorCode()> &run);
+JsErrorCode RunScriptJob(const wchar_t *fileName, const ScriptBudget &budget, JsValueRef *result);
+
+//
+// Converts a script's completion value to the host's exit value.
+//
+
+JsErrorCode GetExitValue(JsValueRef result, int *exitValue);
@@ -0,0 +1,653 @@
+#include "stdafx.h"
+#include "ChakraCoreHost.h"
+#include "EventLoop.h"
+#include "ScriptLoader.h"
+#include <climits>
+#include <cstring>
+
+using namespace std;
+using namespace std::chrono;
+
+//
+// Reads are issued in chunks of this size until the end of the file or pipe.
+//
+
+static const DWORD readChunkSize = 64 * 1024;
+
+EventLoop::EventLoop() :
+	nextTimerId(1)
+{
+	completionPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, nullptr, 0, 1);
+}
+
+EventLoop::~EventLoop()
+{
+	if (completionPort != nullptr)
+	{
+		CloseHandle(completionPort);
+	}
+}
+
+EventLoop *EventLoop::Current()
+{
+	static thread_local EventLoop eventLoop;
+	return &eventLoop;
+}
+
+JsErrorCode EventLoop::Install(JsValueRef globalObject, JsValueRef hostObject)
+{
+	IfFailRet(JsSetPromiseContinuationCallback(PromiseContinuation, nullptr));
+
+	//
+	// SetTimer's callback state says whether the timer repeats.
+	//
+
+	IfFailRet(DefineHostCallback(globalObject, PropertyIdSetTimeout, SetTimer, nullptr));
+	IfFailRet(DefineHostCallback(globalObject, PropertyIdSetInterval, SetTimer, (void *) 1));
+	IfFailRet(DefineHostCallback(globalObject, PropertyIdClearTimeout, ClearTimer, nullptr));
+	IfFailRet(DefineHostCallback(globalObject, PropertyIdClearInterval, ClearTimer, nullptr));
+	IfFailRet(DefineHostCallback(hostObject, PropertyIdReadFile, HostReadFile, nullptr));
+
+	return JsNoError;
+}
+
+JsErrorCode EventLoop::Run()
+{
+	for (;;)
+	{
+		IfFailRet(RunMicrotasks());
+
+		//
+		// Script has returned to the loop, so a collection it started is over.
+		//
+
+		GcScheduler::EndCollection();
+
+		//
+		// Run the next timer if it's due. Cleared timers are left in the heap and skipped here.
+		//
+
+		while (!timerQueue.empty() && timers.find(timerQueue.top().id) == timers.end())
+		{
+			timerQueue.pop();
+		}
+
+		steady_clock::time_point now = steady_clock::now();
+
+		if (!timerQueue.empty() && timerQueue.top().due <= now)
+		{
+			TimerDue due = timerQueue.top();
+			timerQueue.pop();
+			IfFailRet(RunTimer(due));
+			continue;
+		}
+
+		if (timerQueue.empty() && reads.empty() && !HasActiveSources())
+		{
+			return JsNoError;
+		}
+
+		//
+		// Wait for a read to complete, a message to arrive, or until the next timer is due.
+		//
+
+		DWORD timeout = INFINITE;
+		if (!timerQueue.empty())
+		{
+			long long wait = duration_cast<milliseconds>(timerQueue.top().due - now).count() + 1;
+			timeout = (DWORD) min(wait, (long long) INFINITE - 1);
+		}
+
+		//
+		// About to wait anyway, so give the engine its idle time first.
+		//
+
+		timeout = min(timeout, gcScheduler.RunIdleWork());
+
+		DWORD bytes;
+		ULONG_PTR key;
+		OVERLAPPED *overlapped = nullptr;
+		BOOL succeeded = GetQueuedCompletionStatus(completionPort, &bytes, &key, &overlapped, timeout);
+
+		//
+		// Wake-ups from other threads carry a message source as their key. A source may have been
+		// closed since it was posted, so the key is only used if it's still registered. The watchdog
+		// wakes the loop without a source when it stops the job, which ends the loop here rather
+		// than when the next timer or read is due.
+		//
+
+		if (overlapped == nullptr)
+		{
+			if (succeeded && sources.find((MessageSource *) key) != sources.end())
+			{
+				IfFailRet(DeliverMessages((MessageSource *) key));
+			}
+			else if (succeeded && key == 0 && IsExecutionDisabled())
+			{
+				return JsErrorScriptTerminated;
+			}
+
+			continue;
+		}
+
+		Read *read = (Read *) overlapped;
+		DWORD error = succeeded ? ERROR_SUCCESS : GetLastError();
+
+		if (succeeded && bytes > 0)
+		{
+			read->offset += bytes;
+			if (IssueRead(read, &error))
+			{
+				continue;
+			}
+		}
+		else if (succeeded)
+		{
+			error = ERROR_HANDLE_EOF;
+		}
+
+		IfFailRet(CompleteRead(read, error));
+	}
+}
+
+//
+// Each message is a macrotask of its own, so microtasks run after each one.
+//
+
+JsErrorCode EventLoop::DeliverMessages(MessageSource *source)
+{
+	for (;;)
+	{
+		bool delivered;
+		IfFailRet(source->DeliverNext(&delivered));
+
+		if (!delivered)
+		{
+			return JsNoError;
+		}
+
+		IfFailRet(RunMicrotasks());
+	}
+}
+
+//
+// Whether the watchdog has disabled execution in the current context's runtime.
+//
+
+bool EventLoop::IsExecutionDisabled()
+{
+	JsContextRef context;
+	JsRuntimeHandle runtime;
+	bool disabled = false;
+	if (JsGetCurrentContext(&context) == JsNoError && context != JS_INVALID_REFERENCE && JsGetRuntime(context, &runtime) == JsNoError)
+	{
+		JsIsRuntimeExecutionDisabled(runtime, &disabled);
+	}
+
+	return disabled;
+}
+
+//
+// Close the sources that are done, and say whether any are left.
+//
+
+bool EventLoop::HasActiveSources()
+{
+	for (auto source = sources.begin(); source != sources.end();)
+	{
+		if ((*source)->IsActive())
+		{
+			++source;
+			continue;
+		}
+
+		MessageSource *closed = *source;
+		source = sources.erase(source);
+		closed->Close();
+	}
+
+	return !sources.empty();
+}
+
+void EventLoop::AddSource(MessageSource *source)
+{
+	sources.insert(source);
+}
+
+HANDLE EventLoop::OpenWakeHandle()
+{
+	HANDLE wakeHandle;
+	if (!DuplicateHandle(GetCurrentProcess(), completionPort, GetCurrentProcess(), &wakeHandle, 0, FALSE, DUPLICATE_SAME_ACCESS))
+	{
+		return nullptr;
+	}
+
+	return wakeHandle;
+}
+
+void EventLoop::Wake(HANDLE wakeHandle, MessageSource *source)
+{
+	PostQueuedCompletionStatus(wakeHandle, 0, (ULONG_PTR) source, nullptr);
+}
+
+void EventLoop::Reset()
+{
+	set<MessageSource *> closing;
+	closing.swap(sources);
+
+	for (MessageSource *source : closing)
+	{
+		source->Close();
+	}
+
+	for (JsValueRef task : microtasks)
+	{
+		JsRelease(task, nullptr);
+	}
+
+	microtasks.clear();
+
+	for (auto &timer : timers)
+	{
+		ReleaseTimer(timer.second);
+	}
+
+	timers.clear();
+	timerQueue = decltype(timerQueue)();
+
+	//
+	// Cancel outstanding reads and wait for them, since the system still owns their buffers.
+	//
+
+	for (Read *read : reads)
+	{
+		CancelIoEx(read->file, nullptr);
+	}
+
+	while (!reads.empty())
+	{
+		DWORD bytes;
+		ULONG_PTR key;
+		OVERLAPPED *overlapped = nullptr;
+		GetQueuedCompletionStatus(completionPort, &bytes, &key, &overlapped, INFINITE);
+
+		if (overlapped != nullptr)
+		{
+			Read *read = (Read *) overlapped;
+			reads.erase(read);
+
+			CloseHandle(read->file);
+			JsRelease(read->resolve, nullptr);
+			JsRelease(read->reject, nullptr);
+			delete read->data;
+			delete read;
+		}
+	}
+}
+
+JsErrorCode EventLoop::RunMicrotasks()
+{
+	JsValueRef undefined;
+	IfFailRet(JsGetUndefinedValue(&undefined));
+
+	while (!microtasks.empty())
+	{
+		JsValueRef task = microtasks.front();
+		microtasks.pop_front();
+
+		JsValueRef result;
+		JsErrorCode errorCode = JsCallFunction(task, &undefined, 1, &result);
+		JsRelease(task, nullptr);
+		IfFailRet(errorCode);
+	}
+
+	return JsNoError;
+}
+
+JsErrorCode EventLoop::RunTimer(const TimerDue &due)
+{
+	unsigned id = due.id;
+	auto entry = timers.find(id);
+	Timer timer = entry->second;
+
+	//
+	// A timeout is gone before its callback runs, so clearing it from the callback is harmless;
+	// an interval stays until it's cleared.
+	//
+
+	if (!timer.repeat)
+	{
+		timers.erase(entry);
+	}
+
+	vector<JsValueRef> arguments(timer.callback.begin(), timer.callback.end());
+	IfFailRet(JsGetUndefinedValue(&arguments[0]));
+
+	JsValueRef result;
+	JsErrorCode errorCode = JsCallFunction(timer.callback[0], arguments.data(), (unsigned short) arguments.size(), &result);
+
+	if (!timer.repeat)
+	{
+		ReleaseTimer(timer);
+	}
+	else if (timers.find(id) != timers.end())
+	{
+		//
+		// The next run follows from this one's due time rather than from now, so intervals don't
+		// drift by the time their callbacks take. Runs that were missed entirely are skipped.
+		//
+
+		milliseconds interval(timer.interval);
+		TimerDue next = { due.due + interval, id };
+		steady_clock::time_point now = steady_clock::now();
+		if (next.due <= now)
+		{
+			next.due += ((now - next.due) / interval + 1) * interval;
+		}
+
+		timerQueue.push(next);
+	}
+
+	return errorCode;
+}
+
+void EventLoop::ReleaseTimer(Timer &timer)
+{
+	for (JsValueRef value : timer.callback)
+	{
+		JsRelease(value, nullptr);
+	}
+}
+
+JsErrorCode EventLoop::StartRead(const wchar_t *path, bool text, JsValueRef *promise)
+{
+	Read *read = new Read();
+	JsErrorCode errorCode = JsCreatePromise(promise, &read->resolve, &read->reject);
+	if (errorCode != JsNoError)
+	{
+		delete read;
+		return errorCode;
+	}
+
+	JsAddRef(read->resolve, nullptr);
+	JsAddRef(read->reject, nullptr);
+
+	read->path = path;
+	read->data = new vector<char>();
+	read->offset = 0;
+	read->text = text;
+	read->file = CreateFileW(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, nullptr);
+
+	DWORD error = ERROR_SUCCESS;
+	if (read->file == INVALID_HANDLE_VALUE)
+	{
+		error = GetLastError();
+	}
+	else if (CreateIoCompletionPort(read->file, completionPort, 0, 0) == nullptr)
+	{
+		error = GetLastError();
+	}
+	else if (IssueRead(read, &error))
+	{
+		return JsNoError;
+	}
+
+	//
+	// Failing to start is reported through the promise like any other failure.
+	//
+
+	return CompleteRead(read, error);
+}
+
+bool EventLoop::IssueRead(Read *read, DWORD *error)
+{
+	//
+	// Strings and ArrayBuffers are limited to 32-bit lengths.
+	//
+
+	if (read->offset + readChunkSize > UINT_MAX)
+	{
+		*error = ERROR_NOT_ENOUGH_MEMORY;
+		return false;
+	}
+
+	read->data->resize((size_t) read->offset + readChunkSize);
+
+	memset(&read->overlapped, 0, sizeof(read->overlapped));
+	read->overlapped.Offset = (DWORD) read->offset;
+	read->overlapped.OffsetHigh = (DWORD) (read->offset >> 32);
+
+	//
+	// Even a read that finishes at once is completed through the port.
+	//
+
+	if (::ReadFile(read->file, read->data->data() + read->offset, readChunkSize, nullptr, &read->overlapped) || GetLastError() == ERROR_IO_PENDING)
+	{
+		reads.insert(read);
+		return true;
+	}
+
+	*error = GetLastError();
+	return false;
+}
+
+static void CALLBACK FinalizeReadData(void *callbackState)
+{
+	vector<char> *data = (vector<char> *) callbackState;
+	ExternalBuffers::Remove(data->data());
+	delete data;
+}
+
+//
+// Settle the promise of a finished read. The end of a file or of a pipe's data is success.
+//
+
+JsErrorCode EventLoop::CompleteRead(Read *read, DWORD error)
+{
+	reads.erase(read);
+
+	if (read->file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(read->file);
+	}
+
+	JsValueRef value = JS_INVALID_REFERENCE;
+	JsValueRef settle = read->reject;
+	JsErrorCode errorCode = JsNoError;
+
+	read->data->resize((size_t) read->offset);
+
+	if (error == ERROR_HANDLE_EOF || error == ERROR_BROKEN_PIPE)
+	{
+		settle = read->resolve;
+
+		if (read->text)
+		{
+			errorCode = JsCreateString(read->data->data(), read->data->size(), &value);
+		}
+		else if (read->data->empty())
+		{
+			errorCode = JsCreateArrayBuffer(0, &value);
+		}
+		else
+		{
+			read->data->shrink_to_fit();
+			errorCode = JsCreateExternalArrayBuffer(read->data->data(), (unsigned int) read->data->size(), FinalizeReadData, read->data, &value);
+			if (errorCode == JsNoError)
+			{
+				ExternalBuffers::Add(read->data->data());
+				read->data = nullptr;
+			}
+		}
+	}
+	else
+	{
+		wstring message = L"unable to read file: " + read->path;
+		JsValueRef messageValue;
+		errorCode = JsPointerToString(message.c_str(), message.length(), &messageValue);
+		if (errorCode == JsNoError)
+		{
+			errorCode = JsCreateError(messageValue, &value);
+		}
+	}
+
+	if (errorCode == JsNoError)
+	{
+		JsValueRef arguments[2];
+		arguments[1] = value;
+
+		JsValueRef result;
+		errorCode = JsGetUndefinedValue(&arguments[0]);
+		if (errorCode == JsNoError)
+		{
+			errorCode = JsCallFunction(settle, arguments, 2, &result);
+		}
+	}
+
+	JsRelease(read->resolve, nullptr);
+	JsRelease(read->reject, nullptr);
+	delete read->data;
+	delete read;
+
+	return errorCode;
+}
+
+void CALLBACK EventLoop::PromiseContinuation(JsValueRef task, void *callbackState)
+{
+	JsAddRef(task, nullptr);
+	Current()->microtasks.push_back(task);
+}
+
+//
+// setTimeout(callback, delay, ...arguments) and setInterval(callback, delay, ...arguments).
+//
+
+JsValueRef CALLBACK EventLoop::SetTimer(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+{
+	if (argumentCount < 2)
+	{
+		ThrowException(L"not enough arguments");
+		return JS_INVALID_REFERENCE;
+	}
+
+	JsValueType type;
+	IfFailThrow(JsGetValueType(arguments[1], &type), L"invalid callback");
+	if (type != JsFunction)
+	{
+		ThrowException(L"callback is not a function");
+		return JS_INVALID_REFERENCE;
+	}
+
+	double delay = 0;
+	if (argumentCount > 2)
+	{
+		JsValueRef numberValue;
+		IfFailThrow(JsConvertValueToNumber(arguments[2], &numberValue), L"invalid delay");
+		IfFailThrow(JsNumberToDouble(numberValue, &delay), L"invalid delay");
+	}
+
+	if (!(delay >= 0))
+	{
+		delay = 0;
+	}
+
+	Timer timer;
+	timer.repeat = callbackState != nullptr;
+	timer.interval = (unsigned) min(delay, (double) INT_MAX);
+
+	//
+	// An interval of zero would never let the loop wait for anything else.
+	//
+
+	if (timer.repeat && timer.interval == 0)
+	{
+		timer.interval = 1;
+	}
+
+	timer.callback.push_back(arguments[1]);
+	for (unsigned short index = 3; index < argumentCount; index++)
+	{
+		timer.callback.push_back(arguments[index]);
+	}
+
+	for (JsValueRef value : timer.callback)
+	{
+		JsAddRef(value, nullptr);
+	}
+
+	EventLoop *eventLoop = Current();
+	unsigned id = eventLoop->nextTimerId++;
+	eventLoop->timers[id] = timer;
+
+	TimerDue due = { steady_clock::now() + milliseconds(timer.interval), id };
+	eventLoop->timerQueue.push(due);
+
+	JsValueRef idValue;
+	IfFailThrow(JsDoubleToNumber(id, &idValue), L"failed to create timer id");
+	return idValue;
+}
+
+//
+// clearTimeout(id) and clearInterval(id).
+//
+
+JsValueRef CALLBACK EventLoop::ClearTimer(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+{
+	if (argumentCount < 2)
+	{
+		return JS_INVALID_REFERENCE;
+	}
+
+	JsValueRef numberValue;
+	double id;
+	IfFailThrow(JsConvertValueToNumber(arguments[1], &numberValue), L"invalid timer id");
+	IfFailThrow(JsNumberToDouble(numberValue, &id), L"invalid timer id");
+
+	EventLoop *eventLoop = Current();
+	auto timer = id >= 0 && id <= UINT_MAX ? eventLoop->timers.find((unsigned) id) : eventLoop->timers.end();
+	if (timer != eventLoop->timers.end())
+	{
+		eventLoop->ReleaseTimer(timer->second);
+		eventLoop->timers.erase(timer);
+	}
+
+	return JS_INVALID_REFERENCE;
+}
+
+//
+// host.readFile(path[, "utf8"]) returns a promise for the contents of a file or pipe, as an
+// ArrayBuffer or, with "utf8", a string.
+//
+
+JsValueRef CALLBACK EventLoop::HostReadFile(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+{
+	if (argumentCount < 2)
+	{
+		ThrowException(L"not enough arguments");
+		return JS_INVALID_REFERENCE;
+	}
+
+	const wchar_t *path;
+	size_t pathLength;
+	IfFailThrow(JsStringToPointer(arguments[1], &path, &pathLength), L"invalid path argument");
+
+	bool text = false;
+	if (argumentCount > 2)
+	{
+		const wchar_t *encoding;
+		size_t length;
+		IfFailThrow(JsStringToPointer(arguments[2], &encoding, &length), L"invalid encoding argument");
+
+		if (wcscmp(encoding, L"utf8") != 0 && wcscmp(encoding, L"utf-8") != 0)
+		{
+			ThrowException(L"unsupported encoding");
+			return JS_INVALID_REFERENCE;
+		}
+
+		text = true;
+	}
+
+	JsValueRef promise;
+	IfFailThrow(Current()->StartRead(wstring(path, pathLength).c_str(), text, &promise), L"failed to read file");
+	return promise;
+}
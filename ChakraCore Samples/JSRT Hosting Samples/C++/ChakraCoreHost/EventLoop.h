@@ -0,0 +1,150 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <queue>
+#include <set>
+#include <string>
+#include <chrono>
+
+//
+// The event loop that runs a script's asynchronous work once the script itself has returned:
+// promise continuations (microtasks), timers (setTimeout and setInterval) and file and pipe reads
+// (host.readFile). Each host thread has one loop, shared by whatever context the thread is running.
+//
+// Microtasks are drained after every macrotask: the script itself, a timer callback or an I/O
+// completion. Timers are kept in a min-heap by due time; reads are overlapped and complete on an
+// I/O completion port, which the loop waits on until the next timer is due. Other threads wake the
+// loop through the same port when they post messages to it (see MessageSource). The loop returns
+// once there are no microtasks, timers, reads or active message sources left.
+//
+
+//
+// Something on another thread that posts messages to a loop, such as a worker. The loop calls a
+// source on its own thread: it delivers messages when the source wakes the loop, keeps running
+// while the source is active, and closes the source once it isn't, or when the loop is reset.
+//
+
+class MessageSource
+{
+public:
+	virtual ~MessageSource() {}
+
+	//
+	// Run the handler for the next message that has arrived. *delivered is false if there was none.
+	//
+
+	virtual JsErrorCode DeliverNext(bool *delivered) = 0;
+
+	//
+	// Whether more messages may arrive.
+	//
+
+	virtual bool IsActive() = 0;
+
+	virtual void Close() = 0;
+};
+
+class EventLoop
+{
+public:
+	EventLoop();
+	~EventLoop();
+
+	//
+	// The calling thread's loop.
+	//
+
+	static EventLoop *Current();
+
+	//
+	// Hook the current context up to the event loop: promise continuations, setTimeout, setInterval,
+	// clearTimeout, clearInterval and host.readFile.
+	//
+
+	static JsErrorCode Install(JsValueRef globalObject, JsValueRef hostObject);
+
+	//
+	// Run until no work remains, or until a callback fails (the exception is left set). Returns
+	// JsErrorScriptTerminated if the watchdog stops the job while the loop is waiting.
+	//
+
+	JsErrorCode Run();
+
+	//
+	// Run the queued promise continuations, and any they queue in turn, without waiting for anything
+	// else. For hosts that call into script repeatedly before handing over to Run.
+	//
+
+	JsErrorCode RunMicrotasks();
+
+	//
+	// Drop all pending work, after a job failed. The job's context must still be current.
+	//
+
+	void Reset();
+
+	//
+	// Register a message source with the loop. To wake the loop, another thread passes the source
+	// to Wake with a handle from OpenWakeHandle, which keeps the loop's completion port valid after
+	// the loop's thread has gone. The handle is closed with CloseHandle.
+	//
+
+	void AddSource(MessageSource *source);
+	HANDLE OpenWakeHandle();
+	static void Wake(HANDLE wakeHandle, MessageSource *source);
+
+private:
+	struct Timer
+	{
+		std::vector<JsValueRef> callback;	// the function, then its arguments
+		unsigned interval;
+		bool repeat;
+	};
+
+	struct TimerDue
+	{
+		std::chrono::steady_clock::time_point due;
+		unsigned id;
+
+		bool operator>(const TimerDue &other) const
+		{
+			return due > other.due || (due == other.due && id > other.id);
+		}
+	};
+
+	struct Read
+	{
+		OVERLAPPED overlapped;
+		HANDLE file;
+		std::wstring path;
+		std::vector<char> *data;
+		unsigned long long offset;
+		bool text;
+		JsValueRef resolve;
+		JsValueRef reject;
+	};
+
+	std::deque<JsValueRef> microtasks;
+	std::map<unsigned, Timer> timers;
+	std::priority_queue<TimerDue, std::vector<TimerDue>, std::greater<TimerDue>> timerQueue;
+	unsigned nextTimerId;
+	HANDLE completionPort;
+	std::set<Read *> reads;
+	std::set<MessageSource *> sources;
+
+	JsErrorCode RunTimer(const TimerDue &due);
+	JsErrorCode StartRead(const wchar_t *path, bool text, JsValueRef *promise);
+	bool IssueRead(Read *read, DWORD *error);
+	JsErrorCode CompleteRead(Read *read, DWORD error);
+	JsErrorCode DeliverMessages(MessageSource *source);
+	bool HasActiveSources();
+	static bool IsExecutionDisabled();
+	void ReleaseTimer(Timer &timer);
+
+	static void CALLBACK PromiseContinuation(JsValueRef task, void *callbackState);
+	static JsValueRef CALLBACK SetTimer(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
+	static JsValueRef CALLBACK ClearTimer(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
+	static JsValueRef CALLBACK HostReadFile(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
+};
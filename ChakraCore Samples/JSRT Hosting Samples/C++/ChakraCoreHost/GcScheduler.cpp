@@ -0,0 +1,539 @@
+#include "stdafx.h"
+#include "GcScheduler.h"
+#include "PropertyIds.h"
+#include <climits>
+#include <cstring>
+
+using namespace std;
+using namespace std::chrono;
+
+//
+// Collections each runtime keeps for host.gcStats.
+//
+
+static const size_t maxRecentCollections = 256;
+
+//
+// Jobs running on this thread and when the outermost one started, what the host itself is running
+// (idle work or a collection; null while script is), the collection started on this thread that
+// hasn't ended yet, and when idle processing is next due (in GetTickCount ticks).
+//
+
+static thread_local unsigned jobDepth = 0;
+static thread_local unsigned long long jobStart = 0;
+static thread_local wstring jobName;
+static thread_local const char *hostTrigger = nullptr;
+static thread_local void *pendingCollection = nullptr;
+static thread_local DWORD nextIdleTick = 0;
+static thread_local bool idleScheduled = false;
+
+GcScheduler::GcScheduler() :
+	policy(GcPolicyNone),
+	collectionsInJobs(0),
+	collectionsOutsideJobs(0),
+	origin(steady_clock::now())
+{
+	for (Pauses *pauses : { &pausesInJobs, &pausesOutsideJobs, &idleWork, &betweenJobs, &explicitCollections })
+	{
+		pauses->count = 0;
+		pauses->totalNs = 0;
+		pauses->maxNs = 0;
+	}
+}
+
+GcScheduler::~GcScheduler()
+{
+	for (auto &entry : runtimes)
+	{
+		delete entry.second;
+	}
+}
+
+bool GcScheduler::ParsePolicy(const wchar_t *name, GcPolicy *policy)
+{
+	for (int candidate = GcPolicyNone; candidate <= GcPolicyCollect; candidate++)
+	{
+		if (wcscmp(name, GetPolicyName((GcPolicy) candidate)) == 0)
+		{
+			*policy = (GcPolicy) candidate;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const wchar_t *GcScheduler::GetPolicyName(GcPolicy policy)
+{
+	switch (policy)
+	{
+	case GcPolicyNone:
+		return L"none";
+	case GcPolicyIdle:
+		return L"idle";
+	case GcPolicyCollect:
+		return L"collect";
+	}
+
+	return L"unknown";
+}
+
+unsigned long long GcScheduler::GetTimestamp()
+{
+	return duration_cast<nanoseconds>(steady_clock::now() - origin).count();
+}
+
+JsErrorCode GcScheduler::Attach(JsRuntimeHandle runtime, const atomic<size_t> *heapSize)
+{
+	RuntimeCollections *collections = new RuntimeCollections();
+	collections->scheduler = this;
+	collections->heapSize = heapSize;
+	collections->collections = 0;
+	collections->collectionsInJobs = 0;
+	collections->totalNs = 0;
+	collections->maxNs = 0;
+	collections->recentNext = 0;
+
+	JsErrorCode errorCode = JsSetRuntimeBeforeCollectCallback(runtime, collections, BeforeCollect);
+	if (errorCode != JsNoError)
+	{
+		delete collections;
+		return errorCode;
+	}
+
+	lock_guard<mutex> guard(lock);
+	runtimes[runtime] = collections;
+	return JsNoError;
+}
+
+void GcScheduler::Detach(JsRuntimeHandle runtime)
+{
+	RuntimeCollections *collections;
+
+	{
+		lock_guard<mutex> guard(lock);
+		auto entry = runtimes.find(runtime);
+		if (entry == runtimes.end())
+		{
+			return;
+		}
+
+		collections = entry->second;
+		runtimes.erase(entry);
+	}
+
+	//
+	// Runtimes are disposed on the thread that last ran them, which is where a collection would
+	// still be pending.
+	//
+
+	if (pendingCollection == collections)
+	{
+		EndCollection();
+	}
+
+	JsSetRuntimeBeforeCollectCallback(runtime, nullptr, nullptr);
+	delete collections;
+}
+
+unsigned long long GcScheduler::GetCollections(JsRuntimeHandle runtime)
+{
+	lock_guard<mutex> guard(lock);
+	auto entry = runtimes.find(runtime);
+	return entry != runtimes.end() ? (unsigned long long) entry->second->collections : 0;
+}
+
+//
+// Called by the engine on the runtime's thread as a collection starts. The heap size is read from
+// atomics, so this never calls back into the engine.
+//
+
+void CALLBACK GcScheduler::BeforeCollect(void *callbackState)
+{
+	RuntimeCollections *collections = (RuntimeCollections *) callbackState;
+	GcScheduler *scheduler = collections->scheduler;
+
+	//
+	// Back-to-back collections with no script in between: the last one ended when this one began.
+	//
+
+	EndCollection();
+
+	collections->collections++;
+
+	Collection &current = collections->current;
+	current.startNs = scheduler->GetTimestamp();
+	current.durationNs = 0;
+	current.heapBefore = collections->heapSize != nullptr ? (size_t) *collections->heapSize : 0;
+	current.heapAfter = 0;
+	current.threadId = GetCurrentThreadId();
+	current.inJob = jobDepth > 0 && hostTrigger == nullptr;
+	current.trigger = hostTrigger != nullptr ? hostTrigger : "engine";
+
+	if (current.inJob)
+	{
+		scheduler->collectionsInJobs++;
+	}
+	else
+	{
+		scheduler->collectionsOutsideJobs++;
+	}
+
+	pendingCollection = collections;
+}
+
+void GcScheduler::EndCollection()
+{
+	if (pendingCollection == nullptr)
+	{
+		return;
+	}
+
+	RuntimeCollections *collections = (RuntimeCollections *) pendingCollection;
+	pendingCollection = nullptr;
+	collections->scheduler->FinishCollection(collections);
+}
+
+void GcScheduler::FinishCollection(RuntimeCollections *collections)
+{
+	Collection &current = collections->current;
+	current.durationNs = GetTimestamp() - current.startNs;
+	current.heapAfter = collections->heapSize != nullptr ? (size_t) *collections->heapSize : 0;
+
+	collections->totalNs += current.durationNs;
+	collections->maxNs = max(collections->maxNs, current.durationNs);
+	if (current.inJob)
+	{
+		collections->collectionsInJobs++;
+	}
+
+	if (collections->recent.size() < maxRecentCollections)
+	{
+		collections->recent.push_back(current);
+	}
+	else
+	{
+		collections->recent[collections->recentNext] = current;
+	}
+
+	collections->recentNext = (collections->recentNext + 1) % maxRecentCollections;
+
+	(current.inJob ? pausesInJobs : pausesOutsideJobs).Add(current.durationNs);
+
+	if (!traceFile.empty())
+	{
+		lock_guard<mutex> guard(lock);
+		tracedCollections.push_back(current);
+	}
+}
+
+void GcScheduler::EnterJob(const wchar_t *name)
+{
+	if (jobDepth++ == 0 && !traceFile.empty())
+	{
+		jobStart = GetTimestamp();
+		jobName = name;
+	}
+}
+
+void GcScheduler::LeaveJob()
+{
+	EndCollection();
+
+	if (--jobDepth == 0 && !traceFile.empty())
+	{
+		Job job = { jobStart, GetTimestamp() - jobStart, GetCurrentThreadId(), move(jobName) };
+
+		lock_guard<mutex> guard(lock);
+		tracedJobs.push_back(move(job));
+	}
+}
+
+void GcScheduler::Pauses::Add(unsigned long long ns)
+{
+	count++;
+	totalNs += ns;
+
+	unsigned long long observedMax = maxNs;
+	while (ns > observedMax && !maxNs.compare_exchange_weak(observedMax, ns))
+	{
+	}
+}
+
+void GcScheduler::Pauses::Print(const wchar_t *name)
+{
+	fwprintf(stderr, L"chakrahost: gc: %s: %llu, %.3f ms total, %.3f ms longest.\n",
+		name, (unsigned long long) count, totalNs / 1e6, maxNs / 1e6);
+}
+
+DWORD GcScheduler::RunIdleWork()
+{
+	if (policy == GcPolicyNone)
+	{
+		return INFINITE;
+	}
+
+	//
+	// Ticks wrap around, so compare them by their difference.
+	//
+
+	if (idleScheduled && (int) (nextIdleTick - GetTickCount()) > 0)
+	{
+		return nextIdleTick - GetTickCount();
+	}
+
+	steady_clock::time_point start = steady_clock::now();
+
+	hostTrigger = "idle";
+	unsigned int tick;
+	JsErrorCode errorCode = JsIdle(&tick);
+	hostTrigger = nullptr;
+	EndCollection();
+
+	if (errorCode != JsNoError)
+	{
+		return INFINITE;
+	}
+
+	idleWork.Add(duration_cast<nanoseconds>(steady_clock::now() - start).count());
+
+	//
+	// UINT_MAX means the engine has no idle work pending, so wait for the next event instead.
+	//
+
+	if (tick == UINT_MAX)
+	{
+		idleScheduled = false;
+		return INFINITE;
+	}
+
+	//
+	// Never come back sooner than the next tick, so a loop with nothing else to do doesn't spin.
+	//
+
+	nextIdleTick = tick;
+	idleScheduled = true;
+
+	int wait = (int) (nextIdleTick - GetTickCount());
+	return wait > 0 ? (DWORD) wait : 1;
+}
+
+void GcScheduler::RunBetweenJobs()
+{
+	if (policy == GcPolicyNone)
+	{
+		return;
+	}
+
+	if (policy == GcPolicyCollect)
+	{
+		CollectCurrentRuntime(betweenJobs, "between jobs");
+	}
+
+	//
+	// Whatever idle work is left can go now; the next job isn't here yet.
+	//
+
+	idleScheduled = false;
+	RunIdleWork();
+}
+
+JsErrorCode GcScheduler::Collect()
+{
+	return CollectCurrentRuntime(explicitCollections, "collectGarbage");
+}
+
+JsErrorCode GcScheduler::CollectCurrentRuntime(Pauses &pauses, const char *trigger)
+{
+	JsContextRef context;
+	JsRuntimeHandle runtime;
+	IfFailRet(JsGetCurrentContext(&context));
+	IfFailRet(JsGetRuntime(context, &runtime));
+
+	steady_clock::time_point start = steady_clock::now();
+
+	hostTrigger = trigger;
+	JsErrorCode errorCode = JsCollectGarbage(runtime);
+	hostTrigger = nullptr;
+	EndCollection();
+
+	IfFailRet(errorCode);
+
+	pauses.Add(duration_cast<nanoseconds>(steady_clock::now() - start).count());
+	return JsNoError;
+}
+
+//
+// Helpers for building the host.gcStats object.
+//
+
+static JsErrorCode SetProperty(JsValueRef object, const wchar_t *name, JsValueRef value)
+{
+	JsPropertyIdRef propertyId;
+	IfFailRet(PropertyIds::Get(name, &propertyId));
+	return JsSetProperty(object, propertyId, value, true);
+}
+
+static JsErrorCode SetNumber(JsValueRef object, const wchar_t *name, double number)
+{
+	JsValueRef value;
+	IfFailRet(JsDoubleToNumber(number, &value));
+	return SetProperty(object, name, value);
+}
+
+JsErrorCode GcScheduler::GetStats(JsValueRef *stats)
+{
+	//
+	// Script called into the host, so any collection it started is over.
+	//
+
+	EndCollection();
+
+	JsContextRef context;
+	JsRuntimeHandle runtime;
+	IfFailRet(JsGetCurrentContext(&context));
+	IfFailRet(JsGetRuntime(context, &runtime));
+
+	RuntimeCollections *collections;
+
+	{
+		lock_guard<mutex> guard(lock);
+		auto entry = runtimes.find(runtime);
+		if (entry == runtimes.end())
+		{
+			return JsErrorInvalidArgument;
+		}
+
+		collections = entry->second;
+	}
+
+	IfFailRet(JsCreateObject(stats));
+	IfFailRet(SetNumber(*stats, L"collections", (double) collections->collections));
+	IfFailRet(SetNumber(*stats, L"collectionsInJobs", (double) collections->collectionsInJobs));
+	IfFailRet(SetNumber(*stats, L"totalPauseMs", collections->totalNs / 1e6));
+	IfFailRet(SetNumber(*stats, L"maxPauseMs", collections->maxNs / 1e6));
+	IfFailRet(SetNumber(*stats, L"heapBytes", collections->heapSize != nullptr ? (double) *collections->heapSize : 0));
+
+	//
+	// The recent collections, oldest first.
+	//
+
+	size_t count = collections->recent.size();
+	size_t oldest = count < maxRecentCollections ? 0 : collections->recentNext;
+
+	JsValueRef recent;
+	IfFailRet(JsCreateArray((unsigned int) count, &recent));
+
+	for (size_t index = 0; index < count; index++)
+	{
+		const Collection &collection = collections->recent[(oldest + index) % count];
+
+		JsValueRef entry;
+		JsValueRef value;
+		IfFailRet(JsCreateObject(&entry));
+		IfFailRet(SetNumber(entry, L"startMs", collection.startNs / 1e6));
+		IfFailRet(SetNumber(entry, L"durationMs", collection.durationNs / 1e6));
+		IfFailRet(SetNumber(entry, L"heapBeforeBytes", (double) collection.heapBefore));
+		IfFailRet(SetNumber(entry, L"heapAfterBytes", (double) collection.heapAfter));
+		IfFailRet(JsBoolToBoolean(collection.inJob, &value));
+		IfFailRet(SetProperty(entry, L"inJob", value));
+		IfFailRet(JsCreateString(collection.trigger, strlen(collection.trigger), &value));
+		IfFailRet(SetProperty(entry, L"trigger", value));
+
+		JsValueRef indexValue;
+		IfFailRet(JsIntToNumber((int) index, &indexValue));
+		IfFailRet(JsSetIndexedProperty(recent, indexValue, entry));
+	}
+
+	return SetProperty(*stats, L"recent", recent);
+}
+
+void GcScheduler::PrintStatistics()
+{
+	fwprintf(stderr, L"chakrahost: gc: policy %s, %llu collections started inside jobs, %llu outside jobs (idle, between jobs or by the host).\n",
+		GetPolicyName(policy), (unsigned long long) collectionsInJobs, (unsigned long long) collectionsOutsideJobs);
+	pausesInJobs.Print(L"collections inside jobs");
+	pausesOutsideJobs.Print(L"collections outside jobs");
+	idleWork.Print(L"idle processing calls");
+	betweenJobs.Print(L"collections between jobs");
+	explicitCollections.Print(L"host.collectGarbage calls");
+}
+
+//
+// Write a job name as a JSON string in UTF-8.
+//
+
+static void WriteJsonString(FILE *file, const wstring &string)
+{
+	int length = WideCharToMultiByte(CP_UTF8, 0, string.c_str(), (int) string.length(), nullptr, 0, nullptr, nullptr);
+	std::string utf8(length, '\0');
+	if (length > 0)
+	{
+		WideCharToMultiByte(CP_UTF8, 0, string.c_str(), (int) string.length(), &utf8[0], length, nullptr, nullptr);
+	}
+
+	fputc('"', file);
+	for (char c : utf8)
+	{
+		if (c == '"' || c == '\\')
+		{
+			fprintf(file, "\\%c", c);
+		}
+		else if ((unsigned char) c < 0x20)
+		{
+			fprintf(file, "\\u%04x", (unsigned) c);
+		}
+		else
+		{
+			fputc(c, file);
+		}
+	}
+
+	fputc('"', file);
+}
+
+bool GcScheduler::WriteTrace()
+{
+	FILE *file;
+	if (_wfopen_s(&file, traceFile.c_str(), L"w") != 0)
+	{
+		fwprintf(stderr, L"chakrahost: unable to write GC trace: %s.\n", traceFile.c_str());
+		return false;
+	}
+
+	//
+	// Complete ("X") events with timestamps in microseconds, one track per thread, so chrome://tracing
+	// and Perfetto show each collection under or between the jobs it interrupted.
+	//
+
+	DWORD processId = GetCurrentProcessId();
+
+	{
+		lock_guard<mutex> guard(lock);
+
+		fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+		fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%lu,\"args\":{\"name\":\"chakrahost\"}}", processId);
+
+		for (const Job &job : tracedJobs)
+		{
+			fprintf(file, ",\n{\"name\":\"job\",\"cat\":\"script\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%lu,\"args\":{\"script\":",
+				job.startNs / 1e3, job.durationNs / 1e3, processId, job.threadId);
+			WriteJsonString(file, job.name);
+			fprintf(file, "}}");
+		}
+
+		for (const Collection &collection : tracedCollections)
+		{
+			fprintf(file, ",\n{\"name\":\"GC\",\"cat\":\"gc\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%lu,\"tid\":%lu,"
+				"\"args\":{\"trigger\":\"%s\",\"inJob\":%s,\"heapBeforeBytes\":%llu,\"heapAfterBytes\":%llu}}",
+				collection.startNs / 1e3, collection.durationNs / 1e3, processId, collection.threadId,
+				collection.trigger, collection.inJob ? "true" : "false",
+				(unsigned long long) collection.heapBefore, (unsigned long long) collection.heapAfter);
+		}
+
+		fprintf(file, "\n]}\n");
+	}
+
+	fclose(file);
+	return true;
+}
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+
+//
+// When the host lets the engine collect garbage, trading throughput against tail latency.
+//
+
+enum GcPolicy
+{
+	//
+	// The engine collects whenever it decides to, which may be in the middle of a job.
+	//
+
+	GcPolicyNone,
+
+	//
+	// Runtimes do idle processing: the event loop calls JsIdle whenever it would wait anyway, at
+	// the times the engine asks for, and again between jobs.
+	//
+
+	GcPolicyIdle,
+
+	//
+	// Idle processing, plus a full collection between jobs, so the next job starts with a clean
+	// heap. Costs throughput, but keeps collections out of jobs.
+	//
+
+	GcPolicyCollect
+};
+
+//
+// Garbage collection scheduling for every runtime the host creates, and accounting of where
+// collections happen: while a job is running scripts, or while the host is idle or between jobs.
+//
+// The engine says when a collection starts but not when it ends, so a collection is taken to last
+// until the next script transition the host sees: the end of an event loop task or of a job, or
+// the next host call. Collections the host starts itself end when the call that started them
+// returns. Heap sizes before and after come from the runtime's allocation callback.
+//
+
+class GcScheduler
+{
+public:
+	GcScheduler();
+	~GcScheduler();
+
+	static bool ParsePolicy(const wchar_t *name, GcPolicy *policy);
+	static const wchar_t *GetPolicyName(GcPolicy policy);
+
+	//
+	// Start and stop watching a runtime's collections, given the counter its allocation callback
+	// keeps its heap size in. Detach must be called before the runtime is disposed.
+	//
+
+	JsErrorCode Attach(JsRuntimeHandle runtime, const std::atomic<size_t> *heapSize);
+	void Detach(JsRuntimeHandle runtime);
+
+	//
+	// Called by the event loop in the current context when it's about to wait. Runs idle processing
+	// if it's due, and returns how long the loop may wait before it's due again.
+	//
+
+	DWORD RunIdleWork();
+
+	//
+	// Called with a job's context current once the job is over and before the next arrives.
+	//
+
+	void RunBetweenJobs();
+
+	//
+	// A full collection of the current runtime, for host.collectGarbage.
+	//
+
+	JsErrorCode Collect();
+
+	//
+	// Script has handed control back to the host on this thread, so a collection it started is over.
+	//
+
+	static void EndCollection();
+
+	//
+	// Jobs being run on this thread; set by RunJob. Collections that start while a job is running
+	// count as being inside the job. With a trace file, jobs also go into the trace.
+	//
+
+	void EnterJob(const wchar_t *name);
+	void LeaveJob();
+
+	//
+	// The current runtime's collections, for host.gcStats.
+	//
+
+	JsErrorCode GetStats(JsValueRef *stats);
+
+	//
+	// Collections of a runtime so far.
+	//
+
+	unsigned long long GetCollections(JsRuntimeHandle runtime);
+
+	void PrintStatistics();
+
+	//
+	// Write the collections and jobs recorded since tracing started as Chrome trace events.
+	//
+
+	bool WriteTrace();
+
+	GcPolicy policy;
+
+	//
+	// Where to write the trace, or empty not to record one.
+	//
+
+	std::wstring traceFile;
+
+private:
+	struct Collection
+	{
+		unsigned long long startNs;
+		unsigned long long durationNs;
+		size_t heapBefore;
+		size_t heapAfter;
+		DWORD threadId;
+		bool inJob;
+		const char *trigger;
+	};
+
+	struct Job
+	{
+		unsigned long long startNs;
+		unsigned long long durationNs;
+		DWORD threadId;
+		std::wstring name;
+	};
+
+	struct RuntimeCollections
+	{
+		GcScheduler *scheduler;
+		const std::atomic<size_t> *heapSize;
+		std::atomic<unsigned long long> collections;
+
+		//
+		// Totals, and the most recent collections in a ring. Only touched by the thread running the
+		// runtime.
+		//
+
+		unsigned long long collectionsInJobs;
+		unsigned long long totalNs;
+		unsigned long long maxNs;
+		std::vector<Collection> recent;
+		size_t recentNext;
+
+		//
+		// The collection in progress, if any.
+		//
+
+		Collection current;
+	};
+
+	struct Pauses
+	{
+		std::atomic<unsigned long long> count;
+		std::atomic<unsigned long long> totalNs;
+		std::atomic<unsigned long long> maxNs;
+
+		void Add(unsigned long long ns);
+		void Print(const wchar_t *name);
+	};
+
+	std::mutex lock;
+	std::map<JsRuntimeHandle, RuntimeCollections *> runtimes;
+
+	std::atomic<unsigned long long> collectionsInJobs;
+	std::atomic<unsigned long long> collectionsOutsideJobs;
+	Pauses pausesInJobs;
+	Pauses pausesOutsideJobs;
+	Pauses idleWork;
+	Pauses betweenJobs;
+	Pauses explicitCollections;
+
+	std::chrono::steady_clock::time_point origin;
+
+	//
+	// Everything recorded for the trace. Protected by the lock.
+	//
+
+	std::vector<Collection> tracedCollections;
+	std::vector<Job> tracedJobs;
+
+	unsigned long long GetTimestamp();
+	JsErrorCode CollectCurrentRuntime(Pauses &pauses, const char *trigger);
+	void FinishCollection(RuntimeCollections *collections);
+
+	static void CALLBACK BeforeCollect(void *callbackState);
+};
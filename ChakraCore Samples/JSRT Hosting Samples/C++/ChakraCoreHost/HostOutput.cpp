@@ -0,0 +1,146 @@
+#include "stdafx.h"
+#include "HostOutput.h"
+#include <vector>
+#include <cstring>
+
+using namespace std;
+
+//
+// Size at which the buffer is written out, whatever the policy.
+//
+
+static const size_t flushSize = 64 * 1024;
+
+static OutputFlushPolicy flushPolicy = OutputFlushSize;
+
+class OutputBuffer
+{
+public:
+	~OutputBuffer()
+	{
+		Flush();
+	}
+
+	char *Reserve(size_t length)
+	{
+		size_t size = data.size();
+		data.resize(size + length);
+		return data.data() + size;
+	}
+
+	void Commit(size_t length, size_t reserved)
+	{
+		size_t start = data.size() - reserved;
+		data.resize(start + length);
+
+		if (data.size() >= flushSize || (flushPolicy == OutputFlushLine && memchr(data.data() + start, '\n', length) != nullptr))
+		{
+			Flush();
+		}
+	}
+
+	void Flush()
+	{
+		if (!data.empty())
+		{
+			fwrite(data.data(), 1, data.size(), stdout);
+			fflush(stdout);
+			data.clear();
+		}
+	}
+
+private:
+	vector<char> data;
+};
+
+static thread_local OutputBuffer outputBuffer;
+
+void HostOutput::Initialize(OutputFlushPolicy policy)
+{
+	bool console = GetFileType(GetStdHandle(STD_OUTPUT_HANDLE)) == FILE_TYPE_CHAR;
+
+	if (policy == OutputFlushAuto)
+	{
+		policy = console ? OutputFlushLine : OutputFlushSize;
+	}
+
+	flushPolicy = policy;
+
+	//
+	// Output is UTF-8, so make the console show it as such.
+	//
+
+	if (console)
+	{
+		SetConsoleOutputCP(CP_UTF8);
+	}
+}
+
+bool HostOutput::ParseFlushPolicy(const wchar_t *name, OutputFlushPolicy *policy)
+{
+	if (wcscmp(name, L"line") == 0)
+	{
+		*policy = OutputFlushLine;
+	}
+	else if (wcscmp(name, L"size") == 0)
+	{
+		*policy = OutputFlushSize;
+	}
+	else if (wcscmp(name, L"exit") == 0)
+	{
+		*policy = OutputFlushExit;
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+JsErrorCode HostOutput::WriteString(JsValueRef stringValue)
+{
+	//
+	// Ask for the UTF-8 length first, then copy straight into the buffer.
+	//
+
+	size_t length;
+	IfFailRet(JsCopyString(stringValue, nullptr, 0, &length));
+
+	if (length == 0)
+	{
+		return JsNoError;
+	}
+
+	char *buffer = outputBuffer.Reserve(length);
+	size_t written = 0;
+	JsErrorCode errorCode = JsCopyString(stringValue, buffer, length, &written);
+	outputBuffer.Commit(errorCode == JsNoError ? written : 0, length);
+
+	return errorCode;
+}
+
+void HostOutput::Write(const char *data, size_t length)
+{
+	//
+	// Empty ArrayBuffers and views may have no storage at all.
+	//
+
+	if (length == 0)
+	{
+		return;
+	}
+
+	memcpy(outputBuffer.Reserve(length), data, length);
+	outputBuffer.Commit(length, length);
+}
+
+void HostOutput::EndLine()
+{
+	Write("\n", 1);
+}
+
+void HostOutput::Flush()
+{
+	outputBuffer.Flush();
+}
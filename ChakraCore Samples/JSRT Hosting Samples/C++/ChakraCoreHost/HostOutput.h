@@ -0,0 +1,50 @@
+#pragma once
+
+//
+// When buffered script output is written to stdout.
+//
+
+enum OutputFlushPolicy
+{
+	OutputFlushLine,	// at the end of every line, or when the buffer fills up
+	OutputFlushSize,	// whenever the buffer fills up
+	OutputFlushExit,	// when Flush is called, or when the buffer fills up
+	OutputFlushAuto	// line on a console, size otherwise
+};
+
+//
+// Script output (host.echo and host.write). Each thread collects its output as UTF-8 in a buffer
+// of its own and hands it to stdout in one write, so scripts that log a lot don't pay for a
+// locked, wide-character stdio call per string. Buffers are also flushed when their thread exits;
+// the host flushes explicitly before writing to stdout itself.
+//
+
+class HostOutput
+{
+public:
+	//
+	// Set the flush policy and prepare the console for UTF-8. Call before any script runs.
+	//
+
+	static void Initialize(OutputFlushPolicy policy);
+	static bool ParseFlushPolicy(const wchar_t *name, OutputFlushPolicy *policy);
+
+	//
+	// Append the UTF-8 contents of a string value, or raw bytes.
+	//
+
+	static JsErrorCode WriteString(JsValueRef stringValue);
+	static void Write(const char *data, size_t length);
+
+	//
+	// End a line of output, which flushes under the line policy.
+	//
+
+	static void EndLine();
+
+	//
+	// Write out the calling thread's buffer.
+	//
+
+	static void Flush();
+};
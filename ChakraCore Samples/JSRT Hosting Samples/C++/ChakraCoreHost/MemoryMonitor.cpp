@@ -0,0 +1,181 @@
+#include "stdafx.h"
+#include "MemoryMonitor.h"
+
+using namespace std;
+
+MemoryMonitor::MemoryMonitor() :
+	limit(0),
+	runtimesDisposed(0),
+	peak(0),
+	retained(0),
+	allocations(0),
+	frees(0),
+	failures(0),
+	allocatedBytes(0)
+{
+}
+
+MemoryMonitor::~MemoryMonitor()
+{
+	for (auto &entry : runtimes)
+	{
+		delete entry.second;
+	}
+}
+
+JsErrorCode MemoryMonitor::Attach(JsRuntimeHandle runtime)
+{
+	if (limit > 0)
+	{
+		IfFailRet(JsSetRuntimeMemoryLimit(runtime, limit));
+	}
+
+	RuntimeMemory *memory = new RuntimeMemory();
+	memory->current = 0;
+	memory->peak = 0;
+	memory->allocations = 0;
+	memory->frees = 0;
+	memory->failures = 0;
+	memory->allocatedBytes = 0;
+
+	JsErrorCode errorCode = JsSetRuntimeMemoryAllocationCallback(runtime, memory, AllocationCallback);
+	if (errorCode != JsNoError)
+	{
+		delete memory;
+		return errorCode;
+	}
+
+	lock_guard<mutex> guard(lock);
+	runtimes[runtime] = memory;
+	return JsNoError;
+}
+
+void MemoryMonitor::Detach(JsRuntimeHandle runtime)
+{
+	RuntimeMemory *memory;
+
+	{
+		lock_guard<mutex> guard(lock);
+		auto entry = runtimes.find(runtime);
+		if (entry == runtimes.end())
+		{
+			return;
+		}
+
+		memory = entry->second;
+		runtimes.erase(entry);
+	}
+
+	//
+	// What the runtime still holds right before it goes away.
+	//
+
+	size_t usage = 0;
+	JsGetRuntimeMemoryUsage(runtime, &usage);
+
+	JsSetRuntimeMemoryAllocationCallback(runtime, nullptr, nullptr);
+
+	{
+		lock_guard<mutex> guard(lock);
+		runtimesDisposed++;
+		peak = max(peak, (size_t) memory->peak);
+		retained += usage;
+		allocations += memory->allocations;
+		frees += memory->frees;
+		failures += memory->failures;
+		allocatedBytes += memory->allocatedBytes;
+	}
+
+	delete memory;
+}
+
+const atomic<size_t> *MemoryMonitor::GetUsage(JsRuntimeHandle runtime)
+{
+	lock_guard<mutex> guard(lock);
+	auto entry = runtimes.find(runtime);
+	return entry != runtimes.end() ? &entry->second->current : nullptr;
+}
+
+//
+// Called by the engine on the runtime's thread (or a background thread) whenever it takes memory
+// from or returns memory to the system, so it only touches atomics.
+//
+
+bool CALLBACK MemoryMonitor::AllocationCallback(void *callbackState, JsMemoryEventType allocationEvent, size_t allocationSize)
+{
+	RuntimeMemory *memory = (RuntimeMemory *) callbackState;
+
+	switch (allocationEvent)
+	{
+	case JsMemoryAllocate:
+	{
+		size_t current = memory->current += allocationSize;
+		size_t observedPeak = memory->peak;
+		while (current > observedPeak && !memory->peak.compare_exchange_weak(observedPeak, current))
+		{
+		}
+
+		memory->allocations++;
+		memory->allocatedBytes += allocationSize;
+		break;
+	}
+
+	case JsMemoryFree:
+		memory->current -= allocationSize;
+		memory->frees++;
+		break;
+
+	case JsMemoryFailure:
+		//
+		// The allocation was already counted when it was requested.
+		//
+
+		memory->current -= allocationSize;
+		memory->failures++;
+		break;
+	}
+
+	//
+	// The engine enforces the limit itself; we never veto an allocation.
+	//
+
+	return true;
+}
+
+void MemoryMonitor::PrintStatistics()
+{
+	lock_guard<mutex> guard(lock);
+
+	fwprintf(stderr, L"chakrahost: memory: %u runtimes, limit %llu bytes, peak %llu bytes, %llu bytes retained at dispose.\n",
+		runtimesDisposed, (unsigned long long) limit, (unsigned long long) peak, (unsigned long long) retained);
+	fwprintf(stderr, L"chakrahost: memory: %llu allocations (%llu bytes), %llu frees, %llu failed allocations.\n",
+		allocations, allocatedBytes, frees, failures);
+}
+
+bool MemoryMonitor::WriteReport(const wstring &fileName)
+{
+	FILE *file;
+	if (_wfopen_s(&file, fileName.c_str(), L"w") != 0)
+	{
+		fwprintf(stderr, L"chakrahost: unable to write memory report: %s.\n", fileName.c_str());
+		return false;
+	}
+
+	{
+		lock_guard<mutex> guard(lock);
+
+		fprintf(file, "{\n");
+		fprintf(file, "  \"runtimes\": %u,\n", runtimesDisposed);
+		fprintf(file, "  \"limitBytes\": %llu,\n", (unsigned long long) limit);
+		fprintf(file, "  \"peakBytes\": %llu,\n", (unsigned long long) peak);
+		fprintf(file, "  \"retainedBytes\": %llu,\n", (unsigned long long) retained);
+		fprintf(file, "  \"allocations\": %llu,\n", allocations);
+		fprintf(file, "  \"allocatedBytes\": %llu,\n", allocatedBytes);
+		fprintf(file, "  \"frees\": %llu,\n", frees);
+		fprintf(file, "  \"failedAllocations\": %llu\n", failures);
+		fprintf(file, "}\n");
+	}
+
+	fclose(file);
+	return true;
+}
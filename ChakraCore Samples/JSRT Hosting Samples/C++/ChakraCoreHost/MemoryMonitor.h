@@ -0,0 +1,71 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+//
+// Memory accounting for every runtime the host creates. Each runtime gets a memory limit (if one
+// was given) and an allocation callback that keeps its current and peak usage in atomic counters,
+// so the callback never takes a lock. When a runtime is disposed its counters are folded into the
+// totals for the process.
+//
+
+class MemoryMonitor
+{
+public:
+	MemoryMonitor();
+	~MemoryMonitor();
+
+	//
+	// Start and stop accounting for a runtime. Detach must be called before the runtime is disposed.
+	//
+
+	JsErrorCode Attach(JsRuntimeHandle runtime);
+	void Detach(JsRuntimeHandle runtime);
+
+	//
+	// The counter holding a runtime's current usage, valid until the runtime is detached, or
+	// nullptr if it isn't attached.
+	//
+
+	const std::atomic<size_t> *GetUsage(JsRuntimeHandle runtime);
+
+	void PrintStatistics();
+	bool WriteReport(const std::wstring &fileName);
+
+	//
+	// Per-runtime limit in bytes, or 0 for no limit.
+	//
+
+	size_t limit;
+
+private:
+	struct RuntimeMemory
+	{
+		std::atomic<size_t> current;
+		std::atomic<size_t> peak;
+		std::atomic<unsigned long long> allocations;
+		std::atomic<unsigned long long> frees;
+		std::atomic<unsigned long long> failures;
+		std::atomic<unsigned long long> allocatedBytes;
+	};
+
+	std::mutex lock;
+	std::map<JsRuntimeHandle, RuntimeMemory *> runtimes;
+
+	//
+	// Totals over disposed runtimes. Protected by the lock.
+	//
+
+	unsigned runtimesDisposed;
+	size_t peak;
+	size_t retained;
+	unsigned long long allocations;
+	unsigned long long frees;
+	unsigned long long failures;
+	unsigned long long allocatedBytes;
+
+	static bool CALLBACK AllocationCallback(void *callbackState, JsMemoryEventType allocationEvent, size_t allocationSize);
+};
@@ -0,0 +1,556 @@
+#include "stdafx.h"
+#include "ChakraCoreHost.h"
+#include "ModuleLoader.h"
+#include <climits>
+
+using namespace std;
+
+//
+// The module host callbacks don't carry any state of ours, so they find the loader through the
+// thread running the context.
+//
+
+static thread_local ModuleLoader *currentLoader = nullptr;
+
+ModuleLoader::ModuleLoader(unsigned readerCount) :
+	failed(false),
+	root(nullptr),
+	rootResult(nullptr),
+	rootEvaluated(false),
+	previousLoader(nullptr),
+	pendingReads(0),
+	stopping(false)
+{
+	wakeHandle = EventLoop::Current()->OpenWakeHandle();
+
+	if (readerCount == 0)
+	{
+		readerCount = 1;
+	}
+
+	for (unsigned index = 0; index < readerCount; index++)
+	{
+		readers.emplace_back(&ModuleLoader::Read, this);
+	}
+}
+
+ModuleLoader::~ModuleLoader()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+
+	readRequested.notify_all();
+
+	for (thread &reader : readers)
+	{
+		reader.join();
+	}
+
+	if (wakeHandle != nullptr)
+	{
+		CloseHandle(wakeHandle);
+	}
+
+	if (currentLoader == this)
+	{
+		currentLoader = previousLoader;
+	}
+
+	for (auto &entry : modulesByPath)
+	{
+		delete entry.second->source;
+		delete entry.second;
+	}
+}
+
+//
+// Get the directory part of a path, including the trailing separator.
+//
+
+static wstring GetDirectory(const wstring &path)
+{
+	size_t separator = path.find_last_of(L"\\/");
+	return separator == wstring::npos ? wstring() : path.substr(0, separator + 1);
+}
+
+static bool IsAbsolutePath(const wstring &path)
+{
+	return (path.size() > 0 && (path[0] == L'\\' || path[0] == L'/')) || (path.size() > 1 && path[1] == L':');
+}
+
+//
+// Get the message of an exception value, or its string conversion if it has none.
+//
+
+static JsErrorCode GetExceptionMessage(JsValueRef exception, wstring &message)
+{
+	JsPropertyIdRef messageName;
+	IfFailRet(PropertyIds::Get(PropertyIdMessage, &messageName));
+
+	JsValueRef messageValue;
+	IfFailRet(JsGetProperty(exception, messageName, &messageValue));
+
+	JsValueType type;
+	IfFailRet(JsGetValueType(messageValue, &type));
+	if (type == JsUndefined)
+	{
+		messageValue = exception;
+	}
+
+	JsValueRef stringValue;
+	IfFailRet(JsConvertValueToString(messageValue, &stringValue));
+
+	const wchar_t *messageString;
+	size_t length;
+	IfFailRet(JsStringToPointer(stringValue, &messageString, &length));
+
+	message.assign(messageString, length);
+
+	return JsNoError;
+}
+
+//
+// Resolve a specifier against the importing module's directory and return the record for it,
+// creating the record and queueing the file for a reader if we haven't seen the module before.
+//
+
+JsErrorCode ModuleLoader::GetModule(JsModuleRecord referencingModule, const wstring &directory, JsValueRef specifier, JsModuleRecord *moduleRecord)
+{
+	const wchar_t *specifierString;
+	size_t length;
+	IfFailRet(JsStringToPointer(specifier, &specifierString, &length));
+
+	wstring relativePath(specifierString, length);
+	if (!IsAbsolutePath(relativePath))
+	{
+		relativePath = directory + relativePath;
+	}
+
+	//
+	// The canonical path is the cache key.
+	//
+
+	DWORD pathLength = GetFullPathNameW(relativePath.c_str(), 0, nullptr, nullptr);
+	wstring path(pathLength, L'\0');
+	if (pathLength == 0 || (pathLength = GetFullPathNameW(relativePath.c_str(), pathLength, &path[0], nullptr)) == 0)
+	{
+		fwprintf(stderr, L"chakrahost: unable to resolve module: %s.\n", relativePath.c_str());
+		failed = true;
+		return JsErrorInvalidArgument;
+	}
+
+	path.resize(pathLength);
+
+	auto cached = modulesByPath.find(path);
+	if (cached != modulesByPath.end())
+	{
+		*moduleRecord = cached->second->record;
+		return JsNoError;
+	}
+
+	JsValueRef pathValue;
+	IfFailRet(JsPointerToString(path.c_str(), path.length(), &pathValue));
+
+	JsModuleRecord record;
+	IfFailRet(JsInitializeModuleRecord(referencingModule, pathValue, &record));
+	IfFailRet(JsSetModuleHostInfo(record, JsModuleHostInfo_HostDefined, pathValue));
+	IfFailRet(JsSetModuleHostInfo(record, JsModuleHostInfo_Url, pathValue));
+	IfFailRet(JsSetModuleHostInfo(record, JsModuleHostInfo_FetchImportedModuleCallback, (void *) FetchImportedModule));
+	IfFailRet(JsSetModuleHostInfo(record, JsModuleHostInfo_FetchImportedModuleFromScriptCallback, (void *) FetchImportedModuleFromScript));
+	IfFailRet(JsSetModuleHostInfo(record, JsModuleHostInfo_NotifyModuleReadyCallback, (void *) NotifyModuleReady));
+
+	Module *module = new Module();
+	module->path = path;
+	module->record = record;
+	module->order = (unsigned) modulesByPath.size();
+	module->source = nullptr;
+	module->readFailed = false;
+
+	modulesByPath[path] = module;
+	modulesByRecord[record] = module;
+
+	{
+		lock_guard<mutex> guard(lock);
+		readQueue.push_back(module);
+		pendingReads++;
+	}
+
+	readRequested.notify_one();
+
+	//
+	// The loop has to keep running until the read is done, in case it's for a dynamic import.
+	//
+
+	EventLoop::Current()->AddSource(this);
+
+	*moduleRecord = record;
+	return JsNoError;
+}
+
+//
+// Reader thread: map the files of newly discovered modules and page them in, so the runtime
+// thread never waits on the disk while it parses.
+//
+
+void ModuleLoader::Read()
+{
+	for (;;)
+	{
+		Module *module;
+
+		{
+			unique_lock<mutex> guard(lock);
+			readRequested.wait(guard, [this] { return !readQueue.empty() || stopping; });
+
+			if (readQueue.empty())
+			{
+				return;
+			}
+
+			module = readQueue.front();
+			readQueue.pop_front();
+		}
+
+		MappedFile *source = MappedFile::Open(module->path.c_str());
+
+		//
+		// Modules are parsed from a 32-bit length.
+		//
+
+		if (source != nullptr && source->Length() > UINT_MAX)
+		{
+			fwprintf(stderr, L"chakrahost: file too large: %s.\n", module->path.c_str());
+			delete source;
+			source = nullptr;
+		}
+
+		if (source != nullptr)
+		{
+			const volatile BYTE *data = source->Data();
+			BYTE touch = 0;
+			for (unsigned long long offset = 0; offset < source->Length(); offset += 4096)
+			{
+				touch ^= data[offset];
+			}
+
+			(void) touch;
+		}
+
+		module->source = source;
+		module->readFailed = source == nullptr;
+
+		{
+			lock_guard<mutex> guard(lock);
+			readModules[module->order] = module;
+			pendingReads--;
+		}
+
+		readCompleted.notify_one();
+		WakeEventLoop();
+	}
+}
+
+//
+// Once RunModule has returned, the event loop does the parsing, so a read or a ready module has to
+// wake it. While RunModule is still going, the wake-ups find nothing to do.
+//
+
+void ModuleLoader::WakeEventLoop()
+{
+	if (wakeHandle != nullptr)
+	{
+		EventLoop::Wake(wakeHandle, this);
+	}
+}
+
+//
+// Parse a module whose file has been read. Its imports are fetched from inside the parse.
+//
+
+bool ModuleLoader::ParseModule(Module *module)
+{
+	//
+	// The engine takes UTF-8 as is, apart from a byte order mark.
+	//
+
+	static BYTE emptySource[1] = { 0 };
+
+	BYTE *data = module->source->Length() > 0 ? (BYTE *) module->source->Data() : emptySource;
+	unsigned int length = (unsigned int) module->source->Length();
+
+	if (length >= 3 && data[0] == 0xEF && data[1] == 0xBB && data[2] == 0xBF)
+	{
+		data += 3;
+		length -= 3;
+	}
+
+	JsValueRef exception = JS_INVALID_REFERENCE;
+	JsErrorCode errorCode = JsParseModuleSource(module->record, currentSourceContext++, data, length, JsParseModuleSourceFlags_DataIsUTF8, &exception);
+
+	//
+	// The engine keeps its own copy of the source.
+	//
+
+	delete module->source;
+	module->source = nullptr;
+
+	if (errorCode != JsNoError)
+	{
+		//
+		// The engine may already have reported the error through NotifyModuleReady.
+		//
+
+		wstring message;
+		if (!failed && exception != JS_INVALID_REFERENCE && GetExceptionMessage(exception, message) == JsNoError)
+		{
+			fwprintf(stderr, L"chakrahost: exception: %s (%s)\n", message.c_str(), module->path.c_str());
+		}
+		else if (!failed)
+		{
+			fwprintf(stderr, L"chakrahost: failed to parse module: %s.\n", module->path.c_str());
+		}
+
+		failed = true;
+		return false;
+	}
+
+	return true;
+}
+
+//
+// Parse the next module whose file has been read (by discovery order) or, once nothing is left to
+// read or parse, evaluate whatever became ready. Evaluation can start dynamic imports, which give
+// us more to do. With wait, waits for outstanding reads; otherwise *progressed is false if there
+// was nothing to do yet.
+//
+
+JsErrorCode ModuleLoader::Step(bool wait, bool *progressed)
+{
+	*progressed = false;
+
+	Module *module = nullptr;
+
+	{
+		unique_lock<mutex> guard(lock);
+		if (wait)
+		{
+			readCompleted.wait(guard, [this] { return !readModules.empty() || pendingReads == 0; });
+		}
+
+		if (!readModules.empty())
+		{
+			module = readModules.begin()->second;
+			readModules.erase(readModules.begin());
+		}
+		else if (pendingReads > 0)
+		{
+			return JsNoError;
+		}
+	}
+
+	if (module != nullptr)
+	{
+		*progressed = true;
+
+		if (module->readFailed)
+		{
+			failed = true;
+		}
+		else
+		{
+			ParseModule(module);
+		}
+
+		return JsNoError;
+	}
+
+	if (readyModules.empty())
+	{
+		return JsNoError;
+	}
+
+	*progressed = true;
+
+	vector<JsModuleRecord> modules;
+	modules.swap(readyModules);
+
+	for (JsModuleRecord record : modules)
+	{
+		JsValueRef moduleResult;
+		IfFailRet(JsModuleEvaluation(record, &moduleResult));
+
+		if (record == root && rootResult != nullptr)
+		{
+			*rootResult = moduleResult;
+			rootEvaluated = true;
+		}
+	}
+
+	return JsNoError;
+}
+
+JsErrorCode ModuleLoader::RunModule(const wchar_t *fileName, JsValueRef *result)
+{
+	//
+	// The loader stays installed after this returns, for import() from the event loop.
+	//
+
+	if (currentLoader != this)
+	{
+		previousLoader = currentLoader;
+		currentLoader = this;
+	}
+
+	JsErrorCode errorCode = JsNoError;
+	rootEvaluated = false;
+	rootResult = result;
+
+	JsValueRef specifier;
+	errorCode = JsPointerToString(fileName, wcslen(fileName), &specifier);
+	if (errorCode == JsNoError)
+	{
+		errorCode = GetModule(nullptr, wstring(), specifier, &root);
+	}
+
+	//
+	// Parse modules as their files arrive and evaluate them, until the graph is complete.
+	//
+
+	while (errorCode == JsNoError && !failed)
+	{
+		bool progressed;
+		errorCode = Step(true, &progressed);
+		if (!progressed)
+		{
+			break;
+		}
+	}
+
+	rootResult = nullptr;
+
+	if (errorCode == JsNoError && (failed || !rootEvaluated))
+	{
+		if (!failed)
+		{
+			fwprintf(stderr, L"chakrahost: failed to load module: %s.\n", fileName);
+		}
+
+		errorCode = JsErrorInvalidArgument;
+	}
+
+	return errorCode;
+}
+
+//
+// Called by the event loop when a reader or NotifyModuleReady woke it.
+//
+
+JsErrorCode ModuleLoader::DeliverNext(bool *delivered)
+{
+	if (failed)
+	{
+		*delivered = false;
+		return JsErrorInvalidArgument;
+	}
+
+	IfFailRet(Step(false, delivered));
+
+	//
+	// A dynamic import that fails to load fails the job, just as a static one does.
+	//
+
+	return failed ? JsErrorInvalidArgument : JsNoError;
+}
+
+bool ModuleLoader::IsActive()
+{
+	//
+	// A failure keeps the loop going until DeliverNext reports it.
+	//
+
+	if (failed)
+	{
+		return true;
+	}
+
+	if (!readyModules.empty())
+	{
+		return true;
+	}
+
+	lock_guard<mutex> guard(lock);
+	return pendingReads > 0 || !readModules.empty();
+}
+
+//
+// The loader belongs to whoever called RunModule, and outlives the loop's use of it.
+//
+
+void ModuleLoader::Close()
+{
+}
+
+JsErrorCode CALLBACK ModuleLoader::FetchImportedModule(JsModuleRecord referencingModule, JsValueRef specifier, JsModuleRecord *dependentModuleRecord)
+{
+	ModuleLoader *loader = currentLoader;
+	if (loader == nullptr)
+	{
+		return JsErrorInvalidArgument;
+	}
+
+	auto referencing = loader->modulesByRecord.find(referencingModule);
+	wstring directory = referencing != loader->modulesByRecord.end() ? GetDirectory(referencing->second->path) : wstring();
+
+	return loader->GetModule(referencingModule, directory, specifier, dependentModuleRecord);
+}
+
+JsErrorCode CALLBACK ModuleLoader::FetchImportedModuleFromScript(JsSourceContext referencingSourceContext, JsValueRef specifier, JsModuleRecord *dependentModuleRecord)
+{
+	//
+	// import() from a classic script resolves against the current directory. Scripts only get
+	// modules while a module is running.
+	//
+
+	if (currentLoader == nullptr)
+	{
+		return JsErrorInvalidArgument;
+	}
+
+	return currentLoader->GetModule(nullptr, wstring(), specifier, dependentModuleRecord);
+}
+
+JsErrorCode CALLBACK ModuleLoader::NotifyModuleReady(JsModuleRecord referencingModule, JsValueRef exception)
+{
+	ModuleLoader *loader = currentLoader;
+	if (loader == nullptr)
+	{
+		return JsErrorInvalidArgument;
+	}
+
+	if (exception != JS_INVALID_REFERENCE && exception != nullptr)
+	{
+		wstring message;
+		if (!loader->failed && GetExceptionMessage(exception, message) == JsNoError)
+		{
+			auto module = loader->modulesByRecord.find(referencingModule);
+			fwprintf(stderr, L"chakrahost: exception: %s (%s)\n", message.c_str(),
+				module != loader->modulesByRecord.end() ? module->second->path.c_str() : L"module");
+		}
+
+		loader->failed = true;
+		EventLoop::Current()->AddSource(loader);
+		loader->WakeEventLoop();
+		return JsNoError;
+	}
+
+	//
+	// A module imported again once it's loaded is ready without any read, so wake the loop here too.
+	//
+
+	loader->readyModules.push_back(referencingModule);
+	EventLoop::Current()->AddSource(loader);
+	loader->WakeEventLoop();
+	return JsNoError;
+}
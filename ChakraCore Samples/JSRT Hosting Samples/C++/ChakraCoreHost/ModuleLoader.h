@@ -0,0 +1,103 @@
+#pragma once
+
+#include "ScriptLoader.h"
+#include "EventLoop.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+//
+// Loads an ES module and everything it imports into the current context, then evaluates it.
+//
+// The engine tells us about a module's imports while it parses the module. Each new import gets a
+// module record straight away and its file is handed to a reader thread, so the files of a whole
+// level of the graph are read in parallel while the runtime thread goes on parsing. Modules are
+// parsed in the order they were discovered, which walks the graph breadth-first. Records are cached
+// by canonical path, so a module imported under different relative names is loaded once.
+//
+// One loader serves one context, on the thread that runs it. It stays installed from RunModule
+// until it's destroyed, so import() from timers, promise jobs and message handlers still finds it.
+// Modules those imports bring in are parsed and evaluated from the event loop: the loader is a
+// message source of the loop, and the reader threads wake the loop when a file has been read.
+//
+
+class ModuleLoader : public MessageSource
+{
+public:
+	explicit ModuleLoader(unsigned readerCount);
+	~ModuleLoader();
+
+	//
+	// Load the module graph rooted at a file and evaluate it. Returns JsErrorInvalidArgument (after
+	// printing why) if a module can't be loaded, resolved or parsed.
+	//
+
+	JsErrorCode RunModule(const wchar_t *fileName, JsValueRef *result);
+
+	//
+	// MessageSource: parse or evaluate whatever dynamic imports are waiting for.
+	//
+
+	JsErrorCode DeliverNext(bool *delivered) override;
+	bool IsActive() override;
+	void Close() override;
+
+private:
+	struct Module
+	{
+		std::wstring path;
+		JsModuleRecord record;
+		unsigned order;
+		MappedFile *source;
+		bool readFailed;
+	};
+
+	std::map<std::wstring, Module *> modulesByPath;
+	std::map<JsModuleRecord, Module *> modulesByRecord;
+
+	//
+	// Whether any module failed to load, and the modules the engine says are ready to evaluate. Both
+	// are only touched on the runtime thread.
+	//
+
+	bool failed;
+	std::vector<JsModuleRecord> readyModules;
+
+	//
+	// The root module and where its completion value goes while RunModule is evaluating it.
+	//
+
+	JsModuleRecord root;
+	JsValueRef *rootResult;
+	bool rootEvaluated;
+
+	ModuleLoader *previousLoader;
+	HANDLE wakeHandle;
+
+	//
+	// Files waiting for a reader, and files read but not yet parsed (by discovery order).
+	//
+
+	std::mutex lock;
+	std::condition_variable readRequested;
+	std::condition_variable readCompleted;
+	std::deque<Module *> readQueue;
+	std::map<unsigned, Module *> readModules;
+	unsigned pendingReads;
+	bool stopping;
+	std::vector<std::thread> readers;
+
+	JsErrorCode GetModule(JsModuleRecord referencingModule, const std::wstring &directory, JsValueRef specifier, JsModuleRecord *moduleRecord);
+	bool ParseModule(Module *module);
+	JsErrorCode Step(bool wait, bool *progressed);
+	void WakeEventLoop();
+	void Read();
+
+	static JsErrorCode CALLBACK FetchImportedModule(JsModuleRecord referencingModule, JsValueRef specifier, JsModuleRecord *dependentModuleRecord);
+	static JsErrorCode CALLBACK FetchImportedModuleFromScript(JsSourceContext referencingSourceContext, JsValueRef specifier, JsModuleRecord *dependentModuleRecord);
+	static JsErrorCode CALLBACK NotifyModuleReady(JsModuleRecord referencingModule, JsValueRef exception);
+};
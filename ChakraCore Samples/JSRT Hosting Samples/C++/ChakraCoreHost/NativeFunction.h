@@ -0,0 +1,454 @@
+#pragma once
+
+#include <string>
+#include <tuple>
+#include <utility>
+#include <new>
+#include <exception>
+#include <cwchar>
+#include <climits>
+#include <type_traits>
+#include "NativeObject.h"
+
+//
+// Typed native functions. NATIVE_FUNCTION(function) turns an ordinary C++ function into a
+// JsNativeFunction: the arguments are checked against the function's parameters and converted
+// to them, and the result is converted back, all chosen at compile time from the function's type.
+// Arguments are converted into a tuple on the stack; nothing is allocated unless a parameter type
+// asks for it (std::wstring).
+//
+// NATIVE_METHOD(function) does the same, but passes `this` as the function's first parameter.
+//
+// Parameter types:
+//
+//     double, float, int, bool        any value, converted as JavaScript would
+//     const wchar_t *, std::wstring   a string
+//     JsValueRef                      any value, as is
+//     T &                             an external object over a T (see NativeObject)
+//     NativeOptional<T>               a T that may be left out
+//     NativeRestArguments             all remaining arguments, which may be none
+//
+// Result types are void (undefined), double, float, int, bool, const wchar_t *, std::wstring and
+// JsValueRef.
+//
+// A missing argument or one that doesn't convert raises a JavaScript error. So does a
+// NativeScriptError thrown by the function, with its message; any other C++ exception is turned
+// into a JavaScript error rather than being let into the engine.
+//
+
+struct NativeScriptError
+{
+	explicit NativeScriptError(const wchar_t *message) : message(message) {}
+	explicit NativeScriptError(std::wstring message) : message(std::move(message)) {}
+
+	std::wstring message;
+};
+
+//
+// Raise a NativeScriptError with a message if a JSRT call fails.
+//
+
+#define IfFailScriptError(v, e) \
+    { \
+        JsErrorCode error = (v); \
+        if (error != JsNoError) \
+        { \
+            throw NativeScriptError((e)); \
+        } \
+    }
+
+template <class T>
+struct NativeOptional
+{
+	bool present;
+	T value;
+};
+
+struct NativeRestArguments
+{
+	JsValueRef *values;
+	unsigned short count;
+};
+
+//
+// Create an external object over a native object.
+//
+
+inline JsErrorCode CreateNativeObject(NativeObject *object, JsFinalizeCallback finalizeCallback, JsValueRef *value)
+{
+	return JsCreateExternalObject(object, finalizeCallback, value);
+}
+
+//
+// The native object an external object wraps, as a T, or nullptr if the value isn't an external
+// object over a T.
+//
+
+template <class T>
+T *GetNativeObject(JsValueRef value)
+{
+	void *data;
+	if (JsGetExternalData(value, &data) != JsNoError || data == nullptr)
+	{
+		return nullptr;
+	}
+
+	return dynamic_cast<T *>(static_cast<NativeObject *>(data));
+}
+
+namespace NativeBinding
+{
+	inline void SetException(const wchar_t *message)
+	{
+		//
+		// We ignore errors since we're already in an error state.
+		//
+
+		JsValueRef messageValue;
+		JsValueRef errorObject;
+		JsPointerToString(message, wcslen(message), &messageValue);
+		JsCreateError(messageValue, &errorObject);
+		JsSetException(errorObject);
+	}
+
+	//
+	// Argument conversion. Each converter has a Storage type that lives on the caller's stack, a
+	// Convert that fills it in from the argument at `index` (which may be past the end for optional
+	// and rest parameters), and a Get that hands it to the function.
+	//
+
+	template <class T>
+	struct Argument;
+
+	template <>
+	struct Argument<double>
+	{
+		typedef double Storage;
+		static const bool required = true;
+
+		static bool Convert(JsValueRef *values, unsigned short count, unsigned short index, Storage *storage)
+		{
+			if (JsNumberToDouble(values[index], storage) == JsNoError)
+			{
+				return true;
+			}
+
+			JsValueRef number;
+			return JsConvertValueToNumber(values[index], &number) == JsNoError && JsNumberToDouble(number, storage) == JsNoError;
+		}
+
+		static double Get(Storage &storage) { return storage; }
+	};
+
+	template <>
+	struct Argument<float> : Argument<double>
+	{
+		static float Get(Storage &storage) { return (float) storage; }
+	};
+
+	template <>
+	struct Argument<int> : Argument<double>
+	{
+		//
+		// Casting NaN, the infinities or anything out of range to int is undefined, so NaN is 0 and
+		// the rest are clamped.
+		//
+
+		static int Get(Storage &storage)
+		{
+			if (storage != storage)
+			{
+				return 0;
+			}
+
+			if (storage >= (double) INT_MAX)
+			{
+				return INT_MAX;
+			}
+
+			if (storage <= (double) INT_MIN)
+			{
+				return INT_MIN;
+			}
+
+			return (int) storage;
+		}
+	};
+
+	template <>
+	struct Argument<bool>
+	{
+		typedef bool Storage;
+		static const bool required = true;
+
+		static bool Convert(JsValueRef *values, unsigned short count, unsigned short index, Storage *storage)
+		{
+			JsValueRef boolean;
+			return JsConvertValueToBoolean(values[index], &boolean) == JsNoError && JsBooleanToBool(boolean, storage) == JsNoError;
+		}
+
+		static bool Get(Storage &storage) { return storage; }
+	};
+
+	template <>
+	struct Argument<const wchar_t *>
+	{
+		struct Storage
+		{
+			const wchar_t *string;
+			size_t length;
+		};
+
+		static const bool required = true;
+
+		static bool Convert(JsValueRef *values, unsigned short count, unsigned short index, Storage *storage)
+		{
+			return JsStringToPointer(values[index], &storage->string, &storage->length) == JsNoError;
+		}
+
+		static const wchar_t *Get(Storage &storage) { return storage.string; }
+	};
+
+	template <>
+	struct Argument<std::wstring> : Argument<const wchar_t *>
+	{
+		static std::wstring Get(Storage &storage) { return std::wstring(storage.string, storage.length); }
+	};
+
+	template <>
+	struct Argument<const std::wstring &> : Argument<std::wstring>
+	{
+	};
+
+	template <>
+	struct Argument<JsValueRef>
+	{
+		typedef JsValueRef Storage;
+		static const bool required = true;
+
+		static bool Convert(JsValueRef *values, unsigned short count, unsigned short index, Storage *storage)
+		{
+			*storage = values[index];
+			return true;
+		}
+
+		static JsValueRef Get(Storage &storage) { return storage; }
+	};
+
+	template <class T>
+	struct Argument<T &>
+	{
+		typedef T *Storage;
+		static const bool required = true;
+
+		static_assert(std::is_base_of<NativeObject, T>::value, "external objects must wrap a NativeObject");
+
+		static bool Convert(JsValueRef *values, unsigned short count, unsigned short index, Storage *storage)
+		{
+			*storage = GetNativeObject<T>(values[index]);
+			return *storage != nullptr;
+		}
+
+		static T &Get(Storage &storage) { return *storage; }
+	};
+
+	template <class T>
+	struct Argument<NativeOptional<T>>
+	{
+		typedef NativeOptional<typename Argument<T>::Storage> Storage;
+		static const bool required = false;
+
+		static bool Convert(JsValueRef *values, unsigned short count, unsigned short index, Storage *storage)
+		{
+			//
+			// Undefined counts as left out, as it does for JavaScript default parameters.
+			//
+
+			JsValueType type;
+			storage->present = index < count && JsGetValueType(values[index], &type) == JsNoError && type != JsUndefined;
+			return !storage->present || Argument<T>::Convert(values, count, index, &storage->value);
+		}
+
+		static NativeOptional<T> Get(Storage &storage)
+		{
+			NativeOptional<T> optional = { storage.present, T() };
+			if (storage.present)
+			{
+				optional.value = Argument<T>::Get(storage.value);
+			}
+
+			return optional;
+		}
+	};
+
+	template <>
+	struct Argument<NativeRestArguments>
+	{
+		typedef NativeRestArguments Storage;
+		static const bool required = false;
+
+		static bool Convert(JsValueRef *values, unsigned short count, unsigned short index, Storage *storage)
+		{
+			storage->values = values + index;
+			storage->count = index < count ? count - index : 0;
+			return true;
+		}
+
+		static NativeRestArguments Get(Storage &storage) { return storage; }
+	};
+
+	//
+	// Result conversion.
+	//
+
+	inline JsValueRef ToValue(JsValueRef value) { return value; }
+
+	inline JsValueRef ToValue(double value)
+	{
+		JsValueRef result;
+		IfFailScriptError(JsDoubleToNumber(value, &result), L"invalid result");
+		return result;
+	}
+
+	inline JsValueRef ToValue(float value) { return ToValue((double) value); }
+
+	inline JsValueRef ToValue(int value)
+	{
+		JsValueRef result;
+		IfFailScriptError(JsIntToNumber(value, &result), L"invalid result");
+		return result;
+	}
+
+	inline JsValueRef ToValue(bool value)
+	{
+		JsValueRef result;
+		IfFailScriptError(JsBoolToBoolean(value, &result), L"invalid result");
+		return result;
+	}
+
+	inline JsValueRef ToValue(const wchar_t *value)
+	{
+		JsValueRef result;
+		IfFailScriptError(JsPointerToString(value, wcslen(value), &result), L"invalid result");
+		return result;
+	}
+
+	inline JsValueRef ToValue(const std::wstring &value)
+	{
+		JsValueRef result;
+		IfFailScriptError(JsPointerToString(value.c_str(), value.length(), &result), L"invalid result");
+		return result;
+	}
+
+	template <class Result>
+	struct Return
+	{
+		template <class Call>
+		static JsValueRef Invoke(Call call) { return ToValue(call()); }
+	};
+
+	template <>
+	struct Return<void>
+	{
+		template <class Call>
+		static JsValueRef Invoke(Call call)
+		{
+			call();
+			return JS_INVALID_REFERENCE;
+		}
+	};
+
+	template <bool... values>
+	struct CountTrue;
+
+	template <>
+	struct CountTrue<>
+	{
+		static const unsigned value = 0;
+	};
+
+	template <bool first, bool... rest>
+	struct CountTrue<first, rest...>
+	{
+		static const unsigned value = (first ? 1 : 0) + CountTrue<rest...>::value;
+	};
+
+	template <class Signature, Signature function, bool isMethod>
+	struct Function;
+
+	template <class Result, class... Arguments, Result (*function)(Arguments...), bool isMethod>
+	struct Function<Result (*)(Arguments...), function, isMethod>
+	{
+		//
+		// Parameters that need an argument; optional and rest parameters come last.
+		//
+
+		static const unsigned requiredCount = CountTrue<Argument<Arguments>::required...>::value;
+
+		static JsValueRef CALLBACK Call(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+		{
+			//
+			// arguments[0] is `this`, which only methods take.
+			//
+
+			JsValueRef *values = isMethod ? arguments : arguments + 1;
+			unsigned short count = isMethod ? argumentCount : argumentCount - 1;
+
+			if (count < requiredCount)
+			{
+				SetException(L"not enough arguments");
+				return JS_INVALID_REFERENCE;
+			}
+
+			try
+			{
+				return Invoke(values, count, std::index_sequence_for<Arguments...>());
+			}
+			catch (const NativeScriptError &error)
+			{
+				SetException(error.message.c_str());
+			}
+			catch (const std::bad_alloc &)
+			{
+				SetException(L"out of memory");
+			}
+			catch (...)
+			{
+				SetException(L"internal error");
+			}
+
+			return JS_INVALID_REFERENCE;
+		}
+
+	private:
+		template <size_t... indices>
+		static JsValueRef Invoke(JsValueRef *values, unsigned short count, std::index_sequence<indices...>)
+		{
+			std::tuple<typename Argument<Arguments>::Storage...> storage;
+
+			//
+			// Braced initializers are evaluated in order, so arguments convert left to right.
+			//
+
+			bool converted[] = { true, Argument<Arguments>::Convert(values, count, (unsigned short) indices, &std::get<indices>(storage))... };
+
+			for (unsigned index = 1; index < sizeof(converted) / sizeof(converted[0]); index++)
+			{
+				if (!converted[index])
+				{
+					if (isMethod && index == 1)
+					{
+						throw NativeScriptError(L"invalid this value");
+					}
+
+					throw NativeScriptError(L"invalid argument " + std::to_wstring(isMethod ? index - 1 : index));
+				}
+			}
+
+			return Return<Result>::Invoke([&] { return function(Argument<Arguments>::Get(std::get<indices>(storage))...); });
+		}
+	};
+}
+
+#define NATIVE_FUNCTION(function) (NativeBinding::Function<decltype(&function), &function, false>::Call)
+#define NATIVE_METHOD(function) (NativeBinding::Function<decltype(&function), &function, true>::Call)
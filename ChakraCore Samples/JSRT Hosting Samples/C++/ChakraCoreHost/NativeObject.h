@@ -0,0 +1,14 @@
+#pragma once
+
+//
+// The base of every native object that an external object wraps. External objects are created with
+// CreateNativeObject (NativeFunction.h), so their data is always a NativeObject, and a native
+// function that takes a T & checks with dynamic_cast that the object really is a T. A script can
+// then hand a function any external object without it being read as some other type.
+//
+
+class NativeObject
+{
+protected:
+	virtual ~NativeObject() {}
+};
@@ -0,0 +1,209 @@
+#include "stdafx.h"
+#include "PropertyIds.h"
+
+using namespace std;
+
+//
+// The well-known names, indexed by PropertyId.
+//
+
+static constexpr const wchar_t *propertyNames[] =
+{
+#define DEFINE_PROPERTY_NAME(id, name) name,
+	HOST_PROPERTY_NAMES(DEFINE_PROPERTY_NAME)
+#undef DEFINE_PROPERTY_NAME
+};
+
+static_assert(sizeof(propertyNames) / sizeof(propertyNames[0]) == PropertyIdCount, "every PropertyId needs a name");
+
+//
+// Initial size of a runtime's table of other names.
+//
+
+static const size_t initialNamedSize = 64;
+
+mutex PropertyIds::lock;
+map<JsRuntimeHandle, PropertyIds::Table *> PropertyIds::tables;
+atomic<unsigned> PropertyIds::generation(0);
+
+//
+// FNV-1a over the characters of a name.
+//
+
+static size_t HashName(const wchar_t *name)
+{
+	size_t hash = (size_t) 14695981039346656037ULL;
+	for (; *name != L'\0'; name++)
+	{
+		hash = (hash ^ (size_t) *name) * (size_t) 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+void PropertyIds::Attach(JsRuntimeHandle runtime)
+{
+	Table *table = new Table();
+	for (JsPropertyIdRef &propertyId : table->wellKnown)
+	{
+		propertyId = JS_INVALID_REFERENCE;
+	}
+
+	table->named.resize(initialNamedSize);
+	table->namedCount = 0;
+
+	lock_guard<mutex> guard(lock);
+	tables[runtime] = table;
+	generation++;
+}
+
+void PropertyIds::Detach(JsRuntimeHandle runtime)
+{
+	lock_guard<mutex> guard(lock);
+
+	auto entry = tables.find(runtime);
+	if (entry == tables.end())
+	{
+		return;
+	}
+
+	//
+	// The pinned IDs go away with the runtime itself. Bumping the generation makes every thread
+	// forget the table it may have cached.
+	//
+
+	delete entry->second;
+	tables.erase(entry);
+	generation++;
+}
+
+PropertyIds::Table *PropertyIds::GetCurrentTable()
+{
+	static thread_local JsContextRef cachedContext = JS_INVALID_REFERENCE;
+	static thread_local unsigned cachedGeneration = 0;
+	static thread_local Table *cachedTable = nullptr;
+
+	JsContextRef context;
+	if (JsGetCurrentContext(&context) != JsNoError || context == JS_INVALID_REFERENCE)
+	{
+		return nullptr;
+	}
+
+	unsigned currentGeneration = generation;
+	if (context == cachedContext && currentGeneration == cachedGeneration)
+	{
+		return cachedTable;
+	}
+
+	JsRuntimeHandle runtime;
+	if (JsGetRuntime(context, &runtime) != JsNoError)
+	{
+		return nullptr;
+	}
+
+	lock_guard<mutex> guard(lock);
+
+	auto entry = tables.find(runtime);
+	cachedContext = context;
+	cachedGeneration = currentGeneration;
+	cachedTable = entry != tables.end() ? entry->second : nullptr;
+	return cachedTable;
+}
+
+JsErrorCode PropertyIds::Get(PropertyId id, JsPropertyIdRef *propertyId)
+{
+	Table *table = GetCurrentTable();
+
+	//
+	// Runtimes the host didn't create have no table, and simply don't get the cache.
+	//
+
+	if (table == nullptr)
+	{
+		return JsGetPropertyIdFromName(propertyNames[id], propertyId);
+	}
+
+	if (table->wellKnown[id] == JS_INVALID_REFERENCE)
+	{
+		JsPropertyIdRef resolved;
+		IfFailRet(JsGetPropertyIdFromName(propertyNames[id], &resolved));
+		IfFailRet(JsAddRef(resolved, nullptr));
+		table->wellKnown[id] = resolved;
+	}
+
+	*propertyId = table->wellKnown[id];
+	return JsNoError;
+}
+
+JsErrorCode PropertyIds::Get(const wchar_t *name, JsPropertyIdRef *propertyId)
+{
+	Table *table = GetCurrentTable();
+	if (table == nullptr)
+	{
+		return JsGetPropertyIdFromName(name, propertyId);
+	}
+
+	size_t hash = HashName(name);
+	size_t mask = table->named.size() - 1;
+
+	for (size_t index = hash & mask; table->named[index].propertyId != JS_INVALID_REFERENCE; index = (index + 1) & mask)
+	{
+		const NamedPropertyId &entry = table->named[index];
+		if (entry.hash == hash && entry.name == name)
+		{
+			*propertyId = entry.propertyId;
+			return JsNoError;
+		}
+	}
+
+	JsPropertyIdRef resolved;
+	IfFailRet(JsGetPropertyIdFromName(name, &resolved));
+	IfFailRet(JsAddRef(resolved, nullptr));
+	InsertName(table, hash, name, resolved);
+
+	*propertyId = resolved;
+	return JsNoError;
+}
+
+const wchar_t *PropertyIds::GetName(PropertyId id)
+{
+	return propertyNames[id];
+}
+
+void PropertyIds::InsertName(Table *table, size_t hash, wstring name, JsPropertyIdRef propertyId)
+{
+	if ((table->namedCount + 1) * 2 > table->named.size())
+	{
+		vector<NamedPropertyId> named(table->named.size() * 2);
+		size_t mask = named.size() - 1;
+
+		for (NamedPropertyId &entry : table->named)
+		{
+			if (entry.propertyId != JS_INVALID_REFERENCE)
+			{
+				size_t index = entry.hash & mask;
+				while (named[index].propertyId != JS_INVALID_REFERENCE)
+				{
+					index = (index + 1) & mask;
+				}
+
+				named[index] = move(entry);
+			}
+		}
+
+		table->named.swap(named);
+	}
+
+	size_t mask = table->named.size() - 1;
+	size_t index = hash & mask;
+	while (table->named[index].propertyId != JS_INVALID_REFERENCE)
+	{
+		index = (index + 1) & mask;
+	}
+
+	NamedPropertyId &entry = table->named[index];
+	entry.hash = hash;
+	entry.name = move(name);
+	entry.propertyId = propertyId;
+	table->namedCount++;
+}
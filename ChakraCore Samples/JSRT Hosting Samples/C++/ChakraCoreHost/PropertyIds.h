@@ -0,0 +1,107 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <map>
+#include <mutex>
+#include <atomic>
+
+//
+// Property names the host itself uses. Each gets a PropertyId, and its JsPropertyIdRef is resolved
+// once per runtime instead of on every use.
+//
+
+#define HOST_PROPERTY_NAMES(PROPERTY) \
+	PROPERTY(Host, L"host") \
+	PROPERTY(Arguments, L"arguments") \
+	PROPERTY(Message, L"message") \
+	PROPERTY(Length, L"length") \
+	PROPERTY(Echo, L"echo") \
+	PROPERTY(Write, L"write") \
+	PROPERTY(RunScript, L"runScript") \
+	PROPERTY(MapFile, L"mapFile") \
+	PROPERTY(ReadFileInto, L"readFileInto") \
+	PROPERTY(ReadFile, L"readFile") \
+	PROPERTY(SetTimeout, L"setTimeout") \
+	PROPERTY(SetInterval, L"setInterval") \
+	PROPERTY(ClearTimeout, L"clearTimeout") \
+	PROPERTY(ClearInterval, L"clearInterval") \
+	PROPERTY(TimeoutMs, L"timeoutMs") \
+	PROPERTY(CpuTimeoutMs, L"cpuTimeoutMs") \
+	PROPERTY(Json, L"JSON") \
+	PROPERTY(Stringify, L"stringify") \
+	PROPERTY(Transform, L"transform") \
+	PROPERTY(SpawnWorker, L"spawnWorker") \
+	PROPERTY(PostWorkerMessage, L"postMessage") \
+	PROPERTY(OnMessage, L"onmessage") \
+	PROPERTY(Terminate, L"terminate") \
+	PROPERTY(Close, L"close") \
+	PROPERTY(CollectGarbage, L"collectGarbage") \
+	PROPERTY(GcStats, L"gcStats")
+
+enum PropertyId
+{
+#define DEFINE_PROPERTY_ID(id, name) PropertyId##id,
+	HOST_PROPERTY_NAMES(DEFINE_PROPERTY_ID)
+#undef DEFINE_PROPERTY_ID
+	PropertyIdCount
+};
+
+//
+// The property ID registry. Every runtime the host creates gets a table holding the IDs of the
+// well-known names above, indexed by PropertyId, and a small hash table for any other name the
+// host looks up, so a lookup is an array index or a hash probe rather than a trip into the engine.
+// IDs are resolved on first use and pinned with JsAddRef, which keeps them valid for the life of
+// the runtime.
+//
+// A runtime is only used by one thread at a time, so its table is never locked. Each thread
+// remembers the table of the context it last looked up from, and only goes back to the registry
+// when its current context changes or a runtime has been disposed.
+//
+
+class PropertyIds
+{
+public:
+	//
+	// Give a runtime its table, and drop it before the runtime is disposed.
+	//
+
+	static void Attach(JsRuntimeHandle runtime);
+	static void Detach(JsRuntimeHandle runtime);
+
+	//
+	// Get a property ID in the current context.
+	//
+
+	static JsErrorCode Get(PropertyId id, JsPropertyIdRef *propertyId);
+	static JsErrorCode Get(const wchar_t *name, JsPropertyIdRef *propertyId);
+
+	static const wchar_t *GetName(PropertyId id);
+
+private:
+	struct NamedPropertyId
+	{
+		size_t hash;
+		std::wstring name;
+		JsPropertyIdRef propertyId;
+	};
+
+	struct Table
+	{
+		JsPropertyIdRef wellKnown[PropertyIdCount];
+
+		//
+		// Open addressing with linear probing; the size is a power of two, kept at most half full.
+		//
+
+		std::vector<NamedPropertyId> named;
+		size_t namedCount;
+	};
+
+	static std::mutex lock;
+	static std::map<JsRuntimeHandle, Table *> tables;
+	static std::atomic<unsigned> generation;
+
+	static Table *GetCurrentTable();
+	static void InsertName(Table *table, size_t hash, std::wstring name, JsPropertyIdRef propertyId);
+};
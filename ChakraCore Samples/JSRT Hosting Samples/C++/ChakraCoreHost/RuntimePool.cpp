@@ -0,0 +1,174 @@
+#include "stdafx.h"
+#include "ChakraCoreHost.h"
+#include "RuntimePool.h"
+
+using namespace std;
+
+RuntimePool::RuntimePool(unsigned size, unsigned maxReuse, RuntimeResetStrategy resetStrategy) :
+	size(size),
+	maxReuse(maxReuse),
+	resetStrategy(resetStrategy)
+{
+}
+
+RuntimePool::~RuntimePool()
+{
+	for (PooledRuntime *pooledRuntime : runtimes)
+	{
+		DisposeRuntime(pooledRuntime);
+		delete pooledRuntime;
+	}
+}
+
+JsErrorCode RuntimePool::Initialize()
+{
+	for (unsigned index = 0; index < size; index++)
+	{
+		PooledRuntime *pooledRuntime = new PooledRuntime();
+		pooledRuntime->runtime = JS_INVALID_RUNTIME_HANDLE;
+		pooledRuntime->context = JS_INVALID_REFERENCE;
+		pooledRuntime->jobs = 0;
+		runtimes.push_back(pooledRuntime);
+
+		IfFailRet(CreateRuntime(pooledRuntime));
+		available.push_back(pooledRuntime);
+	}
+
+	return JsNoError;
+}
+
+JsErrorCode RuntimePool::CreateRuntime(PooledRuntime *pooledRuntime)
+{
+	IfFailRet(CreateHostRuntime(&pooledRuntime->runtime));
+	pooledRuntime->jobs = 0;
+
+	return CreateContext(pooledRuntime);
+}
+
+JsErrorCode RuntimePool::CreateContext(PooledRuntime *pooledRuntime)
+{
+	JsContextRef context;
+	IfFailRet(CreateHostContext(pooledRuntime->runtime, 0, nullptr, 0, &context));
+
+	//
+	// The context isn't current while the runtime sits in the pool, so keep it alive explicitly.
+	//
+
+	IfFailRet(JsAddRef(context, nullptr));
+
+	if (pooledRuntime->context != JS_INVALID_REFERENCE)
+	{
+		JsRelease(pooledRuntime->context, nullptr);
+	}
+
+	pooledRuntime->context = context;
+	return JsNoError;
+}
+
+void RuntimePool::DisposeRuntime(PooledRuntime *pooledRuntime)
+{
+	if (pooledRuntime->runtime == JS_INVALID_RUNTIME_HANDLE)
+	{
+		return;
+	}
+
+	if (pooledRuntime->context != JS_INVALID_REFERENCE)
+	{
+		JsRelease(pooledRuntime->context, nullptr);
+		pooledRuntime->context = JS_INVALID_REFERENCE;
+	}
+
+	DisposeHostRuntime(pooledRuntime->runtime);
+	pooledRuntime->runtime = JS_INVALID_RUNTIME_HANDLE;
+}
+
+PooledRuntime *RuntimePool::Acquire()
+{
+	PooledRuntime *pooledRuntime;
+
+	{
+		unique_lock<mutex> guard(lock);
+		runtimeAvailable.wait(guard, [this] { return !available.empty(); });
+		pooledRuntime = available.back();
+		available.pop_back();
+	}
+
+	if (pooledRuntime->runtime == JS_INVALID_RUNTIME_HANDLE || JsSetCurrentContext(pooledRuntime->context) != JsNoError)
+	{
+		Release(pooledRuntime);
+		return nullptr;
+	}
+
+	pooledRuntime->jobs++;
+	return pooledRuntime;
+}
+
+void RuntimePool::Release(PooledRuntime *pooledRuntime)
+{
+	JsSetCurrentContext(JS_INVALID_REFERENCE);
+
+	//
+	// A runtime that failed to reset is recreated, which is also how a runtime that couldn't be
+	// created gets another try.
+	//
+
+	JsErrorCode errorCode = JsNoError;
+
+	if (pooledRuntime->runtime == JS_INVALID_RUNTIME_HANDLE)
+	{
+		errorCode = JsErrorFatal;
+	}
+	else if (resetStrategy == RuntimeResetRuntime || (maxReuse > 0 && pooledRuntime->jobs >= maxReuse))
+	{
+		errorCode = JsErrorFatal;
+	}
+	else if (resetStrategy == RuntimeResetContext)
+	{
+		errorCode = CreateContext(pooledRuntime);
+	}
+
+	if (errorCode != JsNoError)
+	{
+		DisposeRuntime(pooledRuntime);
+		if (CreateRuntime(pooledRuntime) != JsNoError)
+		{
+			DisposeRuntime(pooledRuntime);
+		}
+	}
+
+	{
+		lock_guard<mutex> guard(lock);
+		available.push_back(pooledRuntime);
+	}
+
+	runtimeAvailable.notify_one();
+}
+
+bool RuntimePool::ParseResetStrategy(const wchar_t *name, RuntimeResetStrategy *resetStrategy)
+{
+	for (int strategy = RuntimeResetNone; strategy <= RuntimeResetRuntime; strategy++)
+	{
+		if (wcscmp(name, GetResetStrategyName((RuntimeResetStrategy) strategy)) == 0)
+		{
+			*resetStrategy = (RuntimeResetStrategy) strategy;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const wchar_t *RuntimePool::GetResetStrategyName(RuntimeResetStrategy resetStrategy)
+{
+	switch (resetStrategy)
+	{
+	case RuntimeResetNone:
+		return L"none";
+	case RuntimeResetContext:
+		return L"context";
+	case RuntimeResetRuntime:
+		return L"runtime";
+	}
+
+	return L"unknown";
+}
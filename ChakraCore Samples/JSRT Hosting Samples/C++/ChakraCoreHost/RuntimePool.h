@@ -0,0 +1,86 @@
+#pragma once
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+
+//
+// What happens to a pooled runtime between jobs.
+//
+
+enum RuntimeResetStrategy
+{
+	//
+	// Keep the context; the next job sees globals left by the previous one. Cheapest.
+	//
+
+	RuntimeResetNone,
+
+	//
+	// Give the next job a fresh host context in the same runtime.
+	//
+
+	RuntimeResetContext,
+
+	//
+	// Dispose of the runtime and create a new one.
+	//
+
+	RuntimeResetRuntime
+};
+
+//
+// A runtime owned by the pool, with its host context.
+//
+
+struct PooledRuntime
+{
+	JsRuntimeHandle runtime;
+	JsContextRef context;
+	unsigned jobs;
+};
+
+//
+// A pool of pre-initialized runtimes, each with a host context already set up, handed out one job
+// at a time. A runtime is only used by one thread at a time, but may move between threads.
+//
+
+class RuntimePool
+{
+public:
+	RuntimePool(unsigned size, unsigned maxReuse, RuntimeResetStrategy resetStrategy);
+	~RuntimePool();
+
+	JsErrorCode Initialize();
+
+	//
+	// Take a runtime from the pool, waiting for one if they're all busy. Its context is made current
+	// on the calling thread.
+	//
+
+	PooledRuntime *Acquire();
+
+	//
+	// Hand a runtime back. The context is cleared from the calling thread, and the runtime is reset
+	// according to the reset strategy, or recreated once it has run maxReuse jobs.
+	//
+
+	void Release(PooledRuntime *pooledRuntime);
+
+	static bool ParseResetStrategy(const wchar_t *name, RuntimeResetStrategy *resetStrategy);
+	static const wchar_t *GetResetStrategyName(RuntimeResetStrategy resetStrategy);
+
+private:
+	unsigned size;
+	unsigned maxReuse;
+	RuntimeResetStrategy resetStrategy;
+
+	std::vector<PooledRuntime *> runtimes;
+	std::vector<PooledRuntime *> available;
+	std::mutex lock;
+	std::condition_variable runtimeAvailable;
+
+	JsErrorCode CreateRuntime(PooledRuntime *pooledRuntime);
+	JsErrorCode CreateContext(PooledRuntime *pooledRuntime);
+	void DisposeRuntime(PooledRuntime *pooledRuntime);
+};
@@ -0,0 +1,360 @@
+#include "stdafx.h"
+#include "ScriptCache.h"
+#include "ScriptLoader.h"
+
+using namespace std;
+
+//
+// Layout of the header at the start of every cache entry.
+//
+
+struct ScriptCacheEntryHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned long long sourceHash;
+	unsigned long long sourceLength;
+	unsigned long long bytecodeLength;
+};
+
+static const unsigned int ScriptCacheMagic = 0x43424843; // 'CHBC'
+static const unsigned int ScriptCacheVersion = 2;
+
+mutex ScriptCache::sourcesLock;
+map<JsSourceContext, ScriptCache::LazySource> ScriptCache::sources;
+map<wstring, JsSourceContext> ScriptCache::sourceContexts;
+
+unsigned long long HashBytes(const void *data, size_t length, unsigned long long hash)
+{
+	const unsigned char *bytes = (const unsigned char *) data;
+	for (size_t index = 0; index < length; index++)
+	{
+		hash ^= bytes[index];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+ScriptCache::ScriptCache() :
+	hits(0),
+	misses(0),
+	writes(0),
+	rejects(0)
+{
+}
+
+bool ScriptCache::SetDirectory(const wstring &cacheDirectory)
+{
+	if (!CreateDirectoryW(cacheDirectory.c_str(), nullptr) && GetLastError() != ERROR_ALREADY_EXISTS)
+	{
+		fwprintf(stderr, L"chakrahost: unable to create cache directory: %s.\n", cacheDirectory.c_str());
+		return false;
+	}
+
+	directory = cacheDirectory;
+	if (directory.back() != L'\\' && directory.back() != L'/')
+	{
+		directory += L'\\';
+	}
+
+	return true;
+}
+
+//
+// Entries for one script path share a prefix, so stale entries can be found when the source changes.
+//
+
+wstring ScriptCache::GetEntryPrefix(const wchar_t *sourceUrl)
+{
+	//
+	// The first call gives the length including the terminator, the second the length without it.
+	//
+
+	wstring fullPath;
+	DWORD length = GetFullPathNameW(sourceUrl, 0, nullptr, nullptr);
+	if (length > 0)
+	{
+		fullPath.resize(length);
+		length = GetFullPathNameW(sourceUrl, length, &fullPath[0], nullptr);
+	}
+
+	if (length == 0 || length >= fullPath.size())
+	{
+		fullPath = sourceUrl;
+	}
+	else
+	{
+		fullPath.resize(length);
+	}
+
+	wchar_t prefix[32];
+	swprintf_s(prefix, L"%016llx-", HashBytes(fullPath.data(), fullPath.size() * sizeof(wchar_t)));
+	return directory + prefix;
+}
+
+wstring ScriptCache::GetEntryPath(const wchar_t *sourceUrl, unsigned long long sourceHash)
+{
+	wchar_t name[32];
+	swprintf_s(name, L"%016llx.bc", sourceHash);
+	return GetEntryPrefix(sourceUrl) + name;
+}
+
+JsErrorCode ScriptCache::ReadEntry(const wstring &path, unsigned long long sourceHash, size_t sourceLength, JsValueRef *bytecode)
+{
+	if (GetFileAttributesW(path.c_str()) == INVALID_FILE_ATTRIBUTES)
+	{
+		return JsErrorInvalidArgument;
+	}
+
+	MappedFile *entry = MappedFile::Open(path.c_str());
+	if (entry == nullptr)
+	{
+		return JsErrorInvalidArgument;
+	}
+
+	//
+	// The bytecode is handed to the engine straight out of the mapping.
+	//
+
+	const ScriptCacheEntryHeader *header = (const ScriptCacheEntryHeader *) entry->Data();
+
+	if (entry->Length() < sizeof(ScriptCacheEntryHeader) ||
+		header->magic != ScriptCacheMagic ||
+		header->version != ScriptCacheVersion ||
+		header->sourceHash != sourceHash ||
+		header->sourceLength != sourceLength ||
+		header->bytecodeLength == 0 ||
+		header->bytecodeLength != entry->Length() - sizeof(ScriptCacheEntryHeader))
+	{
+		delete entry;
+		return JsErrorInvalidArgument;
+	}
+
+	JsErrorCode errorCode = JsCreateExternalArrayBuffer((void *) (header + 1), (unsigned int) header->bytecodeLength, MappedFile::Finalize, entry, bytecode);
+	if (errorCode != JsNoError)
+	{
+		delete entry;
+	}
+
+	return errorCode;
+}
+
+bool ScriptCache::WriteEntry(const wstring &path, unsigned long long sourceHash, size_t sourceLength, const BYTE *bytecode, unsigned int bytecodeLength)
+{
+	//
+	// Write to a temporary file and rename it into place, so a concurrent host never sees half an entry.
+	//
+
+	wchar_t suffix[32];
+	swprintf_s(suffix, L".%lu.tmp", GetCurrentProcessId());
+	wstring temporaryPath = path + suffix;
+
+	FILE *file;
+	if (_wfopen_s(&file, temporaryPath.c_str(), L"wb"))
+	{
+		return false;
+	}
+
+	ScriptCacheEntryHeader header;
+	header.magic = ScriptCacheMagic;
+	header.version = ScriptCacheVersion;
+	header.sourceHash = sourceHash;
+	header.sourceLength = sourceLength;
+	header.bytecodeLength = bytecodeLength;
+
+	bool succeeded =
+		fwrite(&header, sizeof(header), 1, file) == 1 &&
+		fwrite(bytecode, 1, bytecodeLength, file) == bytecodeLength;
+
+	succeeded = (fclose(file) == 0) && succeeded;
+
+	if (!succeeded || !MoveFileExW(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileW(temporaryPath.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void ScriptCache::RemoveStaleEntries(const wchar_t *sourceUrl, const wstring &currentPath)
+{
+	wstring prefix = GetEntryPrefix(sourceUrl);
+	wstring pattern = prefix + L"*.bc";
+
+	WIN32_FIND_DATAW findData;
+	HANDLE find = FindFirstFileW(pattern.c_str(), &findData);
+	if (find == INVALID_HANDLE_VALUE)
+	{
+		return;
+	}
+
+	do
+	{
+		wstring path = directory + findData.cFileName;
+		if (path != currentPath)
+		{
+			DeleteFileW(path.c_str());
+		}
+	} while (FindNextFileW(find, &findData));
+
+	FindClose(find);
+}
+
+//
+// The source context to run a script with: the one it ran with before if its source is the same,
+// or else the caller's, which replaces the entry for the script's old source.
+//
+
+JsSourceContext ScriptCache::GetSourceContext(const wchar_t *sourceUrl, unsigned long long sourceHash, JsSourceContext sourceContext)
+{
+	lock_guard<mutex> guard(sourcesLock);
+
+	auto previous = sourceContexts.find(sourceUrl);
+	if (previous != sourceContexts.end())
+	{
+		auto entry = sources.find(previous->second);
+		if (entry != sources.end() && entry->second.hash == sourceHash)
+		{
+			return previous->second;
+		}
+
+		if (entry != sources.end())
+		{
+			sources.erase(entry);
+		}
+	}
+
+	sourceContexts[sourceUrl] = sourceContext;
+	LazySource &source = sources[sourceContext];
+	source.path = sourceUrl;
+	source.hash = sourceHash;
+	return sourceContext;
+}
+
+bool CALLBACK ScriptCache::LoadSource(JsSourceContext sourceContext, JsValueRef *value, JsParseScriptAttributes *parseAttributes)
+{
+	LazySource source;
+
+	{
+		//
+		// The entry stays, since other runtimes running the script may ask for its source too.
+		//
+
+		lock_guard<mutex> guard(sourcesLock);
+		auto entry = sources.find(sourceContext);
+		if (entry == sources.end())
+		{
+			return false;
+		}
+
+		source = entry->second;
+	}
+
+	if (LoadScript(source.path.c_str(), value) != JsNoError)
+	{
+		return false;
+	}
+
+	//
+	// Refuse a source that changed on disk since its bytecode was produced.
+	//
+
+	BYTE *buffer;
+	unsigned int bufferLength;
+	if (JsGetArrayBufferStorage(*value, &buffer, &bufferLength) != JsNoError ||
+		HashBytes(buffer, bufferLength) != source.hash)
+	{
+		fwprintf(stderr, L"chakrahost: script changed while running: %s.\n", source.path.c_str());
+		return false;
+	}
+
+	*parseAttributes = JsParseScriptAttributeNone;
+	return true;
+}
+
+JsErrorCode ScriptCache::RunSerialized(JsValueRef bytecode, JsSourceContext sourceContext, const wchar_t *sourceUrl, JsValueRef *result)
+{
+	JsValueRef sourceUrlValue;
+	IfFailRet(JsPointerToString(sourceUrl, wcslen(sourceUrl), &sourceUrlValue));
+	return JsRunSerialized(bytecode, LoadSource, sourceContext, sourceUrlValue, result);
+}
+
+JsErrorCode ScriptCache::RunScript(JsValueRef scriptSource, JsSourceContext sourceContext, const wchar_t *sourceUrl, JsValueRef *result)
+{
+	if (!IsEnabled())
+	{
+		JsValueRef sourceUrlValue;
+		IfFailRet(JsPointerToString(sourceUrl, wcslen(sourceUrl), &sourceUrlValue));
+		return JsRun(scriptSource, sourceContext, sourceUrlValue, JsParseScriptAttributeNone, result);
+	}
+
+	BYTE *source;
+	unsigned int sourceLength;
+	IfFailRet(JsGetArrayBufferStorage(scriptSource, &source, &sourceLength));
+
+	unsigned long long sourceHash = HashBytes(source, sourceLength);
+	wstring path = GetEntryPath(sourceUrl, sourceHash);
+	sourceContext = GetSourceContext(sourceUrl, sourceHash, sourceContext);
+
+	//
+	// Try the cache first. Bytecode from a different engine build is rejected by the engine,
+	// in which case we fall through and recompile.
+	//
+
+	JsValueRef bytecode;
+	if (ReadEntry(path, sourceHash, sourceLength, &bytecode) == JsNoError)
+	{
+		JsErrorCode errorCode = RunSerialized(bytecode, sourceContext, sourceUrl, result);
+		if (errorCode != JsErrorBadSerializedScript)
+		{
+			lock_guard<mutex> guard(lock);
+			hits++;
+			return errorCode;
+		}
+
+		lock_guard<mutex> guard(lock);
+		rejects++;
+	}
+
+	{
+		lock_guard<mutex> guard(lock);
+		misses++;
+	}
+
+	//
+	// Serialize the script. This parses it, so a script that fails to serialize (e.g. on a syntax error)
+	// is just run normally to report the error.
+	//
+
+	JsValueRef sourceUrlValue;
+	IfFailRet(JsPointerToString(sourceUrl, wcslen(sourceUrl), &sourceUrlValue));
+
+	BYTE *buffer;
+	unsigned int bufferLength;
+	if (JsSerialize(scriptSource, &bytecode, JsParseScriptAttributeNone) != JsNoError ||
+		JsGetArrayBufferStorage(bytecode, &buffer, &bufferLength) != JsNoError)
+	{
+		return JsRun(scriptSource, sourceContext, sourceUrlValue, JsParseScriptAttributeNone, result);
+	}
+
+	if (WriteEntry(path, sourceHash, sourceLength, buffer, bufferLength))
+	{
+		RemoveStaleEntries(sourceUrl, path);
+		lock_guard<mutex> guard(lock);
+		writes++;
+	}
+
+	JsErrorCode errorCode = RunSerialized(bytecode, sourceContext, sourceUrl, result);
+	if (errorCode == JsErrorBadSerializedScript)
+	{
+		return JsRun(scriptSource, sourceContext, sourceUrlValue, JsParseScriptAttributeNone, result);
+	}
+
+	return errorCode;
+}
+
+void ScriptCache::PrintStatistics()
+{
+	fwprintf(stderr, L"chakrahost: script cache: %u hits, %u misses, %u writes, %u rejected.\n", hits, misses, writes, rejects);
+}
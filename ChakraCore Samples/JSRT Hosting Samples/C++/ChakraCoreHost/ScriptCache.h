@@ -0,0 +1,83 @@
+#pragma once
+
+#include <string>
+#include <map>
+#include <mutex>
+
+//
+// On-disk bytecode cache for scripts run by the host.
+//
+// Entries are keyed by a hash of the script path plus a hash of the script contents, so a
+// changed source simply misses and replaces the stale entry for that path. Cached scripts are
+// run with JsRunSerialized, which only asks for the source text if the engine actually needs
+// it (e.g. for Function.prototype.toString or a deferred function body).
+//
+
+class ScriptCache
+{
+public:
+	ScriptCache();
+
+	//
+	// Enable the cache, storing entries in the given directory. The directory is created if needed.
+	//
+
+	bool SetDirectory(const std::wstring &directory);
+	bool IsEnabled() const { return !directory.empty(); }
+
+	//
+	// Run a script loaded with LoadScript, going through the cache when it is enabled.
+	// Same contract as JsRun.
+	//
+
+	JsErrorCode RunScript(JsValueRef scriptSource, JsSourceContext sourceContext, const wchar_t *sourceUrl, JsValueRef *result);
+
+	//
+	// Print the hit/miss counters to stderr.
+	//
+
+	void PrintStatistics();
+
+	unsigned hits;
+	unsigned misses;
+	unsigned writes;
+	unsigned rejects;
+
+private:
+	std::wstring directory;
+	std::mutex lock;
+
+	std::wstring GetEntryPrefix(const wchar_t *sourceUrl);
+	std::wstring GetEntryPath(const wchar_t *sourceUrl, unsigned long long sourceHash);
+	JsErrorCode ReadEntry(const std::wstring &path, unsigned long long sourceHash, size_t sourceLength, JsValueRef *bytecode);
+	bool WriteEntry(const std::wstring &path, unsigned long long sourceHash, size_t sourceLength, const BYTE *bytecode, unsigned int bytecodeLength);
+	void RemoveStaleEntries(const wchar_t *sourceUrl, const std::wstring &currentPath);
+	JsErrorCode RunSerialized(JsValueRef bytecode, JsSourceContext sourceContext, const wchar_t *sourceUrl, JsValueRef *result);
+
+	//
+	// Scripts that run from bytecode, by source context. If the engine asks for the source,
+	// the script is mapped again from disk and checked against the hash it was cached under.
+	//
+	// A script keeps the source context it first ran with for as long as its source doesn't change,
+	// so running it again, in any runtime, reuses its entry instead of adding one. There is one
+	// entry per script path.
+	//
+
+	struct LazySource
+	{
+		std::wstring path;
+		unsigned long long hash;
+	};
+
+	static std::mutex sourcesLock;
+	static std::map<JsSourceContext, LazySource> sources;
+	static std::map<std::wstring, JsSourceContext> sourceContexts;
+	static JsSourceContext GetSourceContext(const wchar_t *sourceUrl, unsigned long long sourceHash, JsSourceContext sourceContext);
+	static bool CALLBACK LoadSource(JsSourceContext sourceContext, JsValueRef *value, JsParseScriptAttributes *parseAttributes);
+};
+
+//
+// 64-bit FNV-1a hash, used for cache keys.
+//
+
+unsigned long long HashBytes(const void *data, size_t length, unsigned long long hash = 14695981039346656037ULL);
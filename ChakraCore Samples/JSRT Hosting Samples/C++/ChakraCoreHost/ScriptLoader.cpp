@@ -0,0 +1,153 @@
+#include "stdafx.h"
+#include "ScriptLoader.h"
+#include <climits>
+
+using namespace std;
+
+MappedFile::MappedFile() :
+	mapping(nullptr),
+	data(nullptr),
+	length(0)
+{
+}
+
+MappedFile::~MappedFile()
+{
+	if (data != nullptr)
+	{
+		UnmapViewOfFile(data);
+	}
+
+	if (mapping != nullptr)
+	{
+		CloseHandle(mapping);
+	}
+}
+
+MappedFile *MappedFile::Open(const wchar_t *fileName, bool isPrivate)
+{
+	HANDLE file = CreateFileW(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+	{
+		fwprintf(stderr, L"chakrahost: unable to open file: %s.\n", fileName);
+		return nullptr;
+	}
+
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(file, &fileSize))
+	{
+		CloseHandle(file);
+		fwprintf(stderr, L"chakrahost: unable to read file: %s.\n", fileName);
+		return nullptr;
+	}
+
+	MappedFile *mappedFile = new MappedFile();
+	mappedFile->length = (unsigned long long) fileSize.QuadPart;
+
+	//
+	// Empty files can't be mapped; they are simply a view of length zero.
+	//
+
+	if (mappedFile->length > 0)
+	{
+		mappedFile->mapping = CreateFileMappingW(file, nullptr, isPrivate ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, nullptr);
+		if (mappedFile->mapping != nullptr)
+		{
+			mappedFile->data = (BYTE *) MapViewOfFile(mappedFile->mapping, isPrivate ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+		}
+
+		if (mappedFile->data == nullptr)
+		{
+			CloseHandle(file);
+			delete mappedFile;
+			fwprintf(stderr, L"chakrahost: unable to map file: %s.\n", fileName);
+			return nullptr;
+		}
+	}
+
+	//
+	// The mapping holds its own reference to the file.
+	//
+
+	CloseHandle(file);
+	return mappedFile;
+}
+
+void CALLBACK MappedFile::Finalize(void *callbackState)
+{
+	MappedFile *mappedFile = (MappedFile *) callbackState;
+	ExternalBuffers::Remove(mappedFile->Data());
+	delete mappedFile;
+}
+
+mutex ExternalBuffers::lock;
+map<const void *, void *> ExternalBuffers::buffers;
+
+void ExternalBuffers::Add(const void *data, void *owner)
+{
+	lock_guard<mutex> guard(lock);
+	buffers[data] = owner;
+}
+
+void ExternalBuffers::Remove(const void *data)
+{
+	lock_guard<mutex> guard(lock);
+	buffers.erase(data);
+}
+
+bool ExternalBuffers::Find(const void *data, void **owner)
+{
+	lock_guard<mutex> guard(lock);
+
+	auto entry = buffers.find(data);
+	if (entry == buffers.end())
+	{
+		return false;
+	}
+
+	*owner = entry->second;
+	return true;
+}
+
+JsErrorCode MapFileToArrayBuffer(const wchar_t *fileName, bool isPrivate, JsValueRef *arrayBuffer)
+{
+	MappedFile *mappedFile = MappedFile::Open(fileName, isPrivate);
+	if (mappedFile == nullptr)
+	{
+		return JsErrorInvalidArgument;
+	}
+
+	//
+	// ArrayBuffers are limited to 32-bit lengths.
+	//
+
+	if (mappedFile->Length() > UINT_MAX)
+	{
+		delete mappedFile;
+		fwprintf(stderr, L"chakrahost: file too large: %s.\n", fileName);
+		return JsErrorInvalidArgument;
+	}
+
+	if (mappedFile->Length() == 0)
+	{
+		delete mappedFile;
+		return JsCreateArrayBuffer(0, arrayBuffer);
+	}
+
+	JsErrorCode errorCode = JsCreateExternalArrayBuffer((void *) mappedFile->Data(), (unsigned int) mappedFile->Length(), MappedFile::Finalize, mappedFile, arrayBuffer);
+	if (errorCode != JsNoError)
+	{
+		delete mappedFile;
+	}
+	else
+	{
+		ExternalBuffers::Add(mappedFile->Data());
+	}
+
+	return errorCode;
+}
+
+JsErrorCode LoadScript(const wchar_t *fileName, JsValueRef *scriptSource)
+{
+	return MapFileToArrayBuffer(fileName, false, scriptSource);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+
+//
+// A read-only view of a whole file. Files are mapped rather than read, so scripts and data files
+// reach the engine without being copied or widened.
+//
+
+class MappedFile
+{
+public:
+	//
+	// Map a file. Returns nullptr (after printing why) if the file can't be opened or mapped. A
+	// private mapping is copy-on-write: pages written to are copied, and the file is never changed.
+	//
+
+	static MappedFile *Open(const wchar_t *fileName, bool isPrivate = false);
+
+	~MappedFile();
+
+	const BYTE *Data() const { return data; }
+	unsigned long long Length() const { return length; }
+
+	//
+	// Finalizer for external ArrayBuffers that wrap a mapping; releases the mapping.
+	//
+
+	static void CALLBACK Finalize(void *callbackState);
+
+private:
+	MappedFile();
+
+	HANDLE mapping;
+	BYTE *data;
+	unsigned long long length;
+};
+
+//
+// The memory behind external ArrayBuffers the host has created, which the engine doesn't own. A
+// worker transfer (see Worker.h) takes the engine's own ArrayBuffer memory over; memory found here
+// is either copied, or, if it has an owner, handed over by the owner. Entries are added when the
+// ArrayBuffer is created and removed by its finalizer.
+//
+
+class ExternalBuffers
+{
+public:
+	static void Add(const void *data, void *owner = nullptr);
+	static void Remove(const void *data);
+	static bool Find(const void *data, void **owner);
+
+private:
+	static std::mutex lock;
+	static std::map<const void *, void *> buffers;
+};
+
+//
+// Map a file and wrap it in an external ArrayBuffer. The mapping lives until the engine finalizes
+// the ArrayBuffer. Buffers handed to scripts must use a private mapping, since scripts can write
+// to them.
+//
+
+JsErrorCode MapFileToArrayBuffer(const wchar_t *fileName, bool isPrivate, JsValueRef *arrayBuffer);
+
+//
+// Map a UTF-8 script from disk and wrap it in an external ArrayBuffer that can be passed to JsRun.
+//
+
+JsErrorCode LoadScript(const wchar_t *fileName, JsValueRef *scriptSource);
@@ -0,0 +1,324 @@
+#include "stdafx.h"
+#include "ChakraCoreHost.h"
+#include "ScriptServer.h"
+#include "HostOutput.h"
+#include "BackgroundWorkPool.h"
+#include <vector>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+using namespace std::chrono;
+
+//
+// Largest request we accept, in characters.
+//
+
+static const unsigned int MaxRequestLength = 64 * 1024;
+
+static wstring GetPipePath(const wstring &name)
+{
+	return L"\\\\.\\pipe\\" + name;
+}
+
+static bool ReadPipe(HANDLE pipe, void *buffer, DWORD length)
+{
+	BYTE *bytes = (BYTE *) buffer;
+	while (length > 0)
+	{
+		DWORD bytesRead;
+		if (!ReadFile(pipe, bytes, length, &bytesRead, nullptr) || bytesRead == 0)
+		{
+			return false;
+		}
+
+		bytes += bytesRead;
+		length -= bytesRead;
+	}
+
+	return true;
+}
+
+static bool WritePipe(HANDLE pipe, const void *buffer, DWORD length)
+{
+	DWORD bytesWritten;
+	return WriteFile(pipe, buffer, length, &bytesWritten, nullptr) && bytesWritten == length;
+}
+
+//
+// Create the context for the next job and run the warm-up script in it.
+//
+
+static JsErrorCode PrepareContext(JsRuntimeHandle runtime, const wstring &warmupScript, JsContextRef *context)
+{
+	//
+	// The context isn't current until a job arrives, so keep it alive explicitly. A context that
+	// failed halfway through being set up may have been left current; it is never used.
+	//
+
+	JsErrorCode errorCode = CreateHostContext(runtime, 0, nullptr, 0, context);
+	if (errorCode == JsNoError)
+	{
+		errorCode = JsAddRef(*context, nullptr);
+	}
+
+	if (errorCode != JsNoError)
+	{
+		JsSetCurrentContext(JS_INVALID_REFERENCE);
+		*context = JS_INVALID_REFERENCE;
+		return errorCode;
+	}
+
+	if (warmupScript.empty())
+	{
+		return JsNoError;
+	}
+
+	errorCode = JsSetCurrentContext(*context);
+	if (errorCode == JsNoError)
+	{
+		JsValueRef result;
+		errorCode = RunScriptJob(warmupScript.c_str(), watchdog.defaultBudget, &result);
+
+		if (errorCode == JsErrorScriptException)
+		{
+			PrintScriptException();
+		}
+
+		JsSetCurrentContext(JS_INVALID_REFERENCE);
+	}
+
+	if (errorCode != JsNoError)
+	{
+		JsRelease(*context, nullptr);
+		*context = JS_INVALID_REFERENCE;
+	}
+
+	return errorCode;
+}
+
+//
+// Run one job in a prepared context. The first job argument is the script name.
+//
+
+static int RunJob(JsContextRef context, vector<wchar_t *> &jobArguments, steady_clock::time_point jobStart, double *startupTime)
+{
+	int exitValue = EXIT_FAILURE;
+
+	if (JsSetCurrentContext(context) != JsNoError)
+	{
+		return exitValue;
+	}
+
+	if (SetHostArguments((int) jobArguments.size(), jobArguments.data(), 0) == JsNoError)
+	{
+		*startupTime = duration<double, milli>(steady_clock::now() - jobStart).count();
+
+		JsValueRef result;
+		JsErrorCode errorCode = RunScriptJob(jobArguments[0], watchdog.defaultBudget, &result);
+
+		if (errorCode == JsErrorScriptException)
+		{
+			PrintScriptException();
+		}
+		else if (errorCode == JsNoError)
+		{
+			GetExitValue(result, &exitValue);
+		}
+		else if (errorCode != JsErrorScriptTerminated && errorCode != JsErrorOutOfMemory)
+		{
+			fwprintf(stderr, L"chakrahost: failed to run script: %s.\n", jobArguments[0]);
+		}
+	}
+
+	JsSetCurrentContext(JS_INVALID_REFERENCE);
+	HostOutput::Flush();
+	return exitValue;
+}
+
+int RunScriptServer(const wstring &name, const wstring &warmupScript)
+{
+	int returnValue = EXIT_FAILURE;
+	wstring pipePath = GetPipePath(name);
+
+	//
+	// Jobs are waiting on this runtime's background work.
+	//
+
+	BackgroundWorkPool::SetCallerPriority(BackgroundWorkPriorityHigh);
+
+	try
+	{
+		JsRuntimeHandle runtime;
+		JsContextRef readyContext;
+
+		//
+		// Measure what a cold start costs: the runtime plus one warmed-up context.
+		//
+
+		steady_clock::time_point coldStartBegin = steady_clock::now();
+
+		IfFailError(CreateHostRuntime(&runtime), L"failed to create runtime.");
+		IfFailError(PrepareContext(runtime, warmupScript, &readyContext), L"failed to prepare execution context.");
+
+		double coldStartTime = duration<double, milli>(steady_clock::now() - coldStartBegin).count();
+		fwprintf(stderr, L"chakrahost: serving on %s (cold start %.3f ms).\n", pipePath.c_str(), coldStartTime);
+
+		for (unsigned jobCount = 1;; jobCount++)
+		{
+			HANDLE pipe = CreateNamedPipeW(pipePath.c_str(), PIPE_ACCESS_DUPLEX, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, 4096, 4096, 0, nullptr);
+			if (pipe == INVALID_HANDLE_VALUE)
+			{
+				fwprintf(stderr, L"chakrahost: unable to create pipe: %s.\n", pipePath.c_str());
+				break;
+			}
+
+			if (!ConnectNamedPipe(pipe, nullptr) && GetLastError() != ERROR_PIPE_CONNECTED)
+			{
+				CloseHandle(pipe);
+				continue;
+			}
+
+			//
+			// Read the request: its length, then the script name and arguments, each null terminated.
+			//
+
+			unsigned int length = 0;
+			vector<wchar_t> request;
+			if (ReadPipe(pipe, &length, sizeof(length)) && length > 0 && length <= MaxRequestLength)
+			{
+				request.resize(length);
+				if (!ReadPipe(pipe, request.data(), length * sizeof(wchar_t)))
+				{
+					request.clear();
+				}
+			}
+
+			if (request.empty())
+			{
+				DisconnectNamedPipe(pipe);
+				CloseHandle(pipe);
+				continue;
+			}
+
+			steady_clock::time_point jobStart = steady_clock::now();
+
+			request.push_back(L'\0');
+			vector<wchar_t *> jobArguments;
+			for (size_t index = 0; index < request.size() - 1; index += wcslen(&request[index]) + 1)
+			{
+				jobArguments.push_back(&request[index]);
+			}
+
+			//
+			// If the last job's warm-up failed there is no context ready, so pay for it now.
+			//
+
+			int exitValue = EXIT_FAILURE;
+			double startupTime = 0;
+
+			if (readyContext != JS_INVALID_REFERENCE ||
+				PrepareContext(runtime, warmupScript, &readyContext) == JsNoError)
+			{
+				exitValue = RunJob(readyContext, jobArguments, jobStart, &startupTime);
+				JsRelease(readyContext, nullptr);
+				readyContext = JS_INVALID_REFERENCE;
+			}
+
+			wchar_t reply[64];
+			swprintf_s(reply, L"%d %.3f %.3f", exitValue, startupTime, coldStartTime);
+			WritePipe(pipe, reply, (DWORD) (wcslen(reply) * sizeof(wchar_t)));
+			FlushFileBuffers(pipe);
+			DisconnectNamedPipe(pipe);
+			CloseHandle(pipe);
+
+			fwprintf(stderr, L"chakrahost: job %u: %s: exit value %d, startup %.3f ms (cold start %.3f ms).\n",
+				jobCount, jobArguments[0], exitValue, startupTime, coldStartTime);
+
+			//
+			// Get the next context ready while waiting for the next job.
+			//
+
+			PrepareContext(runtime, warmupScript, &readyContext);
+			if (readyContext != JS_INVALID_REFERENCE && JsSetCurrentContext(readyContext) == JsNoError)
+			{
+				//
+				// Any garbage the last job left behind is collected now rather than during the next one.
+				//
+
+				gcScheduler.RunBetweenJobs();
+				JsSetCurrentContext(JS_INVALID_REFERENCE);
+			}
+		}
+
+		if (readyContext != JS_INVALID_REFERENCE)
+		{
+			JsRelease(readyContext, nullptr);
+		}
+
+		IfFailError(DisposeHostRuntime(runtime), L"failed to cleanup runtime.");
+	}
+	catch (...)
+	{
+		fwprintf(stderr, L"chakrahost: fatal error: internal error.\n");
+	}
+
+error:
+	return returnValue;
+}
+
+int SubmitScriptJob(const wstring &name, int argc, wchar_t *argv [], int argumentsStart)
+{
+	wstring pipePath = GetPipePath(name);
+
+	HANDLE pipe = CreateFileW(pipePath.c_str(), GENERIC_READ | GENERIC_WRITE, 0, nullptr, OPEN_EXISTING, 0, nullptr);
+	if (pipe == INVALID_HANDLE_VALUE)
+	{
+		fwprintf(stderr, L"chakrahost: unable to connect to server: %s.\n", pipePath.c_str());
+		return EXIT_FAILURE;
+	}
+
+	//
+	// The server may be running in another directory, so send it the full script path.
+	//
+
+	wchar_t scriptPath[MAX_PATH];
+	if (GetFullPathNameW(argv[argumentsStart], MAX_PATH, scriptPath, nullptr) == 0)
+	{
+		wcsncpy_s(scriptPath, argv[argumentsStart], _TRUNCATE);
+	}
+
+	vector<wchar_t> request(scriptPath, scriptPath + wcslen(scriptPath) + 1);
+	for (int index = argumentsStart + 1; index < argc; index++)
+	{
+		request.insert(request.end(), argv[index], argv[index] + wcslen(argv[index]) + 1);
+	}
+
+	unsigned int length = (unsigned int) request.size();
+	wchar_t reply[64] = {};
+
+	bool succeeded =
+		WritePipe(pipe, &length, sizeof(length)) &&
+		WritePipe(pipe, request.data(), length * sizeof(wchar_t));
+
+	if (succeeded)
+	{
+		DWORD bytesRead;
+		succeeded = ReadFile(pipe, reply, sizeof(reply) - sizeof(wchar_t), &bytesRead, nullptr) && bytesRead > 0;
+	}
+
+	CloseHandle(pipe);
+
+	int exitValue;
+	double startupTime;
+	double coldStartTime;
+	if (!succeeded || swscanf(reply, L"%d %lf %lf", &exitValue, &startupTime, &coldStartTime) != 3)
+	{
+		fwprintf(stderr, L"chakrahost: no reply from server: %s.\n", pipePath.c_str());
+		return EXIT_FAILURE;
+	}
+
+	fwprintf(stderr, L"chakrahost: startup %.3f ms (cold start %.3f ms).\n", startupTime, coldStartTime);
+	cout << exitValue << endl;
+	return exitValue;
+}
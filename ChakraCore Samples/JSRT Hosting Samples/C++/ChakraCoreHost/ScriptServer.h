@@ -0,0 +1,23 @@
+#pragma once
+
+#include <string>
+
+//
+// Server mode.
+//
+// The server creates its runtime once and serves script jobs from a local named pipe. Each job
+// runs in its own context, so jobs don't see each other's globals, but the context is created and
+// warmed up (by running the warm-up script in it) while the server is idle, before the job arrives.
+// Job startup is then just taking the ready context and setting host.arguments.
+//
+// A job is a UTF-16 request of the form <length><script name>\0<argument>\0...; the reply is
+// "<exit value> <startup ms> <cold start ms>".
+//
+
+int RunScriptServer(const std::wstring &name, const std::wstring &warmupScript);
+
+//
+// Send a script job to a running server and wait for it to finish.
+//
+
+int SubmitScriptJob(const std::wstring &name, int argc, wchar_t *argv [], int argumentsStart);
@@ -0,0 +1,447 @@
+#include "stdafx.h"
+#include "ChakraCoreHost.h"
+#include "StreamRunner.h"
+#include "HostOutput.h"
+#include "BackgroundWorkPool.h"
+#include "EventLoop.h"
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstring>
+
+using namespace std;
+using namespace std::chrono;
+
+//
+// Input is read in chunks of this size.
+//
+
+static const DWORD readChunkSize = 1024 * 1024;
+
+//
+// Batches the reader may get ahead of the runtime by.
+//
+
+static const size_t maxQueuedBatches = 4;
+
+//
+// A batch of lines, stored back to back without their line breaks. Line `i` ends at ends[i] and
+// starts where the previous one ends.
+//
+
+struct LineBatch
+{
+	vector<char> text;
+	vector<size_t> ends;
+};
+
+class LineQueue
+{
+public:
+	LineQueue() :
+		finished(false),
+		cancelled(false)
+	{
+	}
+
+	~LineQueue()
+	{
+		for (LineBatch *batch : batches)
+		{
+			delete batch;
+		}
+	}
+
+	//
+	// Queue a batch, waiting for room. Returns false if the consumer has gone away.
+	//
+
+	bool Push(LineBatch *batch)
+	{
+		unique_lock<mutex> guard(lock);
+		batchTaken.wait(guard, [this] { return batches.size() < maxQueuedBatches || cancelled; });
+
+		if (cancelled)
+		{
+			delete batch;
+			return false;
+		}
+
+		batches.push_back(batch);
+		batchQueued.notify_one();
+		return true;
+	}
+
+	//
+	// Take the next batch, or nullptr once the input is exhausted.
+	//
+
+	LineBatch *Pop()
+	{
+		unique_lock<mutex> guard(lock);
+		batchQueued.wait(guard, [this] { return !batches.empty() || finished; });
+
+		if (batches.empty())
+		{
+			return nullptr;
+		}
+
+		LineBatch *batch = batches.front();
+		batches.pop_front();
+		batchTaken.notify_one();
+		return batch;
+	}
+
+	void Finish()
+	{
+		lock_guard<mutex> guard(lock);
+		finished = true;
+		batchQueued.notify_all();
+	}
+
+	void Cancel()
+	{
+		lock_guard<mutex> guard(lock);
+		cancelled = true;
+		batchTaken.notify_all();
+	}
+
+	bool IsCancelled()
+	{
+		lock_guard<mutex> guard(lock);
+		return cancelled;
+	}
+
+private:
+	mutex lock;
+	condition_variable batchQueued;
+	condition_variable batchTaken;
+	deque<LineBatch *> batches;
+	bool finished;
+	bool cancelled;
+};
+
+//
+// Reader thread: split the input into lines and queue them in batches. Empty lines are skipped.
+//
+
+static void ReadLines(HANDLE input, unsigned batchSize, LineQueue &queue, bool &readFailed)
+{
+	vector<char> chunk(readChunkSize);
+	LineBatch *batch = new LineBatch();
+	size_t lineStart = 0;
+
+	for (;;)
+	{
+		if (queue.IsCancelled())
+		{
+			break;
+		}
+
+		DWORD bytesRead;
+		if (!ReadFile(input, chunk.data(), readChunkSize, &bytesRead, nullptr))
+		{
+			DWORD error = GetLastError();
+			readFailed = error != ERROR_BROKEN_PIPE && error != ERROR_HANDLE_EOF && error != ERROR_OPERATION_ABORTED;
+			break;
+		}
+
+		if (bytesRead == 0)
+		{
+			break;
+		}
+
+		const char *data = chunk.data();
+		const char *end = data + bytesRead;
+
+		while (data < end)
+		{
+			const char *newline = (const char *) memchr(data, '\n', end - data);
+			const char *segmentEnd = newline != nullptr ? newline : end;
+			batch->text.insert(batch->text.end(), data, segmentEnd);
+			data = segmentEnd;
+
+			if (newline == nullptr)
+			{
+				break;
+			}
+
+			data++;
+
+			if (batch->text.size() > lineStart && batch->text.back() == '\r')
+			{
+				batch->text.pop_back();
+			}
+
+			if (batch->text.size() > lineStart)
+			{
+				batch->ends.push_back(batch->text.size());
+				lineStart = batch->text.size();
+			}
+
+			if (batch->ends.size() >= batchSize)
+			{
+				if (!queue.Push(batch))
+				{
+					return;
+				}
+
+				batch = new LineBatch();
+				lineStart = 0;
+			}
+		}
+	}
+
+	//
+	// The last line may not end with a line break.
+	//
+
+	if (batch->text.size() > lineStart)
+	{
+		batch->ends.push_back(batch->text.size());
+	}
+
+	if (batch->ends.empty())
+	{
+		delete batch;
+	}
+	else
+	{
+		queue.Push(batch);
+	}
+
+	queue.Finish();
+}
+
+static JsErrorCode GetFunction(JsValueRef object, PropertyId id, JsValueRef *function)
+{
+	JsPropertyIdRef propertyId;
+	IfFailRet(PropertyIds::Get(id, &propertyId));
+	IfFailRet(JsGetProperty(object, propertyId, function));
+
+	JsValueType type;
+	IfFailRet(JsGetValueType(*function, &type));
+	return type == JsFunction ? JsNoError : JsErrorInvalidArgument;
+}
+
+//
+// Pass every line to transform and write out the results.
+//
+
+static JsErrorCode TransformLines(LineQueue &queue, unsigned long long *records, unsigned long long *outputRecords)
+{
+	JsValueRef globalObject;
+	IfFailRet(JsGetGlobalObject(&globalObject));
+
+	JsValueRef transform;
+	JsErrorCode errorCode = GetFunction(globalObject, PropertyIdTransform, &transform);
+	if (errorCode == JsErrorInvalidArgument)
+	{
+		fwprintf(stderr, L"chakrahost: the script doesn't define a transform function.\n");
+	}
+
+	IfFailRet(errorCode);
+
+	JsPropertyIdRef jsonPropertyId;
+	JsValueRef json;
+	IfFailRet(PropertyIds::Get(PropertyIdJson, &jsonPropertyId));
+	IfFailRet(JsGetProperty(globalObject, jsonPropertyId, &json));
+
+	JsValueRef stringify;
+	IfFailRet(GetFunction(json, PropertyIdStringify, &stringify));
+
+	JsValueRef arguments[2];
+	IfFailRet(JsGetUndefinedValue(&arguments[0]));
+
+	EventLoop *eventLoop = EventLoop::Current();
+
+	for (;;)
+	{
+		LineBatch *batch = queue.Pop();
+		if (batch == nullptr)
+		{
+			return JsNoError;
+		}
+
+		size_t lineStart = 0;
+		for (size_t lineEnd : batch->ends)
+		{
+			JsValueRef result;
+			errorCode = JsCreateString(batch->text.data() + lineStart, lineEnd - lineStart, &arguments[1]);
+			if (errorCode == JsNoError)
+			{
+				errorCode = JsCallFunction(transform, arguments, 2, &result);
+			}
+
+			JsValueType type;
+			if (errorCode == JsNoError)
+			{
+				errorCode = JsGetValueType(result, &type);
+			}
+
+			//
+			// Anything that isn't a string goes through JSON.stringify, which gives undefined for
+			// values JSON can't represent.
+			//
+
+			if (errorCode == JsNoError && type != JsUndefined && type != JsNull && type != JsString)
+			{
+				arguments[1] = result;
+				errorCode = JsCallFunction(stringify, arguments, 2, &result);
+				if (errorCode == JsNoError)
+				{
+					errorCode = JsGetValueType(result, &type);
+				}
+			}
+
+			if (errorCode == JsNoError && type == JsString)
+			{
+				errorCode = HostOutput::WriteString(result);
+				if (errorCode == JsNoError)
+				{
+					HostOutput::EndLine();
+					(*outputRecords)++;
+				}
+			}
+
+			//
+			// Settle the promises this record started before taking the next one, so async work keeps
+			// pace with the input instead of piling up until it ends.
+			//
+
+			if (errorCode == JsNoError)
+			{
+				errorCode = eventLoop->RunMicrotasks();
+			}
+
+			if (errorCode != JsNoError)
+			{
+				delete batch;
+				return errorCode;
+			}
+
+			(*records)++;
+			lineStart = lineEnd;
+		}
+
+		delete batch;
+	}
+}
+
+int RunStream(int argc, wchar_t *argv[], int argumentsStart, const wstring &input, unsigned batchSize)
+{
+	int returnValue = EXIT_FAILURE;
+	const wchar_t *scriptName = argv[argumentsStart];
+
+	HANDLE inputHandle;
+	if (input == L"-")
+	{
+		inputHandle = GetStdHandle(STD_INPUT_HANDLE);
+	}
+	else
+	{
+		inputHandle = CreateFileW(input.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (inputHandle == INVALID_HANDLE_VALUE)
+		{
+			fwprintf(stderr, L"chakrahost: unable to open file: %s.\n", input.c_str());
+			return returnValue;
+		}
+	}
+
+	BackgroundWorkPool::SetCallerPriority(BackgroundWorkPriorityHigh);
+
+	//
+	// Start reading while the runtime is being set up.
+	//
+
+	LineQueue queue;
+	bool readFailed = false;
+	thread reader(ReadLines, inputHandle, batchSize > 0 ? batchSize : 1, ref(queue), ref(readFailed));
+
+	JsRuntimeHandle runtime;
+	JsContextRef context;
+	unsigned long long records = 0;
+	unsigned long long outputRecords = 0;
+	double time = 0;
+
+	if (CreateHostRuntime(&runtime) != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: failed to create runtime.\n");
+	}
+	else
+	{
+		if (CreateHostContext(runtime, argc, argv, argumentsStart, &context) != JsNoError || JsSetCurrentContext(context) != JsNoError)
+		{
+			fwprintf(stderr, L"chakrahost: failed to create execution context.\n");
+		}
+		else
+		{
+			steady_clock::time_point start = steady_clock::now();
+
+			JsErrorCode errorCode = RunJob(scriptName, watchdog.defaultBudget, [&]
+			{
+				JsValueRef result;
+				IfFailRet(RunScriptFile(scriptName, &result));
+
+				start = steady_clock::now();
+				return TransformLines(queue, &records, &outputRecords);
+			});
+
+			time = duration<double, milli>(steady_clock::now() - start).count();
+
+			if (errorCode == JsErrorScriptException)
+			{
+				PrintScriptException();
+			}
+			else if (errorCode == JsNoError)
+			{
+				returnValue = EXIT_SUCCESS;
+			}
+			else if (errorCode != JsErrorInvalidArgument && errorCode != JsErrorScriptTerminated && errorCode != JsErrorOutOfMemory)
+			{
+				fwprintf(stderr, L"chakrahost: failed to run script.\n");
+			}
+
+			JsSetCurrentContext(JS_INVALID_REFERENCE);
+		}
+
+		DisposeHostRuntime(runtime);
+	}
+
+	//
+	// If we stopped early, the reader may be waiting for room in the queue, or blocked reading a
+	// console or pipe that has nothing more to say. Its read is cancelled until it exits, since it
+	// may not have started the read yet.
+	//
+
+	queue.Cancel();
+	HANDLE readerHandle = reader.native_handle();
+	while (WaitForSingleObject(readerHandle, 0) == WAIT_TIMEOUT)
+	{
+		CancelSynchronousIo(readerHandle);
+		WaitForSingleObject(readerHandle, 10);
+	}
+
+	reader.join();
+
+	if (input != L"-")
+	{
+		CloseHandle(inputHandle);
+	}
+
+	if (readFailed)
+	{
+		fwprintf(stderr, L"chakrahost: unable to read file: %s.\n", input.c_str());
+		returnValue = EXIT_FAILURE;
+	}
+
+	HostOutput::Flush();
+
+	fwprintf(stderr, L"chakrahost: stream: %llu records in, %llu records out, %.3f ms (%.0f records/s).\n",
+		records, outputRecords, time, time > 0 ? records * 1000 / time : 0);
+
+	return returnValue;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <string>
+
+//
+// Stream mode: run a script that defines a global `transform(record)` function, then call it for
+// every line of the input (a file, or stdin for "-"), typically newline-delimited JSON.
+//
+// A reader thread reads the input in large chunks, splits it into lines and hands them to the
+// runtime thread in batches of `batchSize` lines. Each line is passed to transform as a string
+// created straight from its UTF-8 bytes; the script decides whether it needs JSON.parse. A string
+// result is written out as a line as is, undefined and null results are dropped, and anything else
+// is written as JSON. Output goes through the buffered host output, and the number of records and
+// records per second are reported on stderr.
+//
+
+int RunStream(int argc, wchar_t *argv[], int argumentsStart, const std::wstring &input, unsigned batchSize);
@@ -0,0 +1,231 @@
+#include "stdafx.h"
+#include "Watchdog.h"
+#include "EventLoop.h"
+
+using namespace std;
+using namespace std::chrono;
+
+Watchdog::Watchdog() :
+	nextTicket(1),
+	stopping(false)
+{
+}
+
+Watchdog::~Watchdog()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		stopping = true;
+	}
+
+	entriesChanged.notify_all();
+
+	if (watcher.joinable())
+	{
+		watcher.join();
+	}
+}
+
+//
+// CPU time (user and kernel) used so far by a thread, in milliseconds.
+//
+
+static double GetThreadCpuTime(HANDLE thread)
+{
+	FILETIME creationTime, exitTime, kernelTime, userTime;
+	if (!GetThreadTimes(thread, &creationTime, &exitTime, &kernelTime, &userTime))
+	{
+		return 0;
+	}
+
+	unsigned long long kernel = ((unsigned long long) kernelTime.dwHighDateTime << 32) | kernelTime.dwLowDateTime;
+	unsigned long long user = ((unsigned long long) userTime.dwHighDateTime << 32) | userTime.dwLowDateTime;
+	return (kernel + user) / 10000.0;
+}
+
+unsigned Watchdog::Arm(JsRuntimeHandle runtime, const ScriptBudget &budget)
+{
+	Entry entry;
+	entry.runtime = runtime;
+	entry.thread = budget.cpuTimeoutMs > 0 ? OpenThread(THREAD_QUERY_LIMITED_INFORMATION, FALSE, GetCurrentThreadId()) : nullptr;
+	entry.wakeHandle = EventLoop::Current()->OpenWakeHandle();
+	entry.cpuTimeoutMs = entry.thread != nullptr ? budget.cpuTimeoutMs : 0;
+
+	//
+	// Threads are reused for job after job, so only the CPU time from here on counts.
+	//
+
+	entry.cpuStart = entry.thread != nullptr ? GetThreadCpuTime(entry.thread) : 0;
+	entry.start = steady_clock::now();
+	entry.deadline = budget.timeoutMs > 0 ? entry.start + milliseconds(budget.timeoutMs) : steady_clock::time_point::max();
+	entry.check = entry.cpuTimeoutMs > 0 ? min(entry.deadline, entry.start + milliseconds(entry.cpuTimeoutMs)) : entry.deadline;
+	entry.interrupted = false;
+
+	unsigned ticket;
+
+	{
+		lock_guard<mutex> guard(lock);
+
+		if (!watcher.joinable())
+		{
+			watcher = thread(&Watchdog::Watch, this);
+		}
+
+		ticket = nextTicket++;
+		entries[ticket] = entry;
+	}
+
+	entriesChanged.notify_one();
+	return ticket;
+}
+
+//
+// Stop watching a script. Returns whether its budget ran out, and if so how long it ran before it
+// was interrupted and how long it took to stop after that, and whether an enclosing script in the
+// same runtime ran out as well.
+//
+
+bool Watchdog::Disarm(unsigned ticket, double *runTime, double *stopTime, bool *enclosingInterrupted)
+{
+	lock_guard<mutex> guard(lock);
+
+	auto entry = entries.find(ticket);
+	bool interrupted = entry->second.interrupted;
+
+	if (interrupted)
+	{
+		*runTime = duration<double, milli>(entry->second.interruptTime - entry->second.start).count();
+		*stopTime = duration<double, milli>(steady_clock::now() - entry->second.interruptTime).count();
+
+		*enclosingInterrupted = false;
+		for (auto &other : entries)
+		{
+			if (other.first != ticket && other.second.runtime == entry->second.runtime && other.second.interrupted)
+			{
+				*enclosingInterrupted = true;
+			}
+		}
+	}
+
+	if (entry->second.thread != nullptr)
+	{
+		CloseHandle(entry->second.thread);
+	}
+
+	if (entry->second.wakeHandle != nullptr)
+	{
+		CloseHandle(entry->second.wakeHandle);
+	}
+
+	entries.erase(entry);
+	return interrupted;
+}
+
+void Watchdog::Watch()
+{
+	unique_lock<mutex> guard(lock);
+
+	while (!stopping)
+	{
+		steady_clock::time_point next = steady_clock::time_point::max();
+		for (auto &entry : entries)
+		{
+			if (!entry.second.interrupted && entry.second.check < next)
+			{
+				next = entry.second.check;
+			}
+		}
+
+		if (next == steady_clock::time_point::max())
+		{
+			entriesChanged.wait(guard);
+		}
+		else
+		{
+			entriesChanged.wait_until(guard, next);
+		}
+
+		steady_clock::time_point now = steady_clock::now();
+
+		for (auto &entry : entries)
+		{
+			Entry &script = entry.second;
+			if (script.interrupted || script.check > now)
+			{
+				continue;
+			}
+
+			bool expired = now >= script.deadline;
+
+			if (!expired && script.cpuTimeoutMs > 0)
+			{
+				double cpuTime = GetThreadCpuTime(script.thread) - script.cpuStart;
+				expired = cpuTime >= script.cpuTimeoutMs;
+				script.check = min(script.deadline, now + microseconds((long long) ((script.cpuTimeoutMs - cpuTime) * 1000)));
+			}
+
+			//
+			// Disarm takes the lock before the runtime can go away, so it's still alive here.
+			//
+
+			if (expired)
+			{
+				JsDisableRuntimeExecution(script.runtime);
+
+				//
+				// Disabling execution only stops running script; a loop waiting for a timer or a read
+				// has to be woken to find out.
+				//
+
+				if (script.wakeHandle != nullptr)
+				{
+					EventLoop::Wake(script.wakeHandle, nullptr);
+				}
+
+				script.interrupted = true;
+				script.interruptTime = now;
+			}
+		}
+	}
+}
+
+JsErrorCode Watchdog::Run(const wchar_t *scriptName, const ScriptBudget &budget, const function<JsErrorCode()> &run)
+{
+	JsErrorCode errorCode;
+
+	if (!budget.IsLimited())
+	{
+		errorCode = run();
+		return errorCode == JsErrorScriptTerminated ? JsErrorInDisabledState : errorCode;
+	}
+
+	JsContextRef context;
+	JsRuntimeHandle runtime;
+	IfFailRet(JsGetCurrentContext(&context));
+	IfFailRet(JsGetRuntime(context, &runtime));
+
+	unsigned ticket = Arm(runtime, budget);
+	errorCode = run();
+
+	double runTime;
+	double stopTime;
+	bool enclosingInterrupted;
+	if (!Disarm(ticket, &runTime, &stopTime, &enclosingInterrupted))
+	{
+		return errorCode == JsErrorScriptTerminated ? JsErrorInDisabledState : errorCode;
+	}
+
+	fwprintf(stderr, L"chakrahost: script timed out: %s (interrupted after %.3f ms, stopped %.3f ms later).\n", scriptName, runTime, stopTime);
+
+	if (enclosingInterrupted)
+	{
+		return JsErrorInDisabledState;
+	}
+
+	//
+	// The budget may have run out just as the script finished; execution is disabled either way.
+	//
+
+	IfFailRet(JsEnableRuntimeExecution(runtime));
+	return JsErrorScriptTerminated;
+}
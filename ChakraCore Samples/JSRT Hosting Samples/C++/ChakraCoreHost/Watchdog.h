@@ -0,0 +1,84 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <functional>
+
+//
+// How long a script may run: wall-clock time, CPU time of the thread running it, or both.
+// Zero means no limit.
+//
+
+struct ScriptBudget
+{
+	unsigned timeoutMs;
+	unsigned cpuTimeoutMs;
+
+	ScriptBudget() :
+		timeoutMs(0),
+		cpuTimeoutMs(0)
+	{
+	}
+
+	bool IsLimited() const { return timeoutMs > 0 || cpuTimeoutMs > 0; }
+};
+
+//
+// A thread that stops scripts that run over their budget, by disabling execution in their
+// runtime. Runtimes must be created with JsRuntimeAttributeAllowScriptInterrupt.
+//
+// The thread sleeps until the earliest deadline of all the scripts being watched. A CPU budget
+// can't run out sooner than the same amount of wall-clock time, so a script with a CPU budget is
+// checked when its remaining budget would have run out at full speed, and again from then on.
+//
+
+class Watchdog
+{
+public:
+	Watchdog();
+	~Watchdog();
+
+	//
+	// Run scripts in the current context under a budget. If the budget runs out, execution is
+	// re-enabled so the runtime can be reused, the timeout is reported and JsErrorScriptTerminated is
+	// returned. If the budget of an enclosing Run runs out instead, JsErrorInDisabledState is returned
+	// and the runtime stays disabled until that Run returns.
+	//
+
+	JsErrorCode Run(const wchar_t *scriptName, const ScriptBudget &budget, const std::function<JsErrorCode()> &run);
+
+	//
+	// The budget of scripts the host runs on its own behalf, set from the command line.
+	//
+
+	ScriptBudget defaultBudget;
+
+private:
+	struct Entry
+	{
+		JsRuntimeHandle runtime;
+		HANDLE thread;
+		HANDLE wakeHandle;	// the running thread's event loop, which may be waiting when time runs out
+		unsigned cpuTimeoutMs;
+		double cpuStart;	// the thread's CPU time when the budget started, in milliseconds
+		std::chrono::steady_clock::time_point start;
+		std::chrono::steady_clock::time_point deadline;
+		std::chrono::steady_clock::time_point check;
+		bool interrupted;
+		std::chrono::steady_clock::time_point interruptTime;
+	};
+
+	std::map<unsigned, Entry> entries;
+	unsigned nextTicket;
+	std::mutex lock;
+	std::condition_variable entriesChanged;
+	std::thread watcher;
+	bool stopping;
+
+	unsigned Arm(JsRuntimeHandle runtime, const ScriptBudget &budget);
+	bool Disarm(unsigned ticket, double *runTime, double *stopTime, bool *enclosingInterrupted);
+	void Watch();
+};
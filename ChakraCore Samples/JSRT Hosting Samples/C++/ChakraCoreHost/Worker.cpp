@@ -0,0 +1,763 @@
+#include "stdafx.h"
+#include "ChakraCoreHost.h"
+#include "Worker.h"
+#include "ScriptLoader.h"
+#include "HostOutput.h"
+#include "BackgroundWorkPool.h"
+#include <memory>
+#include <thread>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+using namespace std;
+
+//
+// Worker threads still running, so the host can wait for them before it exits.
+//
+
+static mutex workersLock;
+static condition_variable workersFinished;
+static unsigned runningWorkers = 0;
+
+//
+// The worker running on this thread, if any.
+//
+
+static thread_local Worker *currentWorker = nullptr;
+
+static void FreeMessage(WorkerMessage *message)
+{
+	for (TransferredBuffer &buffer : message->buffers)
+	{
+		if (buffer.shared != nullptr)
+		{
+			JsReleaseSharedArrayBufferContentHandle(buffer.shared);
+		}
+
+		free(buffer.data);
+	}
+
+	delete message;
+}
+
+MessageQueue::MessageQueue() :
+	head(&stub),
+	tail(&stub),
+	pending(0)
+{
+	stub.next = nullptr;
+}
+
+MessageQueue::~MessageQueue()
+{
+	for (WorkerMessage *message = Pop(); message != nullptr; message = Pop())
+	{
+		FreeMessage(message);
+	}
+}
+
+void MessageQueue::Push(WorkerMessage *message)
+{
+	message->next = nullptr;
+	pending++;
+
+	WorkerMessage *previous = head.exchange(message);
+	previous->next = message;
+}
+
+WorkerMessage *MessageQueue::Pop()
+{
+	WorkerMessage *first = tail;
+	WorkerMessage *next = first->next;
+
+	if (first == &stub)
+	{
+		if (next == nullptr)
+		{
+			return nullptr;
+		}
+
+		tail = next;
+		first = next;
+		next = next->next;
+	}
+
+	if (next != nullptr)
+	{
+		tail = next;
+		pending--;
+		return first;
+	}
+
+	//
+	// `first` is the last message, unless a push has swapped the head but not linked it in yet.
+	//
+
+	if (first != head)
+	{
+		return nullptr;
+	}
+
+	//
+	// Put the stub back behind the last message, so the message can be taken off on its own.
+	//
+
+	stub.next = nullptr;
+	WorkerMessage *previous = head.exchange(&stub);
+	previous->next = &stub;
+
+	next = first->next;
+	if (next != nullptr)
+	{
+		tail = next;
+		pending--;
+		return first;
+	}
+
+	return nullptr;
+}
+
+//
+// The state of an ArrayBuffer that arrived in a message. Its memory belongs to the ArrayBuffer
+// until the buffer is transferred on, after which the finalizer leaves it alone.
+//
+
+struct ReceivedBuffer
+{
+	void *data;
+	bool owned;
+};
+
+static void CALLBACK FinalizeReceivedBuffer(void *callbackState)
+{
+	ReceivedBuffer *buffer = (ReceivedBuffer *) callbackState;
+
+	if (buffer->owned)
+	{
+		ExternalBuffers::Remove(buffer->data);
+		free(buffer->data);
+	}
+
+	delete buffer;
+}
+
+//
+// On x64, ChakraCore reserves ArrayBuffers of the lengths asm.js can use (64 KiB and up, a power of
+// two or a multiple of 16 MiB, and whole pages) with VirtualAlloc rather than malloc. This is the
+// engine's own test.
+//
+
+static bool IsVirtualBufferLength(unsigned int length)
+{
+#if defined(_WIN64)
+	return length >= 0x10000 &&
+		((length & (~length + 1)) == length || (length >= 0x1000000 && (length & 0xFFFFFF) == 0)) &&
+		length % 4096 == 0;
+#else
+	return false;
+#endif
+}
+
+static void *CopyBuffer(ChakraBytePtr data, unsigned int length)
+{
+	void *copy = malloc(length);
+	if (copy == nullptr)
+	{
+		throw bad_alloc();
+	}
+
+	memcpy(copy, data, length);
+	return copy;
+}
+
+//
+// Take an ArrayBuffer's memory for a message and detach the ArrayBuffer. ChakraCore allocates
+// ArrayBuffer memory with malloc, except for the virtual buffers above, and once an ArrayBuffer is
+// externalized its memory is the host's to free, so the engine's malloc'd buffers are handed over
+// as they are. So are buffers that arrived in a message. Virtual buffers are copied and detached,
+// which leaves them to the engine to free. Other external buffers, such as mapped files, belong to
+// someone else and are copied.
+//
+
+static TransferredBuffer TransferBuffer(JsValueRef arrayBuffer)
+{
+	ChakraBytePtr data;
+	unsigned int length;
+	IfFailScriptError(JsGetArrayBufferStorage(arrayBuffer, &data, &length), L"invalid ArrayBuffer");
+
+	TransferredBuffer transferred = { nullptr, length, nullptr };
+	if (length == 0)
+	{
+		return transferred;
+	}
+
+	void *owner;
+	bool external = ExternalBuffers::Find(data, &owner);
+
+	if (!external && IsVirtualBufferLength(length))
+	{
+		transferred.data = CopyBuffer(data, length);
+		if (JsDetachArrayBuffer(arrayBuffer) != JsNoError)
+		{
+			free(transferred.data);
+			throw NativeScriptError(L"unable to transfer ArrayBuffer");
+		}
+
+		return transferred;
+	}
+	else if (!external)
+	{
+		IfFailScriptError(JsExternalizeArrayBuffer(arrayBuffer), L"unable to transfer ArrayBuffer");
+		IfFailScriptError(JsDetachArrayBuffer(arrayBuffer), L"unable to transfer ArrayBuffer");
+	}
+	else if (owner != nullptr)
+	{
+		//
+		// Detaching may finalize the buffer, so it has to give up its memory first.
+		//
+
+		ReceivedBuffer *received = (ReceivedBuffer *) owner;
+		ExternalBuffers::Remove(data);
+		received->owned = false;
+
+		if (JsDetachArrayBuffer(arrayBuffer) != JsNoError)
+		{
+			received->owned = true;
+			ExternalBuffers::Add(data, received);
+			throw NativeScriptError(L"unable to transfer ArrayBuffer");
+		}
+	}
+	else
+	{
+		transferred.data = CopyBuffer(data, length);
+		return transferred;
+	}
+
+	transferred.data = data;
+	return transferred;
+}
+
+//
+// Wrap a transferred buffer in an ArrayBuffer that owns it from then on.
+//
+
+static JsErrorCode ReceiveBuffer(TransferredBuffer &transferred, JsValueRef *arrayBuffer)
+{
+	//
+	// The new SharedArrayBuffer takes a reference of its own.
+	//
+
+	if (transferred.shared != nullptr)
+	{
+		IfFailRet(JsCreateSharedArrayBufferWithSharedContent(transferred.shared, arrayBuffer));
+		JsReleaseSharedArrayBufferContentHandle(transferred.shared);
+		transferred.shared = nullptr;
+		return JsNoError;
+	}
+
+	if (transferred.data == nullptr)
+	{
+		return JsCreateArrayBuffer(0, arrayBuffer);
+	}
+
+	ReceivedBuffer *received = new ReceivedBuffer();
+	received->data = transferred.data;
+	received->owned = true;
+
+	JsErrorCode errorCode = JsCreateExternalArrayBuffer(transferred.data, transferred.length, FinalizeReceivedBuffer, received, arrayBuffer);
+	if (errorCode != JsNoError)
+	{
+		delete received;
+		return errorCode;
+	}
+
+	ExternalBuffers::Add(transferred.data, received);
+	transferred.data = nullptr;
+	return JsNoError;
+}
+
+//
+// Build a message from a value, converted to a string, and a list of buffers to transfer or share.
+// The list is checked before any ArrayBuffer is detached.
+//
+
+static WorkerMessage *CreateMessage(JsValueRef value, NativeOptional<JsValueRef> transfer)
+{
+	unique_ptr<WorkerMessage, void (*)(WorkerMessage *)> message(new WorkerMessage(), FreeMessage);
+
+	JsValueRef string;
+	size_t length;
+	IfFailScriptError(JsConvertValueToString(value, &string), L"invalid message");
+	IfFailScriptError(JsCopyString(string, nullptr, 0, &length), L"invalid message");
+
+	message->text.resize(length);
+	if (length > 0)
+	{
+		IfFailScriptError(JsCopyString(string, &message->text[0], length, &length), L"invalid message");
+	}
+
+	if (!transfer.present)
+	{
+		return message.release();
+	}
+
+	JsPropertyIdRef lengthPropertyId;
+	JsValueRef lengthValue;
+	double count;
+	IfFailScriptError(PropertyIds::Get(PropertyIdLength, &lengthPropertyId), L"invalid transfer list");
+	IfFailScriptError(JsGetProperty(transfer.value, lengthPropertyId, &lengthValue), L"invalid transfer list");
+	IfFailScriptError(JsNumberToDouble(lengthValue, &count), L"invalid transfer list");
+
+	//
+	// Shared memory is referenced straight away; ArrayBuffers are taken once the whole list has
+	// checked out.
+	//
+
+	vector<pair<size_t, JsValueRef>> arrayBuffers;
+	message->buffers.reserve((size_t) max(count, 0.0));
+
+	for (int index = 0; index < count; index++)
+	{
+		JsValueRef indexValue;
+		JsValueRef buffer;
+		JsValueType type;
+		IfFailScriptError(JsIntToNumber(index, &indexValue), L"invalid transfer list");
+		IfFailScriptError(JsGetIndexedProperty(transfer.value, indexValue, &buffer), L"invalid transfer list");
+		IfFailScriptError(JsGetValueType(buffer, &type), L"invalid transfer list");
+
+		TransferredBuffer transferred = { nullptr, 0, nullptr };
+		if (type == JsArrayBuffer)
+		{
+			arrayBuffers.push_back(make_pair(message->buffers.size(), buffer));
+		}
+		else if (JsGetSharedArrayBufferContent(buffer, &transferred.shared) != JsNoError)
+		{
+			throw NativeScriptError(L"transfer list may only hold ArrayBuffers and SharedArrayBuffers");
+		}
+
+		message->buffers.push_back(transferred);
+	}
+
+	for (auto &arrayBuffer : arrayBuffers)
+	{
+		message->buffers[arrayBuffer.first] = TransferBuffer(arrayBuffer.second);
+	}
+
+	return message.release();
+}
+
+//
+// Call target.onmessage(message, buffers). Without a handler, the message is dropped.
+//
+
+static JsErrorCode DeliverMessage(JsValueRef target, WorkerMessage *message)
+{
+	JsPropertyIdRef onMessagePropertyId;
+	JsValueRef handler;
+	JsValueType type;
+	IfFailRet(PropertyIds::Get(PropertyIdOnMessage, &onMessagePropertyId));
+	IfFailRet(JsGetProperty(target, onMessagePropertyId, &handler));
+	IfFailRet(JsGetValueType(handler, &type));
+
+	if (type != JsFunction)
+	{
+		return JsNoError;
+	}
+
+	JsValueRef arguments[3];
+	arguments[0] = target;
+	IfFailRet(JsCreateString(message->text.data(), message->text.length(), &arguments[1]));
+	IfFailRet(JsCreateArray((unsigned int) message->buffers.size(), &arguments[2]));
+
+	for (unsigned int index = 0; index < message->buffers.size(); index++)
+	{
+		JsValueRef indexValue;
+		JsValueRef arrayBuffer;
+		IfFailRet(JsIntToNumber((int) index, &indexValue));
+		IfFailRet(ReceiveBuffer(message->buffers[index], &arrayBuffer));
+		IfFailRet(JsSetIndexedProperty(arguments[2], indexValue, arrayBuffer));
+	}
+
+	JsValueRef result;
+	return JsCallFunction(handler, arguments, 3, &result);
+}
+
+Worker::Endpoint::Endpoint(Worker *worker, bool isParent) :
+	worker(worker),
+	isParent(isParent),
+	object(JS_INVALID_REFERENCE),
+	wakeHandle(nullptr)
+{
+}
+
+JsErrorCode Worker::Endpoint::DeliverNext(bool *delivered)
+{
+	*delivered = false;
+
+	//
+	// A terminated worker stops at once, and the parent ignores whatever it posted before it
+	// stopped.
+	//
+
+	if (worker->terminated)
+	{
+		return isParent ? JsNoError : JsErrorScriptTerminated;
+	}
+
+	WorkerMessage *message = (isParent ? worker->toParent : worker->toWorker).Pop();
+	if (message == nullptr)
+	{
+		return JsNoError;
+	}
+
+	*delivered = true;
+
+	JsErrorCode errorCode = DeliverMessage(object, message);
+	FreeMessage(message);
+	return errorCode;
+}
+
+bool Worker::Endpoint::IsActive()
+{
+	if (isParent)
+	{
+		return !worker->exited || (!worker->terminated && worker->toParent.Pending() > 0);
+	}
+
+	if (worker->terminated || worker->closed)
+	{
+		return false;
+	}
+
+	//
+	// A worker waits for messages only while it has a handler for them.
+	//
+
+	JsPropertyIdRef onMessagePropertyId;
+	JsValueRef handler;
+	JsValueType type;
+	return PropertyIds::Get(PropertyIdOnMessage, &onMessagePropertyId) == JsNoError &&
+		JsGetProperty(object, onMessagePropertyId, &handler) == JsNoError &&
+		JsGetValueType(handler, &type) == JsNoError &&
+		type == JsFunction;
+}
+
+void Worker::Endpoint::Close()
+{
+	if (!isParent)
+	{
+		worker->closed = true;
+		return;
+	}
+
+	//
+	// Either the worker is done, or the parent's job failed and nobody is left to talk to it.
+	//
+
+	worker->Terminate();
+	JsRelease(object, nullptr);
+	object = JS_INVALID_REFERENCE;
+}
+
+Worker::Worker(const wstring &fileName) :
+	fileName(fileName),
+	references(1),
+	parent(this, true),
+	child(this, false),
+	terminated(false),
+	exited(false),
+	closed(false),
+	runtime(JS_INVALID_RUNTIME_HANDLE)
+{
+}
+
+Worker::~Worker()
+{
+	if (parent.wakeHandle != nullptr)
+	{
+		CloseHandle(parent.wakeHandle);
+	}
+
+	if (child.wakeHandle != nullptr)
+	{
+		CloseHandle(child.wakeHandle);
+	}
+}
+
+void Worker::AddRef()
+{
+	references++;
+}
+
+void Worker::Release()
+{
+	if (--references == 0)
+	{
+		delete this;
+	}
+}
+
+void CALLBACK Worker::FinalizeWorker(void *data)
+{
+	static_cast<Worker *>((NativeObject *) data)->Release();
+}
+
+void Worker::Post(WorkerMessage *message, bool toParentSide)
+{
+	Endpoint &receiver = toParentSide ? parent : child;
+	(toParentSide ? toParent : toWorker).Push(message);
+
+	//
+	// A worker that can't be woken yet wakes itself once it can.
+	//
+
+	HANDLE wakeHandle = receiver.wakeHandle;
+	if (wakeHandle != nullptr)
+	{
+		EventLoop::Wake(wakeHandle, &receiver);
+	}
+}
+
+void Worker::Terminate()
+{
+	{
+		lock_guard<mutex> guard(runtimeLock);
+
+		if (terminated)
+		{
+			return;
+		}
+
+		terminated = true;
+		if (runtime != JS_INVALID_RUNTIME_HANDLE)
+		{
+			JsDisableRuntimeExecution(runtime);
+		}
+	}
+
+	//
+	// Wake the worker in case it's waiting for a message rather than running a script.
+	//
+
+	HANDLE wakeHandle = child.wakeHandle;
+	if (wakeHandle != nullptr)
+	{
+		EventLoop::Wake(wakeHandle, &child);
+	}
+}
+
+//
+// Create the worker's context and make it current: a host context, plus postMessage and close.
+//
+
+static JsErrorCode CreateWorkerContext(JsRuntimeHandle runtime, JsNativeFunction postMessage, JsNativeFunction close, JsValueRef *globalObject)
+{
+	JsContextRef context;
+	IfFailRet(CreateHostContext(runtime, 0, nullptr, 0, &context));
+	IfFailRet(JsSetCurrentContext(context));
+	IfFailRet(JsGetGlobalObject(globalObject));
+	IfFailRet(DefineHostCallback(*globalObject, PropertyIdPostWorkerMessage, postMessage, nullptr));
+	IfFailRet(DefineHostCallback(*globalObject, PropertyIdClose, close, nullptr));
+
+	return JsNoError;
+}
+
+//
+// The worker thread: run the script and its event loop in a runtime of the worker's own.
+//
+
+void Worker::Run()
+{
+	currentWorker = this;
+	BackgroundWorkPool::SetCallerPriority(BackgroundWorkPriorityHigh);
+
+	JsRuntimeHandle workerRuntime;
+	if (CreateHostRuntime(&workerRuntime) != JsNoError)
+	{
+		fwprintf(stderr, L"chakrahost: failed to create runtime for worker: %s.\n", fileName.c_str());
+	}
+	else
+	{
+		bool started;
+		{
+			lock_guard<mutex> guard(runtimeLock);
+			started = !terminated;
+			if (started)
+			{
+				runtime = workerRuntime;
+			}
+		}
+
+		JsValueRef globalObject;
+		if (started && CreateWorkerContext(workerRuntime, NATIVE_FUNCTION(PostToParent), NATIVE_FUNCTION(CloseWorker), &globalObject) != JsNoError)
+		{
+			fwprintf(stderr, L"chakrahost: failed to create execution context for worker: %s.\n", fileName.c_str());
+			started = false;
+		}
+
+		if (started)
+		{
+			EventLoop *eventLoop = EventLoop::Current();
+			child.object = globalObject;
+			child.wakeHandle = eventLoop->OpenWakeHandle();
+			eventLoop->AddSource(&child);
+
+			//
+			// Messages posted before the worker could be woken are picked up once its script has
+			// run.
+			//
+
+			if (child.wakeHandle != nullptr)
+			{
+				EventLoop::Wake(child.wakeHandle, &child);
+			}
+
+			//
+			// Being terminated isn't an error worth reporting.
+			//
+
+			JsValueRef result;
+			JsErrorCode errorCode = RunScriptJob(fileName.c_str(), watchdog.defaultBudget, &result);
+
+			if (errorCode == JsErrorScriptException && !terminated)
+			{
+				PrintScriptException();
+			}
+			else if (errorCode != JsNoError && errorCode != JsErrorScriptException && errorCode != JsErrorInvalidArgument &&
+				errorCode != JsErrorScriptTerminated && errorCode != JsErrorInDisabledState && errorCode != JsErrorOutOfMemory)
+			{
+				fwprintf(stderr, L"chakrahost: failed to run worker: %s.\n", fileName.c_str());
+			}
+		}
+
+		JsSetCurrentContext(JS_INVALID_REFERENCE);
+
+		{
+			lock_guard<mutex> guard(runtimeLock);
+			runtime = JS_INVALID_RUNTIME_HANDLE;
+		}
+
+		DisposeHostRuntime(workerRuntime);
+	}
+
+	HostOutput::Flush();
+	currentWorker = nullptr;
+
+	//
+	// Let the parent's loop see that the worker is gone.
+	//
+
+	exited = true;
+	EventLoop::Wake(parent.wakeHandle, &parent);
+	Release();
+
+	lock_guard<mutex> guard(workersLock);
+	runningWorkers--;
+	workersFinished.notify_all();
+}
+
+//
+// Callback to start a worker: spawnWorker(fileName) returns the worker object.
+//
+
+JsValueRef Worker::SpawnWorker(const wstring &fileName)
+{
+	EventLoop *eventLoop = EventLoop::Current();
+	HANDLE wakeHandle = eventLoop->OpenWakeHandle();
+	if (wakeHandle == nullptr)
+	{
+		throw NativeScriptError(L"unable to start worker");
+	}
+
+	Worker *worker = new Worker(fileName);
+	worker->parent.wakeHandle = wakeHandle;
+
+	//
+	// From here on, the worker object holds the parent's reference to the worker.
+	//
+
+	JsValueRef object;
+	if (CreateNativeObject(worker, FinalizeWorker, &object) != JsNoError)
+	{
+		delete worker;
+		throw NativeScriptError(L"unable to start worker");
+	}
+
+	IfFailScriptError(DefineHostCallback(object, PropertyIdPostWorkerMessage, NATIVE_METHOD(PostToWorker), nullptr), L"unable to start worker");
+	IfFailScriptError(DefineHostCallback(object, PropertyIdTerminate, NATIVE_METHOD(TerminateWorker), nullptr), L"unable to start worker");
+	IfFailScriptError(JsAddRef(object, nullptr), L"unable to start worker");
+	worker->parent.object = object;
+
+	{
+		lock_guard<mutex> guard(workersLock);
+		runningWorkers++;
+	}
+
+	worker->AddRef();
+
+	try
+	{
+		thread(&Worker::Run, worker).detach();
+	}
+	catch (...)
+	{
+		{
+			lock_guard<mutex> guard(workersLock);
+			runningWorkers--;
+		}
+
+		worker->Release();
+		JsRelease(object, nullptr);
+		throw NativeScriptError(L"unable to start worker");
+	}
+
+	eventLoop->AddSource(&worker->parent);
+	return object;
+}
+
+//
+// Callbacks on the worker object: postMessage(message, transfer) and terminate(). Messages to a
+// worker that has stopped are dropped, and nothing is transferred.
+//
+
+void Worker::PostToWorker(Worker &worker, JsValueRef message, NativeOptional<JsValueRef> transfer)
+{
+	if (worker.terminated || worker.exited)
+	{
+		return;
+	}
+
+	worker.Post(CreateMessage(message, transfer), false);
+}
+
+void Worker::TerminateWorker(Worker &worker)
+{
+	worker.Terminate();
+}
+
+//
+// Callbacks in the worker: postMessage(message, transfer) and close().
+//
+
+void Worker::PostToParent(JsValueRef message, NativeOptional<JsValueRef> transfer)
+{
+	currentWorker->Post(CreateMessage(message, transfer), true);
+}
+
+void Worker::CloseWorker()
+{
+	currentWorker->closed = true;
+}
+
+JsErrorCode Worker::Install(JsValueRef hostObject)
+{
+	return DefineHostCallback(hostObject, PropertyIdSpawnWorker, NATIVE_FUNCTION(SpawnWorker), nullptr);
+}
+
+void Worker::WaitForAll()
+{
+	unique_lock<mutex> guard(workersLock);
+	workersFinished.wait(guard, [] { return runningWorkers == 0; });
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include "EventLoop.h"
+#include "NativeFunction.h"
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+
+//
+// Workers: scripts that run on threads of their own, each in a runtime and host context of its
+// own, and talk to the script that started them by posting messages.
+//
+// host.spawnWorker(fileName) starts a worker and returns an object with postMessage(message,
+// transfer) and terminate(); messages from the worker go to the object's onmessage. In the worker,
+// postMessage(message, transfer) posts to the parent, messages from the parent go to the global
+// onmessage, and close() stops taking messages. Handlers are called as onmessage(message, buffers).
+//
+// A message is a string plus the buffers listed in `transfer`. Transferred ArrayBuffers are
+// detached in the sender and their memory handed to the receiver as is, without a copy.
+// SharedArrayBuffers (with --shared-memory) stay usable in the sender: the receiver gets a
+// SharedArrayBuffer over the same memory, so the two can use Atomics on it. The engine counts the
+// references to shared memory, and frees it once the last runtime's SharedArrayBuffer is gone. Messages
+// travel through lock-free queues and wake the receiver's event loop, so each one is delivered as
+// a macrotask.
+//
+// A parent's event loop keeps running while its workers are; a worker's keeps running while it
+// has an onmessage handler and hasn't been closed or terminated.
+//
+
+struct TransferredBuffer
+{
+	void *data;		// allocated with malloc; nullptr for an empty buffer
+	unsigned length;
+	JsSharedArrayBufferContentHandle shared;	// a reference to a SharedArrayBuffer's memory instead
+};
+
+struct WorkerMessage
+{
+	std::atomic<WorkerMessage *> next;
+	std::string text;	// UTF-8
+	std::vector<TransferredBuffer> buffers;
+};
+
+//
+// An intrusive multi-producer, single-consumer queue (Vyukov's). Push never blocks and never
+// allocates. Pop may briefly see the queue as empty while a push is halfway done; the pusher wakes
+// the consumer afterwards, so the message is picked up then.
+//
+
+class MessageQueue
+{
+public:
+	MessageQueue();
+	~MessageQueue();
+
+	void Push(WorkerMessage *message);
+	WorkerMessage *Pop();
+
+	//
+	// Messages pushed and not yet popped.
+	//
+
+	unsigned Pending() const { return pending; }
+
+private:
+	std::atomic<WorkerMessage *> head;
+	WorkerMessage *tail;
+	WorkerMessage stub;
+	std::atomic<unsigned> pending;
+};
+
+class Worker : public NativeObject
+{
+public:
+	//
+	// Add host.spawnWorker to a context's host object.
+	//
+
+	static JsErrorCode Install(JsValueRef hostObject);
+
+	//
+	// Wait for every worker thread to finish, before the process exits.
+	//
+
+	static void WaitForAll();
+
+private:
+	//
+	// One end of the channel, registered with that end's event loop. `object` gets the messages:
+	// the worker object in the parent, the global object in the worker.
+	//
+
+	class Endpoint : public MessageSource
+	{
+	public:
+		Endpoint(Worker *worker, bool isParent);
+
+		JsErrorCode DeliverNext(bool *delivered) override;
+		bool IsActive() override;
+		void Close() override;
+
+		Worker *worker;
+		bool isParent;
+		JsValueRef object;
+		std::atomic<HANDLE> wakeHandle;
+	};
+
+	Worker(const std::wstring &fileName);
+	~Worker();
+
+	std::wstring fileName;
+	std::atomic<unsigned> references;
+
+	MessageQueue toWorker;
+	MessageQueue toParent;
+	Endpoint parent;
+	Endpoint child;
+
+	std::atomic<bool> terminated;
+	std::atomic<bool> exited;
+	std::atomic<bool> closed;
+
+	//
+	// The worker's runtime while it's running, so terminate can stop its scripts.
+	//
+
+	std::mutex runtimeLock;
+	JsRuntimeHandle runtime;
+
+	void AddRef();
+	void Release();
+	void Post(WorkerMessage *message, bool toParentSide);
+	void Terminate();
+	void Run();
+
+	static JsValueRef SpawnWorker(const std::wstring &fileName);
+	static void PostToWorker(Worker &worker, JsValueRef message, NativeOptional<JsValueRef> transfer);
+	static void TerminateWorker(Worker &worker);
+	static void PostToParent(JsValueRef message, NativeOptional<JsValueRef> transfer);
+	static void CloseWorker();
+	static void CALLBACK FinalizeWorker(void *data);
+};
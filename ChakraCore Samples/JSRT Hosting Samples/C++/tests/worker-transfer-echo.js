@@ -0,0 +1,7 @@
+// Worker for worker-transfer.js: transfers every buffer it receives back to the parent.
+
+'use strict';
+
+this.onmessage = (message, buffers) => {
+    postMessage(message, buffers);
+};
@@ -0,0 +1,56 @@
+// Worker transfer test
+// Run from this directory with `ChakraCoreHost.exe worker-transfer.js`. Transfers ArrayBuffers of
+// several lengths to a worker, which transfers them back, and checks that the sender's buffers are
+// detached and the contents arrive intact. 64 KiB and 256 KiB are lengths ChakraCore reserves with
+// VirtualAlloc on x64, which the host has to copy rather than hand over. Throws if a check fails.
+
+'use strict';
+
+const lengths = [16, 4096, 65536, 65536 * 4, 100000];
+
+function fill(length, seed) {
+    let buffer = new ArrayBuffer(length);
+    let bytes = new Uint8Array(buffer);
+    for (let i = 0; i < length; i++) {
+        bytes[i] = (i * 31 + seed) & 255;
+    }
+    return buffer;
+}
+
+function check(buffer, length, seed) {
+    if (!(buffer instanceof ArrayBuffer) || buffer.byteLength !== length) {
+        throw new Error(`${length} bytes: received a buffer of ${buffer && buffer.byteLength} bytes`);
+    }
+    let bytes = new Uint8Array(buffer);
+    for (let i = 0; i < length; i++) {
+        if (bytes[i] !== ((i * 31 + seed) & 255)) {
+            throw new Error(`${length} bytes: wrong contents at offset ${i}`);
+        }
+    }
+}
+
+let worker = host.spawnWorker('worker-transfer-echo.js');
+let next = 0;
+
+function send() {
+    if (next === lengths.length) {
+        worker.terminate();
+        host.echo('worker-transfer: passed');
+        return;
+    }
+    let buffer = fill(lengths[next], next);
+    worker.postMessage(String(next), [buffer]);
+    if (buffer.byteLength !== 0) {
+        throw new Error(`${lengths[next]} bytes: the sent buffer wasn't detached`);
+    }
+}
+
+worker.onmessage = (message, buffers) => {
+    let index = Number(message);
+    check(buffers[0], lengths[index], index);
+    next++;
+    send();
+};
+
+send();
+0;
@@ -0,0 +1,39 @@
+#pragma once
+#include "AllocationCounter.h"
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+using namespace std;
+
+// glfw may call back on other threads, so the count is atomic
+static atomic<unsigned long long> allocations(0);
+
+unsigned long long allocationCount()
+{
+	return allocations.load(memory_order_relaxed);
+}
+
+void* operator new(size_t size)
+{
+	allocations.fetch_add(1, memory_order_relaxed);
+	void* p = malloc(size > 0 ? size : 1);
+	if (p == nullptr)
+		throw bad_alloc();
+	return p;
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+	free(p);
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+// number of times the engine has called operator new. the engine's own code allocates through
+// the global operator new, which AllocationCounter.cpp replaces to count; ChakraCore and the GL
+// libraries have allocators of their own and aren't counted.
+unsigned long long allocationCount();
@@ -1,5 +1,6 @@
 #pragma once
 #include "Canvas.h"
+#include <windows.h>
 
 Canvas::Canvas() 
 {
@@ -66,10 +67,36 @@ void Canvas::render()
 		for (std::vector<GLShape*>::iterator it = _shapes.begin(); it != _shapes.end(); ++it) {
 			(*it)->render();
 		}
+	}
+}
 
+void Canvas::swapBuffers()
+{
+	if (!glfwWindowShouldClose(window))
 		glfwSwapBuffers(window);
-		glfwPollEvents();
-	}
+}
+
+int Canvas::refreshRate()
+{
+	const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
+	return mode ? mode->refreshRate : 0;
+}
+
+bool Canvas::isClosed()
+{
+	return window == nullptr || glfwWindowShouldClose(window);
+}
+
+void Canvas::pollEvents()
+{
+	glfwPollEvents();
+}
+
+void Canvas::waitEvents(int timeout)
+{
+	// glfw 3.1 has no glfwWaitEventsTimeout, so wait on the thread's message queue ourselves
+	MsgWaitForMultipleObjects(0, nullptr, FALSE, timeout, QS_ALLINPUT);
+	glfwPollEvents();
 }
 
 Canvas::~Canvas() 
@@ -17,6 +17,11 @@ public:
 	void setMouseClickCallback(GLFWmousebuttonfun func);	// set a mouse event callback on canvas
 	void addShape(GLShape* shape);							// add a  to canvas
 	void removeShape(GLShape* shape);						// remove a GLShape to canvas
-	void render();											// paint a frame
+	void render();											// paint a frame into the back buffer
+	void swapBuffers();										// show the painted frame; waits for vsync
+	int refreshRate();										// refresh rate of the display in Hz, or 0
+	bool isClosed();										// whether the user closed the window
+	void pollEvents();										// process pending input events
+	void waitEvents(int timeout);							// wait up to timeout ms for input, then process it
 	~Canvas();												// terminate drawing session
 };
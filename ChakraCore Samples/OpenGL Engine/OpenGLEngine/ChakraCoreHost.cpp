@@ -1,8 +1,10 @@
 #pragma once
 #include "ChakraCoreHost.h"
+#include "AllocationCounter.h"
 #include <string>
 #include <assert.h>
-#include <time.h>
+#include <climits>
+#include <algorithm>
 
 using namespace std;
 
@@ -10,20 +12,27 @@ using namespace std;
 //						 ChakraCoreHost
 // ************************************************************
 
+// raises the system timer resolution to 1 ms while it's alive, so it's put back however the loop ends
+class TimerResolution
+{
+public:
+	TimerResolution() { timeBeginPeriod(1); }
+	~TimerResolution() { timeEndPeriod(1); }
+};
+
 // ES6 Promise callback
 void CALLBACK PromiseContinuationCallback(JsValueRef task, void *callbackState)
 {
-	// Save promises in taskQueue.
-	JsValueRef global;
-	JsGetGlobalObject(&global);
-	queue<Task*> * q = (queue<Task*> *)callbackState;
-	q->push(new Task(task, 0, global, JS_INVALID_REFERENCE));
+	// Save promise jobs in the microtask queue; they run once the current task is done.
+	MicrotaskQueue* microtasks = (MicrotaskQueue*)callbackState;
+	microtasks->push(task);
 }
 
 // ChakraCoreHost constructor
 ChakraCoreHost::ChakraCoreHost()
 {
 	currentSourceContext = 0;
+	startTime = TaskScheduler::now();
 	JsContextRef context;
 
 	// Create the runtime. We're only going to use one runtime for this host.
@@ -39,12 +48,15 @@ ChakraCoreHost::ChakraCoreHost()
 		throw "failed to set current context.";
 
 	// Set up ES6 Promise 
-	if (JsSetPromiseContinuationCallback(PromiseContinuationCallback, &taskQueue) != JsNoError)
+	if (JsSetPromiseContinuationCallback(PromiseContinuationCallback, &microtasks) != JsNoError)
 		throw "failed to set PromiseContinuationCallback.";
 
 	// Add bindings to native methods 
 	Binding::host = this;
 	Binding::addNativeBindings();
+
+	// Frames are paced to the display.
+	frames.setRefreshRate(canvas.refreshRate());
 }
 
 // load script from file
@@ -110,8 +122,8 @@ wstring ChakraCoreHost::runScript(wstring script)
 			if (JsGetAndClearException(&exception) != JsNoError)
 				return L"failed to get and clear exception";
 
-			JsPropertyIdRef messageName;
-			if (JsGetPropertyIdFromName(L"message", &messageName) != JsNoError)
+			JsPropertyIdRef messageName = propertyIds.get(PropertyIdMessage);
+			if (messageName == JS_INVALID_REFERENCE)
 				return L"failed to get error message id";
 
 			JsValueRef messageValue;
@@ -126,24 +138,44 @@ wstring ChakraCoreHost::runScript(wstring script)
 			return message;
 		}
 
-		// Execute tasks stored in taskQueue
-		while (!taskQueue.empty()) {
-			Task* task = taskQueue.front();
-			taskQueue.pop();
-			int currentTime = clock() / (double)(CLOCKS_PER_SEC / 1000);
-			if (currentTime - task->_time > task->_delay) {
+		// Promise jobs queued by the script itself run before any task.
+		microtasks.drain();
+
+		// Execute scheduled tasks and frames until none are left or the window is closed. After each
+		// task, including input callbacks, the promise jobs it queued run to completion.
+		// Waits are timed with 1 ms resolution instead of the default 15.6 ms timer tick.
+		TimerResolution timerResolution;
+		while ((!scheduler.empty() || frames.pending()) && !canvas.isClosed()) {
+			// run every task that was due when this pass started; tasks rescheduled while it runs wait
+			// for the next pass, so input is still processed between them
+			long long passTime = TaskScheduler::now();
+			unsigned long long allocations = allocationCount();
+			while (!scheduler.empty() && scheduler.nextDeadline() <= passTime) {
+				Task* task = scheduler.pop();
 				task->invoke();
-				if (task->_repeat) {
-					task->_time = currentTime;
-					taskQueue.push(task);
-				}
-				else {
-					delete task;
-				}
-			}
-			else {
-				taskQueue.push(task);
+				microtasks.drain();
+				scheduler.finish(task);
 			}
+			scheduler.countPass(allocationCount() - allocations);
+
+			// at most one frame per pass, once it's due
+			if (frames.pending() && frames.nextFrame() <= TaskScheduler::now())
+				runFrame();
+			scheduler.report(microtasks.runCount());
+			frames.report();
+
+			// sleep whole milliseconds until the next task or frame is due or input arrives; the last
+			// fraction of a millisecond is polled
+			long long next = LLONG_MAX;
+			if (!scheduler.empty())
+				next = scheduler.nextDeadline();
+			if (frames.pending())
+				next = min(next, frames.nextFrame());
+			long long wait = next == LLONG_MAX ? 0 : (next - TaskScheduler::now()) / 1000000;
+			if (wait > 0)
+				canvas.waitEvents((int)min(wait, (long long)INT_MAX));
+			else
+				canvas.pollEvents();
 		}
 
 		// Convert the return value to wstring.
@@ -162,8 +194,27 @@ wstring ChakraCoreHost::runScript(wstring script)
 	}
 }
 
+// the callbacks share a timestamp from the start of the frame, in performance.now() time. script,
+// render and swap are timed separately so the frame's budget use can be reported.
+void ChakraCoreHost::runFrame()
+{
+	unsigned long long allocations = allocationCount();
+	long long start = TaskScheduler::now();
+	frames.run((start - startTime) / 1e6, microtasks);
+	long long scripted = TaskScheduler::now();
+	canvas.render();
+	long long rendered = TaskScheduler::now();
+	canvas.swapBuffers();
+	long long swapped = TaskScheduler::now();
+	frames.finish(start, scripted, rendered, swapped, allocationCount() - allocations);
+}
+
 ChakraCoreHost::~ChakraCoreHost()
 {
+	scheduler.clear();
+	frames.clear();
+	microtasks.clear();
+	propertyIds.reset();
 	JsDisposeRuntime(runtime);
 }
 
@@ -184,75 +235,104 @@ JsValueRef Binding::mouseCallbackThisArg;
 //	  Binding - Util functions
 // ******************************
 
-void Binding::setCallback(JsValueRef object, const wchar_t *propertyName, JsNativeFunction callback, void *callbackState)
+// property ids come from the host's table rather than JsGetPropertyIdFromName on every call
+void Binding::setCallback(JsValueRef object, PropertyId propertyId, JsNativeFunction callback, void *callbackState)
 {
-	JsPropertyIdRef propertyId;
-	JsGetPropertyIdFromName(propertyName, &propertyId);
 	JsValueRef function;
 	JsCreateFunction(callback, callbackState, &function);
-	JsSetProperty(object, propertyId, function, true);
+	JsSetProperty(object, host->propertyIds.get(propertyId), function, true);
 }
 
-void Binding::setProperty(JsValueRef object, const wchar_t *propertyName, JsValueRef property)
+void Binding::setProperty(JsValueRef object, PropertyId propertyId, JsValueRef property)
 {
-	JsPropertyIdRef propertyId;
-	JsGetPropertyIdFromName(propertyName, &propertyId);
-	JsSetProperty(object, propertyId, property, true);
+	JsSetProperty(object, host->propertyIds.get(propertyId), property, true);
 }
 
-JsValueRef Binding::getProperty(JsValueRef object, const wchar_t *propertyName)
+JsValueRef Binding::getProperty(JsValueRef object, PropertyId propertyId)
 {
 	JsValueRef output;
-	JsPropertyIdRef propertyId;
-	JsGetPropertyIdFromName(propertyName, &propertyId);
-	JsGetProperty(object, propertyId, &output);
+	JsGetProperty(object, host->propertyIds.get(propertyId), &output);
 	return output;
 }
 
+// throw in script unless func can be called; a task that can't be called would fail every time it runs
+void Binding::checkCallback(JsValueRef func)
+{
+	JsValueType type;
+	if (JsGetValueType(func, &type) != JsNoError || type != JsFunction)
+		throw NativeScriptError(L"callback is not a function");
+}
+
 // ******************************
 //	 Binding - General methods
 // ******************************
 
-// JsNativeFunction for console.log(expr)
-JsValueRef CALLBACK Binding::JSLog(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// console.log(expr)
+void Binding::JSLog(NativeRestArguments values)
 {
-	for (unsigned int index = 1; index < argumentCount; index++)
+	for (unsigned int index = 0; index < values.count; index++)
 	{
-		if (index > 1)
+		if (index > 0)
 		{
 			wprintf(L" ");
 		}
 		JsValueRef stringValue;
-		JsConvertValueToString(arguments[index], &stringValue);
+		IfFailScriptError(JsConvertValueToString(values.values[index], &stringValue), L"invalid argument");
 		const wchar_t *string;
 		size_t length;
-		JsStringToPointer(stringValue, &string, &length);
+		IfFailScriptError(JsStringToPointer(stringValue, &string, &length), L"invalid argument");
 		wprintf(L"%s", string);
 	}
 	wprintf(L"\n");
-	return JS_INVALID_REFERENCE;
 }
 
-// JsNativeFunction for setTimeout(func, delay)
-JsValueRef CALLBACK Binding::JSSetTimeout(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// setTimeout(func, delay) - func is called with the same this; returns a handle for clearTimeout.
+// delay defaults to 0.
+double Binding::JSSetTimeout(JsValueRef thisArg, JsValueRef func, NativeOptional<int> delay)
+{
+	checkCallback(func);
+	double handle = host->scheduler.add(func, delay.present ? delay.value : 0, thisArg, JS_INVALID_REFERENCE);
+	if (handle == 0)
+		throw NativeScriptError(L"too many timers");
+	return handle;
+}
+
+// setInterval(func, delay) - returns a handle for clearInterval
+double Binding::JSSetInterval(JsValueRef thisArg, JsValueRef func, NativeOptional<int> delay)
+{
+	checkCallback(func);
+	double handle = host->scheduler.add(func, delay.present ? delay.value : 0, thisArg, JS_INVALID_REFERENCE, true);
+	if (handle == 0)
+		throw NativeScriptError(L"too many timers");
+	return handle;
+}
+
+// clearTimeout(handle), clearInterval(handle) - handles that already ran or were cleared are ignored
+void Binding::JSClearTimer(NativeOptional<double> handle)
+{
+	if (handle.present)
+		host->scheduler.cancel(handle.value);
+}
+
+// performance.now() - milliseconds since the engine started, with sub-millisecond precision
+double Binding::JSPerformanceNow()
+{
+	return (TaskScheduler::now() - host->startTime) / 1e6;
+}
+
+// requestAnimationFrame(func) - func(timestamp) is called before the next frame is rendered;
+// returns an id for cancelAnimationFrame
+double Binding::JSRequestAnimationFrame(JsValueRef func)
 {
-	assert(!isConstructCall && argumentCount == 3);
-	JsValueRef func = arguments[1];
-	int delay = 0;
-	JsNumberToInt(arguments[2], &delay);
-	host->taskQueue.push(new Task(func, delay, arguments[0], JS_INVALID_REFERENCE));
-	return JS_INVALID_REFERENCE;
+	checkCallback(func);
+	return host->frames.request(func);
 }
 
-// JsNativeFunction for setInterval(func, delay)
-JsValueRef CALLBACK Binding::JSSetInterval(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// cancelAnimationFrame(id) - ids of callbacks that already ran or were cancelled are ignored
+void Binding::JSCancelAnimationFrame(NativeOptional<double> id)
 {
-	assert(!isConstructCall && argumentCount == 3);
-	JsValueRef func = arguments[1];
-	int delay = 0;
-	JsNumberToInt(arguments[2], &delay);
-	host->taskQueue.push(new Task(func, delay, arguments[0], JS_INVALID_REFERENCE, true));
-	return JS_INVALID_REFERENCE;
+	if (id.present && id.value >= 1 && id.value <= UINT_MAX)
+		host->frames.cancel((unsigned)id.value);
 }
 
 // ******************************
@@ -261,180 +341,108 @@ JsValueRef CALLBACK Binding::JSSetInterval(JsValueRef callee, bool isConstructCa
 
 // project JavaScript Point object back to native GLPoint
 GLPoint* Binding::JSPointToNativePoint(JsValueRef point) {
-	void* p;
-	JsGetExternalData(point, &p);
-	return reinterpret_cast<GLPoint*>(p);
+	return GetNativeObject<GLPoint>(point);
 }
 
-// JsNativeFunction for Pointer constructor - Point(x, y, z)
-JsValueRef CALLBACK Binding::JSPointConstructor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// project a JavaScript array of Points back to native GLPoints
+vector<GLPoint> Binding::JSPointsToNativePoints(JsValueRef points) {
+	vector<GLPoint> output;
+	int length;
+	IfFailScriptError(JsNumberToInt(getProperty(points, PropertyIdLength), &length), L"invalid points argument");
+	for (int i = 0; i < length; i++) {
+		JsValueRef jsIndex;
+		JsIntToNumber(i, &jsIndex);
+		JsValueRef jsPoint;
+		JsGetIndexedProperty(points, jsIndex, &jsPoint);
+		GLPoint* point = JSPointToNativePoint(jsPoint);
+		if (point == nullptr)
+			throw NativeScriptError(L"invalid point");
+		output.push_back(*point);
+	}
+	return output;
+}
+
+// Point constructor - Point(x, y, z)
+JsValueRef Binding::JSPointConstructor(float x, float y, float z)
 {
-	assert(isConstructCall && argumentCount == 4);
 	JsValueRef output = JS_INVALID_REFERENCE;
-	double x, y, z;
-	JsNumberToDouble(arguments[1], &x);
-	JsNumberToDouble(arguments[2], &y);
-	JsNumberToDouble(arguments[3], &z);
-	GLPoint* p1 = new GLPoint((float)x, (float)y, (float)z);
-	JsCreateExternalObject(p1, nullptr, &output);
+	GLPoint* p1 = new GLPoint(x, y, z);
+	CreateNativeObject(p1, nullptr, &output);
 	JsSetPrototype(output, JSPointPrototype);
 	return output;
 }
 
 // create GLPolygon
-JsValueRef Binding::createPolygon(JsValueRef *arguments, unsigned short argumentCount) {
+JsValueRef Binding::createPolygon(vector<GLPoint> points, JsValueRef prototype) {
 	JsValueRef output = JS_INVALID_REFERENCE;
-	vector<GLPoint> points;
-	for (int i = 1; i < argumentCount; i++)
-	{
-		points.push_back(*(JSPointToNativePoint(arguments[i])));
-	}
 	GLPolygon* polygon = new GLPolygon(points);
-	JsCreateExternalObject(polygon, nullptr, &output);
+	CreateNativeObject(polygon, nullptr, &output);
+	JsSetPrototype(output, prototype);
 	return output;
 }
 
-// JsNativeFunction for Line constructor - new Line(point1, point2)
-JsValueRef CALLBACK Binding::JSLineConstructor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// Line constructor - new Line(point1, point2)
+JsValueRef Binding::JSLineConstructor(GLPoint &point1, GLPoint &point2)
 {
-	assert(isConstructCall && argumentCount == 3);
-	JsValueRef output = JS_INVALID_REFERENCE;
-	output = createPolygon(arguments, argumentCount);
-	JsSetPrototype(output, JSLinePrototype);
-	return output;
+	return createPolygon({ point1, point2 }, JSLinePrototype);
 }
 
-// JsNativeFunction for Triangle constructor - Triangle(point1, point2, point3)
-JsValueRef CALLBACK Binding::JSTriangleConstructor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// Triangle constructor - Triangle(point1, point2, point3)
+JsValueRef Binding::JSTriangleConstructor(GLPoint &point1, GLPoint &point2, GLPoint &point3)
 {
-	assert(isConstructCall && argumentCount == 4);
-	JsValueRef output = JS_INVALID_REFERENCE;
-	output = createPolygon(arguments, argumentCount);
-	JsSetPrototype(output, JSTrianglePrototype);
-	return output;
+	return createPolygon({ point1, point2, point3 }, JSTrianglePrototype);
 }
 
-// JsNativeFunction for Quad constructor - Quad(point1, point2, point3, point4)
-JsValueRef CALLBACK Binding::JSQuadConstructor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// Quad constructor - Quad(point1, point2, point3, point4)
+JsValueRef Binding::JSQuadConstructor(GLPoint &point1, GLPoint &point2, GLPoint &point3, GLPoint &point4)
 {
-	assert(isConstructCall && argumentCount == 5);
-	JsValueRef output = JS_INVALID_REFERENCE;
-	output = createPolygon(arguments, argumentCount);
-	JsSetPrototype(output, JSQuadPrototype);
-	return output;
+	return createPolygon({ point1, point2, point3, point4 }, JSQuadPrototype);
 }
 
-// JsNativeFunction for Polygon constructor - Polygon([points])
-JsValueRef CALLBACK Binding::JSPolygonConstructor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// Polygon constructor - Polygon([points])
+JsValueRef Binding::JSPolygonConstructor(JsValueRef points)
 {
-	assert(isConstructCall && argumentCount == 2);
-	JsValueRef output = JS_INVALID_REFERENCE;
-	vector<GLPoint> points;
-	// retrieve all elements in [points] param 
-	int length;
-	JsNumberToInt(getProperty(arguments[1], L"length"), &length);
-	for (int i = 0; i < length; i++) {
-		JsValueRef jsIndex;
-		JsIntToNumber(i, &jsIndex);
-		JsValueRef jsPoint;
-		JsGetIndexedProperty(arguments[1], jsIndex, &jsPoint);
-		points.push_back(*(JSPointToNativePoint(jsPoint)));
-	}
-	GLPolygon* polygon = new GLPolygon(points);
-	JsCreateExternalObject(polygon, nullptr, &output);
-	JsSetPrototype(output, JSPolygonPrototype);
-	return output;
+	return createPolygon(JSPointsToNativePoints(points), JSPolygonPrototype);
 }
 
-// JsNativeFunction for rotate - shape.rotate(rotateAngle, x, y, z)
-JsValueRef CALLBACK Binding::JSRotate(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// shape.rotate(rotateAngle, x, y, z)
+void Binding::JSRotate(GLShape &shape, float rotateAngle, float x, float y, float z)
 {
-	assert(!isConstructCall && argumentCount == 5);
-	JsValueRef output = JS_INVALID_REFERENCE;
-	void* shape;
-	if (JsGetExternalData(arguments[0], &shape) == JsNoError) {
-		GLShape* s = static_cast<GLShape*>(shape);
-		double rotateAngle, x, y, z;
-		JsNumberToDouble(arguments[1], &rotateAngle);
-		JsNumberToDouble(arguments[2], &x);
-		JsNumberToDouble(arguments[3], &y);
-		JsNumberToDouble(arguments[4], &z);
-		s->rotate((float)rotateAngle, GLTriple((float)x, (float)y, (float)z));
-	};
-	return output;
+	shape.rotate(rotateAngle, GLTriple(x, y, z));
 }
 
-// JsNativeFunction for setColor - shape.setColor(R, G, B)
-JsValueRef CALLBACK Binding::JSSetColor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// shape.setColor(R, G, B)
+void Binding::JSSetColor(GLShape &shape, float r, float g, float b)
 {
-	assert(!isConstructCall && argumentCount == 4);
-	JsValueRef output = JS_INVALID_REFERENCE;
-	void* shape;
-	if (JsGetExternalData(arguments[0], &shape) == JsNoError) {
-		GLShape* s = static_cast<GLShape*>(shape);
-		double x, y, z;
-		JsNumberToDouble(arguments[1], &x);
-		JsNumberToDouble(arguments[2], &y);
-		JsNumberToDouble(arguments[3], &z);
-		s->setColor(GLTriple((float)x, (float)y, (float)z));
-	};
-	return output;
+	shape.setColor(GLTriple(r, g, b));
 }
 
-// JsNativeFunction for setPosition - shape.setPosition([points])
-JsValueRef CALLBACK Binding::JSSetPosition(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// shape.setPosition([points])
+void Binding::JSSetPosition(GLPolygon &shape, JsValueRef points)
 {
-	assert(!isConstructCall && argumentCount == 2);
-	JsValueRef output = JS_INVALID_REFERENCE;
-	void* shape;
-	if (JsGetExternalData(arguments[0], &shape) == JsNoError) {
-		GLPolygon* s = static_cast<GLPolygon*>(shape);
-		s->_points.clear();
-		// retrieve all elements in [points] param 
-		int length;
-		JsNumberToInt(getProperty(arguments[1], L"length"), &length);
-		for (int i = 0; i < length; i++) {
-			JsValueRef jsIndex;
-			JsIntToNumber(i, &jsIndex);
-			JsValueRef jsPoint;
-			JsGetIndexedProperty(arguments[1], jsIndex, &jsPoint);
-			s->_points.push_back(*(JSPointToNativePoint(jsPoint)));
-		}
-	};
-	return output;
+	shape._points = JSPointsToNativePoints(points);
 }
 
 // ******************************
 //	  Binding - Canvas methods
 // ******************************
 
-// JsNativeFunction for canvas.addShape(shape)
-JsValueRef CALLBACK Binding::JSAddShape(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// canvas.addShape(shape)
+void Binding::JSAddShape(GLShape &shape)
 {
-	assert(!isConstructCall && argumentCount == 2);
-	void* shape;
-	JsGetExternalData(arguments[1], &shape);
-	GLShape* f = static_cast<GLShape*>(shape);
-	host->canvas.addShape(static_cast<GLShape*>(shape));
-	return JS_INVALID_REFERENCE;
+	host->canvas.addShape(&shape);
 }
 
-// JsNativeFunction for canvas.removeShape(shape)
-JsValueRef CALLBACK Binding::JSRemoveShape(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// canvas.removeShape(shape)
+void Binding::JSRemoveShape(GLShape &shape)
 {
-	assert(!isConstructCall && argumentCount == 2);
-	void* shape;
-	JsGetExternalData(arguments[1], &shape);
-	host->canvas.removeShape(static_cast<GLShape*>(shape));
-	return JS_INVALID_REFERENCE;
+	host->canvas.removeShape(&shape);
 }
 
-// JsNativeFunction for canvas.render()
-JsValueRef CALLBACK Binding::JSRender(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// canvas.render() - the canvas is painted in the next frame
+void Binding::JSRender()
 {
-	assert(!isConstructCall && argumentCount == 1);
-	host->canvas.render();
-	return JS_INVALID_REFERENCE;
+	host->frames.requestRender();
 }
 
 void Binding::mouse_click_callback(GLFWwindow* window, int button, int action, int mods)
@@ -450,34 +458,32 @@ void Binding::mouse_click_callback(GLFWwindow* window, int button, int action, i
 	JsDoubleToNumber(xpos, &jsXpos);
 	JsDoubleToNumber(ypos, &jsYpos);
 	JsCreateObject(&jsArg);
-	setProperty(jsArg, L"x", jsXpos);
-	setProperty(jsArg, L"y", jsYpos);
+	setProperty(jsArg, PropertyIdX, jsXpos);
+	setProperty(jsArg, PropertyIdY, jsYpos);
 	if (action == GLFW_PRESS) {
-		host->taskQueue.push(new Task(mouseCallbackFunc, 0, mouseCallbackThisArg, jsArg));
+		host->scheduler.add(mouseCallbackFunc, 0, mouseCallbackThisArg, jsArg);
 	}
 }
 
-// JsNativeFunction for canvas.setMouseClickCallback((pos)=>{...})
-JsValueRef CALLBACK Binding::JSSetMouseClickCallback(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState)
+// canvas.setMouseClickCallback((pos)=>{...})
+void Binding::JSSetMouseClickCallback(JsValueRef thisArg, JsValueRef func)
 {
-	assert(!isConstructCall && argumentCount == 2);
 	// release previously set callback 
 	if (mouseCallbackFunc != JS_INVALID_REFERENCE && mouseCallbackThisArg != JS_INVALID_REFERENCE) {
 		JsRelease(mouseCallbackFunc, nullptr);
 		JsRelease(mouseCallbackThisArg, nullptr);
 	}
-	mouseCallbackFunc = arguments[1];
-	mouseCallbackThisArg = arguments[0];
+	mouseCallbackFunc = func;
+	mouseCallbackThisArg = thisArg;
 	// pin down the callback so that it will not be garbage collected
 	JsAddRef(mouseCallbackFunc, nullptr);
 	JsAddRef(mouseCallbackThisArg, nullptr);
 	host->canvas.setMouseClickCallback(Binding::mouse_click_callback);
-	return JS_INVALID_REFERENCE;
 }
 
 // project a custom native class and its member functions to JS
 // there must be a one-to-one mapping between elements in memberNames and memberFunc
-void Binding::projectNativeClass(const wchar_t *className, JsNativeFunction constructor, JsValueRef &prototype, vector<const wchar_t *> memberNames, vector<JsNativeFunction> memberFuncs) {
+void Binding::projectNativeClass(PropertyId className, JsNativeFunction constructor, JsValueRef &prototype, vector<PropertyId> memberNames, vector<JsNativeFunction> memberFuncs) {
 	// project constructor to global scope 
 	JsValueRef globalObject;
 	JsGetGlobalObject(&globalObject);
@@ -490,43 +496,52 @@ void Binding::projectNativeClass(const wchar_t *className, JsNativeFunction cons
 	for (int i = 0; i < memberNames.size(); ++i) {
 		setCallback(prototype, memberNames[i], memberFuncs[i], nullptr);
 	}
-	setProperty(jsConstructor, L"prototype", prototype);
+	setProperty(jsConstructor, PropertyIdPrototype, prototype);
 }
 
 // add all native bindings
 void Binding::addNativeBindings() {
-	// project general methods - console.log, setTimeout, setInterval
+	// project general methods - console.log, setTimeout, setInterval, clearTimeout, clearInterval,
+	// performance.now, requestAnimationFrame, cancelAnimationFrame
 	JsValueRef globalObject;
 	JsGetGlobalObject(&globalObject);
 	JsValueRef console;
 	JsCreateObject(&console);
-	setProperty(globalObject, L"console", console);
-	setCallback(console, L"log", JSLog, nullptr);
-	setCallback(globalObject, L"setTimeout", JSSetTimeout, nullptr);
-	setCallback(globalObject, L"setInterval", JSSetInterval, nullptr);
+	setProperty(globalObject, PropertyIdConsole, console);
+	setCallback(console, PropertyIdLog, NATIVE_FUNCTION(JSLog), nullptr);
+	setCallback(globalObject, PropertyIdSetTimeout, NATIVE_METHOD(JSSetTimeout), nullptr);
+	setCallback(globalObject, PropertyIdSetInterval, NATIVE_METHOD(JSSetInterval), nullptr);
+	setCallback(globalObject, PropertyIdClearTimeout, NATIVE_FUNCTION(JSClearTimer), nullptr);
+	setCallback(globalObject, PropertyIdClearInterval, NATIVE_FUNCTION(JSClearTimer), nullptr);
+	JsValueRef performance;
+	JsCreateObject(&performance);
+	setProperty(globalObject, PropertyIdPerformance, performance);
+	setCallback(performance, PropertyIdNow, NATIVE_FUNCTION(JSPerformanceNow), nullptr);
+	setCallback(globalObject, PropertyIdRequestAnimationFrame, NATIVE_FUNCTION(JSRequestAnimationFrame), nullptr);
+	setCallback(globalObject, PropertyIdCancelAnimationFrame, NATIVE_FUNCTION(JSCancelAnimationFrame), nullptr);
 
 	// project shape classes and their methods
-	vector<const wchar_t *> memberNames;
+	vector<PropertyId> memberNames;
 	vector<JsNativeFunction> memberFuncs;
-	memberNames.push_back(L"rotate");
-	memberFuncs.push_back(JSRotate);
-	memberNames.push_back(L"setColor");
-	memberFuncs.push_back(JSSetColor);
-	projectNativeClass(L"Point", JSPointConstructor, JSPointPrototype, memberNames, memberFuncs);
+	memberNames.push_back(PropertyIdRotate);
+	memberFuncs.push_back(NATIVE_METHOD(JSRotate));
+	memberNames.push_back(PropertyIdSetColor);
+	memberFuncs.push_back(NATIVE_METHOD(JSSetColor));
+	projectNativeClass(PropertyIdPoint, NATIVE_FUNCTION(JSPointConstructor), JSPointPrototype, memberNames, memberFuncs);
 	// setPosition not available for Point
-	memberNames.push_back(L"setPosition");
-	memberFuncs.push_back(JSSetPosition);
-	projectNativeClass(L"Line", JSLineConstructor, JSLinePrototype, memberNames, memberFuncs);
-	projectNativeClass(L"Triangle", JSTriangleConstructor, JSTrianglePrototype, memberNames, memberFuncs);
-	projectNativeClass(L"Quad", JSQuadConstructor, JSQuadPrototype, memberNames, memberFuncs);
-	projectNativeClass(L"Polygon", JSPolygonConstructor, JSPolygonPrototype, memberNames, memberFuncs);
+	memberNames.push_back(PropertyIdSetPosition);
+	memberFuncs.push_back(NATIVE_METHOD(JSSetPosition));
+	projectNativeClass(PropertyIdLine, NATIVE_FUNCTION(JSLineConstructor), JSLinePrototype, memberNames, memberFuncs);
+	projectNativeClass(PropertyIdTriangle, NATIVE_FUNCTION(JSTriangleConstructor), JSTrianglePrototype, memberNames, memberFuncs);
+	projectNativeClass(PropertyIdQuad, NATIVE_FUNCTION(JSQuadConstructor), JSQuadPrototype, memberNames, memberFuncs);
+	projectNativeClass(PropertyIdPolygon, NATIVE_FUNCTION(JSPolygonConstructor), JSPolygonPrototype, memberNames, memberFuncs);
 
 	// project canvas & its methods
 	JsValueRef canvas;
 	JsCreateObject(&canvas);
-	setProperty(globalObject, L"canvas", canvas);
-	setCallback(canvas, L"addShape", JSAddShape, nullptr);
-	setCallback(canvas, L"removeShape", JSRemoveShape, nullptr);
-	setCallback(canvas, L"render", JSRender, nullptr);
-	setCallback(canvas, L"setMouseClickCallback", JSSetMouseClickCallback, nullptr);
+	setProperty(globalObject, PropertyIdCanvas, canvas);
+	setCallback(canvas, PropertyIdAddShape, NATIVE_FUNCTION(JSAddShape), nullptr);
+	setCallback(canvas, PropertyIdRemoveShape, NATIVE_FUNCTION(JSRemoveShape), nullptr);
+	setCallback(canvas, PropertyIdRender, NATIVE_FUNCTION(JSRender), nullptr);
+	setCallback(canvas, PropertyIdSetMouseClickCallback, NATIVE_METHOD(JSSetMouseClickCallback), nullptr);
 }
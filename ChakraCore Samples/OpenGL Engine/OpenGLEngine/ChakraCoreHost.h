@@ -1,8 +1,12 @@
 #pragma once
 #include "Task.h"
+#include "TaskScheduler.h"
+#include "MicrotaskQueue.h"
+#include "FrameScheduler.h"
 #include "Canvas.h"
+#include "PropertyIds.h"
+#include "NativeFunction.h"
 #include "ChakraCore.h"
-#include <queue>
 
 using namespace std;
 
@@ -12,9 +16,14 @@ class ChakraCoreHost
 private:
 	JsRuntimeHandle runtime;
 	unsigned currentSourceContext;
+	void runFrame();									// run a frame's callbacks, then render and swap once
 public:
-	queue<Task*> taskQueue;
+	TaskScheduler scheduler;
+	MicrotaskQueue microtasks;							// promise jobs, run after every task
+	FrameScheduler frames;								// requestAnimationFrame callbacks and frame timing
 	Canvas canvas;
+	PropertyIds propertyIds;							// property ids of the runtime
+	long long startTime;								// when the host started, in TaskScheduler::now() time
 	ChakraCoreHost();
 	wstring runScript(wstring script);					// run a script
 	wstring loadScript(wstring fileName);				// load a script from file
@@ -35,26 +44,32 @@ private:
 	static JsValueRef JSPolygonPrototype;
 	static JsValueRef mouseCallbackFunc;
 	static JsValueRef mouseCallbackThisArg;
-	static void setCallback(JsValueRef object, const wchar_t *propertyName, JsNativeFunction callback, void *callbackState);
-	static void setProperty(JsValueRef object, const wchar_t *propertyName, JsValueRef property);
-	static JsValueRef getProperty(JsValueRef object, const wchar_t *propertyName);
-	static JsValueRef CALLBACK JSLog(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef CALLBACK JSSetTimeout(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef CALLBACK JSSetInterval(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
+	static void setCallback(JsValueRef object, PropertyId propertyId, JsNativeFunction callback, void *callbackState);
+	static void setProperty(JsValueRef object, PropertyId propertyId, JsValueRef property);
+	static JsValueRef getProperty(JsValueRef object, PropertyId propertyId);
+	static void checkCallback(JsValueRef func);
+	static void JSLog(NativeRestArguments values);
+	static double JSSetTimeout(JsValueRef thisArg, JsValueRef func, NativeOptional<int> delay);
+	static double JSSetInterval(JsValueRef thisArg, JsValueRef func, NativeOptional<int> delay);
+	static void JSClearTimer(NativeOptional<double> handle);
+	static double JSPerformanceNow();
+	static double JSRequestAnimationFrame(JsValueRef func);
+	static void JSCancelAnimationFrame(NativeOptional<double> id);
 	static GLPoint* JSPointToNativePoint(JsValueRef point);
-	static JsValueRef CALLBACK JSPointConstructor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef createPolygon(JsValueRef *arguments, unsigned short argumentCount);
-	static JsValueRef CALLBACK JSLineConstructor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef CALLBACK JSTriangleConstructor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef CALLBACK JSQuadConstructor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef CALLBACK JSPolygonConstructor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef CALLBACK JSRotate(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef CALLBACK JSSetColor(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef CALLBACK JSSetPosition(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef CALLBACK JSAddShape(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef CALLBACK JSRemoveShape(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static JsValueRef CALLBACK JSRender(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
+	static vector<GLPoint> JSPointsToNativePoints(JsValueRef points);
+	static JsValueRef JSPointConstructor(float x, float y, float z);
+	static JsValueRef createPolygon(vector<GLPoint> points, JsValueRef prototype);
+	static JsValueRef JSLineConstructor(GLPoint &point1, GLPoint &point2);
+	static JsValueRef JSTriangleConstructor(GLPoint &point1, GLPoint &point2, GLPoint &point3);
+	static JsValueRef JSQuadConstructor(GLPoint &point1, GLPoint &point2, GLPoint &point3, GLPoint &point4);
+	static JsValueRef JSPolygonConstructor(JsValueRef points);
+	static void JSRotate(GLShape &shape, float rotateAngle, float x, float y, float z);
+	static void JSSetColor(GLShape &shape, float r, float g, float b);
+	static void JSSetPosition(GLPolygon &shape, JsValueRef points);
+	static void JSAddShape(GLShape &shape);
+	static void JSRemoveShape(GLShape &shape);
+	static void JSRender();
 	static void mouse_click_callback(GLFWwindow* window, int button, int action, int mods);
-	static JsValueRef CALLBACK JSSetMouseClickCallback(JsValueRef callee, bool isConstructCall, JsValueRef *arguments, unsigned short argumentCount, void *callbackState);
-	static void projectNativeClass(const wchar_t *className, JsNativeFunction constructor, JsValueRef &prototype, vector<const wchar_t *> memberNames, vector<JsNativeFunction> memberFuncs);
+	static void JSSetMouseClickCallback(JsValueRef thisArg, JsValueRef func);
+	static void projectNativeClass(PropertyId className, JsNativeFunction constructor, JsValueRef &prototype, vector<PropertyId> memberNames, vector<JsNativeFunction> memberFuncs);
 };
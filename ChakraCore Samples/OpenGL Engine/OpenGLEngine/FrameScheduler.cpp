@@ -0,0 +1,174 @@
+#pragma once
+#include "FrameScheduler.h"
+#include "TaskScheduler.h"
+#include <stdio.h>
+
+// start frames this much earlier than the last frame says they need to, for timing noise
+static const long long frameMargin = 1000000;
+
+FrameScheduler::FrameScheduler()
+{
+	_next = 0;
+	_lastId = 0;
+	_renderRequested = false;
+	_period = 1000000000LL / 60;
+	_vsync = TaskScheduler::now();
+	_work = 0;
+	_reportTime = _vsync;
+	_frames = 0;
+	_totalScript = 0;
+	_maxScript = 0;
+	_totalRender = 0;
+	_maxRender = 0;
+	_totalSwap = 0;
+	_overBudget = 0;
+	_allocations = 0;
+	_maxAllocations = 0;
+}
+
+void FrameScheduler::setRefreshRate(int hertz)
+{
+	if (hertz > 0)
+		_period = 1000000000LL / hertz;
+}
+
+unsigned FrameScheduler::request(JsValueRef func)
+{
+	// ids skip 0 when they wrap, so they're always truthy
+	if (++_lastId == 0)
+		_lastId = 1;
+	JsAddRef(func, nullptr);
+	_pending.push_back({ func, _lastId });
+	return _lastId;
+}
+
+void FrameScheduler::cancel(unsigned id)
+{
+	for (size_t i = 0; i < _pending.size(); ++i) {
+		if (_pending[i].id == id) {
+			JsRelease(_pending[i].func, nullptr);
+			_pending.erase(_pending.begin() + i);
+			return;
+		}
+	}
+	// a callback of the running frame that hasn't been called yet
+	for (size_t i = _next; i < _running.size(); ++i) {
+		if (_running[i].id == id && _running[i].func != JS_INVALID_REFERENCE) {
+			JsRelease(_running[i].func, nullptr);
+			_running[i].func = JS_INVALID_REFERENCE;
+			return;
+		}
+	}
+}
+
+void FrameScheduler::requestRender()
+{
+	_renderRequested = true;
+}
+
+bool FrameScheduler::pending()
+{
+	return _renderRequested || !_pending.empty();
+}
+
+long long FrameScheduler::nextFrame()
+{
+	return _vsync + _period - _work - frameMargin;
+}
+
+void FrameScheduler::run(double timestamp, MicrotaskQueue &microtasks)
+{
+	// callbacks requested from now on wait for the next frame
+	_running.swap(_pending);
+	JsValueRef args[2];
+	JsGetUndefinedValue(&args[0]);
+	JsDoubleToNumber(timestamp, &args[1]);
+	for (_next = 0; _next < _running.size(); ) {
+		JsValueRef func = _running[_next++].func;
+		if (func == JS_INVALID_REFERENCE)
+			continue;
+		JsValueRef result;
+		if (JsCallFunction(func, args, 2, &result) == JsErrorScriptException) {
+			// an exception in one callback doesn't stop the others
+			JsValueRef exception;
+			JsGetAndClearException(&exception);
+		}
+		JsRelease(func, nullptr);
+		microtasks.drain();
+	}
+	_running.clear();
+	_next = 0;
+	// this frame is rendered, including whatever the callbacks asked for
+	_renderRequested = false;
+}
+
+void FrameScheduler::finish(long long start, long long scripted, long long rendered, long long swapped,
+	unsigned long long allocations)
+{
+	long long script = scripted - start;
+	long long render = rendered - scripted;
+	_work = script + render;
+	// a swap that blocked returned at a vsync, or the frame was late and the display's phase is
+	// unknown; either way start from the swap. one that returned before the predicted vsync didn't
+	// block, so the prediction stands.
+	long long predicted = _vsync + _period;
+	_vsync = swapped > predicted ? swapped : predicted;
+
+	_frames++;
+	_totalScript += script;
+	_totalRender += render;
+	_totalSwap += swapped - rendered;
+	if (script > _maxScript)
+		_maxScript = script;
+	if (render > _maxRender)
+		_maxRender = render;
+	if (_work > _period)
+		_overBudget++;
+	_allocations += allocations;
+	if (allocations > _maxAllocations)
+		_maxAllocations = allocations;
+}
+
+void FrameScheduler::report()
+{
+	long long currentTime = TaskScheduler::now();
+	long long elapsed = currentTime - _reportTime;
+	if (elapsed < TaskScheduler::reportInterval)
+		return;
+	if (_frames > 0) {
+		fwprintf(stderr, L"frames: %u frames (%.1f fps), budget %.3f ms: script %.3f ms average, %.3f ms max, render %.3f ms average, %.3f ms max, swap wait %.3f ms average, %u over budget\n",
+			_frames, _frames * 1e9 / elapsed, _period / 1e6, _totalScript / 1e6 / _frames, _maxScript / 1e6,
+			_totalRender / 1e6 / _frames, _maxRender / 1e6, _totalSwap / 1e6 / _frames, _overBudget);
+		fwprintf(stderr, L"frames: %llu allocations (%.2f per frame, %llu max)\n",
+			_allocations, (double)_allocations / _frames, _maxAllocations);
+	}
+	_reportTime = currentTime;
+	_frames = 0;
+	_totalScript = 0;
+	_maxScript = 0;
+	_totalRender = 0;
+	_maxRender = 0;
+	_totalSwap = 0;
+	_overBudget = 0;
+	_allocations = 0;
+	_maxAllocations = 0;
+}
+
+void FrameScheduler::clear()
+{
+	for (Callback &callback : _pending)
+		JsRelease(callback.func, nullptr);
+	for (size_t i = _next; i < _running.size(); ++i) {
+		if (_running[i].func != JS_INVALID_REFERENCE)
+			JsRelease(_running[i].func, nullptr);
+	}
+	_pending.clear();
+	_running.clear();
+	_next = 0;
+	_renderRequested = false;
+}
+
+FrameScheduler::~FrameScheduler()
+{
+	clear();
+}
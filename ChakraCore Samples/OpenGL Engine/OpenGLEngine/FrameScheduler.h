@@ -0,0 +1,57 @@
+#pragma once
+#include "MicrotaskQueue.h"
+#include "ChakraCore.h"
+#include <vector>
+
+using namespace std;
+
+// requestAnimationFrame callbacks and the timing of frames. all callbacks requested before a frame
+// starts run in that frame with the same timestamp, and the frame ends with one render and swap.
+// frames are planned against the display's vsync: a frame starts as late as it can while its
+// script and render time, going by the last frame, still fit before the vsync it will be shown at,
+// so the swap blocks as little as possible and timers keep running in between.
+class FrameScheduler
+{
+private:
+	struct Callback
+	{
+		JsValueRef func;						// JS_INVALID_REFERENCE once cancelled
+		unsigned id;
+	};
+	vector<Callback> _pending;					// requested for the next frame
+	vector<Callback> _running;					// the frame that is running; kept to reuse its memory
+	size_t _next;								// next callback of _running to call
+	unsigned _lastId;
+	bool _renderRequested;
+	// timing, in nanoseconds of TaskScheduler::now()
+	long long _period;							// display refresh period, the budget of a frame
+	long long _vsync;							// estimated time of the last vsync
+	long long _work;							// script and render time of the last frame
+	// statistics since the last report
+	long long _reportTime;
+	unsigned _frames;
+	long long _totalScript;
+	long long _maxScript;
+	long long _totalRender;
+	long long _maxRender;
+	long long _totalSwap;
+	unsigned _overBudget;
+	unsigned long long _allocations;
+	unsigned long long _maxAllocations;
+public:
+	FrameScheduler();
+	void setRefreshRate(int hertz);
+	unsigned request(JsValueRef func);			// queue a callback for the next frame and return its id
+	void cancel(unsigned id);					// cancel a callback that hasn't run; unknown ids are ignored
+	void requestRender();						// render in the next frame even without callbacks
+	bool pending();								// whether a frame is wanted
+	long long nextFrame();						// when the next frame should start
+	void run(double timestamp, MicrotaskQueue &microtasks);	// call the callbacks of a frame, each
+															// followed by its promise jobs
+	void finish(long long start, long long scripted, long long rendered, long long swapped,
+		unsigned long long allocations);		// record a frame's timing once it was swapped
+	void report();								// print frame rate, time budget use and allocations
+												// every few seconds
+	void clear();								// drop every callback, before the runtime goes away
+	~FrameScheduler();
+};
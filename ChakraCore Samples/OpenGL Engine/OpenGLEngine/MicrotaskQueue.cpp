@@ -0,0 +1,72 @@
+#pragma once
+#include "MicrotaskQueue.h"
+
+// room for this many jobs before the first allocation; a power of two
+static const size_t initialCapacity = 256;
+
+MicrotaskQueue::MicrotaskQueue()
+{
+	_jobs.resize(initialCapacity);
+	_head = 0;
+	_count = 0;
+	_run = 0;
+}
+
+// double the buffer, unwrapping the jobs to its start
+void MicrotaskQueue::grow()
+{
+	vector<JsValueRef> jobs(_jobs.size() * 2);
+	for (size_t i = 0; i < _count; ++i)
+		jobs[i] = _jobs[(_head + i) & (_jobs.size() - 1)];
+	_jobs.swap(jobs);
+	_head = 0;
+}
+
+void MicrotaskQueue::push(JsValueRef job)
+{
+	if (_count == _jobs.size())
+		grow();
+	JsAddRef(job, nullptr);
+	_jobs[(_head + _count) & (_jobs.size() - 1)] = job;
+	_count++;
+}
+
+bool MicrotaskQueue::empty()
+{
+	return _count == 0;
+}
+
+void MicrotaskQueue::drain()
+{
+	if (_count == 0)
+		return;
+	JsValueRef undefined;
+	JsGetUndefinedValue(&undefined);
+	while (_count > 0) {
+		JsValueRef job = _jobs[_head];
+		_head = (_head + 1) & (_jobs.size() - 1);
+		_count--;
+		JsValueRef result;
+		if (JsCallFunction(job, &undefined, 1, &result) == JsErrorScriptException) {
+			// an exception in one job doesn't stop the others
+			JsValueRef exception;
+			JsGetAndClearException(&exception);
+		}
+		JsRelease(job, nullptr);
+		_run++;
+	}
+}
+
+void MicrotaskQueue::clear()
+{
+	while (_count > 0) {
+		JsRelease(_jobs[_head], nullptr);
+		_head = (_head + 1) & (_jobs.size() - 1);
+		_count--;
+	}
+}
+
+unsigned long long MicrotaskQueue::runCount()
+{
+	return _run;
+}
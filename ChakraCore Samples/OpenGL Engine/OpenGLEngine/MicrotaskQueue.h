@@ -0,0 +1,24 @@
+#pragma once
+#include "ChakraCore.h"
+#include <vector>
+
+using namespace std;
+
+// promise jobs waiting to run, in a ring buffer that only allocates when it has to grow. jobs are
+// pinned with JsAddRef while queued, since the garbage collector doesn't see native memory.
+class MicrotaskQueue
+{
+private:
+	vector<JsValueRef> _jobs;
+	size_t _head;
+	size_t _count;
+	unsigned long long _run;
+	void grow();
+public:
+	MicrotaskQueue();
+	void push(JsValueRef job);					// queue a promise job
+	bool empty();
+	void drain();								// run jobs until none are left, including ones they queue
+	void clear();								// drop every job, before the runtime goes away
+	unsigned long long runCount();				// jobs run so far
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include "ChakraCore.h"
+// property names used by the bindings, resolved once per runtime instead of on every call
+#define ENGINE_PROPERTY_NAMES(PROPERTY) \
+	PROPERTY(Message, L"message") \
+	PROPERTY(Length, L"length") \
+	PROPERTY(X, L"x") \
+	PROPERTY(Y, L"y") \
+	PROPERTY(Prototype, L"prototype") \
+	PROPERTY(Console, L"console") \
+	PROPERTY(Log, L"log") \
+	PROPERTY(SetTimeout, L"setTimeout") \
+	PROPERTY(SetInterval, L"setInterval") \
+	PROPERTY(ClearTimeout, L"clearTimeout") \
+	PROPERTY(ClearInterval, L"clearInterval") \
+	PROPERTY(Performance, L"performance") \
+	PROPERTY(Now, L"now") \
+	PROPERTY(RequestAnimationFrame, L"requestAnimationFrame") \
+	PROPERTY(CancelAnimationFrame, L"cancelAnimationFrame") \
+	PROPERTY(Point, L"Point") \
+	PROPERTY(Line, L"Line") \
+	PROPERTY(Triangle, L"Triangle") \
+	PROPERTY(Quad, L"Quad") \
+	PROPERTY(Polygon, L"Polygon") \
+	PROPERTY(Rotate, L"rotate") \
+	PROPERTY(SetColor, L"setColor") \
+	PROPERTY(SetPosition, L"setPosition") \
+	PROPERTY(Canvas, L"canvas") \
+	PROPERTY(AddShape, L"addShape") \
+	PROPERTY(RemoveShape, L"removeShape") \
+	PROPERTY(Render, L"render") \
+	PROPERTY(SetMouseClickCallback, L"setMouseClickCallback")
+
+enum PropertyId
+{
+#define DEFINE_PROPERTY_ID(id, name) PropertyId##id,
+	ENGINE_PROPERTY_NAMES(DEFINE_PROPERTY_ID)
+#undef DEFINE_PROPERTY_ID
+	PropertyIdCount
+};
+
+// property ids of one runtime, indexed by PropertyId. ids are pinned with JsAddRef the first time
+// they are used, and stay valid until the runtime is disposed. a context of the runtime must be
+// current.
+class PropertyIds
+{
+private:
+	JsPropertyIdRef _wellKnown[PropertyIdCount];
+	static JsPropertyIdRef resolve(const wchar_t *name)
+	{
+		JsPropertyIdRef propertyId = JS_INVALID_REFERENCE;
+		if (JsGetPropertyIdFromName(name, &propertyId) == JsNoError)
+			JsAddRef(propertyId, nullptr);
+		return propertyId;
+	}
+public:
+	PropertyIds()
+	{
+		reset();
+	}
+	// forget every id, when the runtime they belong to goes away
+	void reset()
+	{
+		for (int i = 0; i < PropertyIdCount; ++i)
+			_wellKnown[i] = JS_INVALID_REFERENCE;
+	}
+	static const wchar_t *name(PropertyId id)
+	{
+		static const wchar_t *const names[] =
+		{
+#define DEFINE_PROPERTY_NAME(id, name) name,
+			ENGINE_PROPERTY_NAMES(DEFINE_PROPERTY_NAME)
+#undef DEFINE_PROPERTY_NAME
+		};
+		static_assert(sizeof(names) / sizeof(names[0]) == PropertyIdCount, "every PropertyId needs a name");
+		return names[id];
+	}
+	JsPropertyIdRef get(PropertyId id)
+	{
+		if (_wellKnown[id] == JS_INVALID_REFERENCE)
+			_wellKnown[id] = resolve(name(id));
+		return _wellKnown[id];
+	}
+};
@@ -1,4 +1,5 @@
 #pragma once
+#include "NativeObject.h"
 #include <vector>
 
 using namespace std;
@@ -13,7 +14,7 @@ public:
 };
 
 // base class OpenGL shape that can be added to canvas
-class GLShape 
+class GLShape : public NativeObject
 {
 public: 
 	GLTriple _color = GLTriple(1.0f, 1.0f, 1.0f);
@@ -1,22 +1,42 @@
 #pragma once
 #include "Task.h"
-#include <time.h>
+#include "TaskScheduler.h"
+#include <cstdio>
 
 using namespace std;
 
-Task::Task(JsValueRef func, int delay, JsValueRef thisArg, JsValueRef extraArgs, bool repeat)
+Task::Task()
+{
+	_func = JS_INVALID_REFERENCE;
+	_args[0] = JS_INVALID_REFERENCE;
+	_args[1] = JS_INVALID_REFERENCE;
+	_argCount = 0;
+	_deadline = 0;
+	_period = 0;
+	_repeat = false;
+	_cancelled = false;
+	_generation = 1;
+	_sequence = 0;
+	_index = 0;
+	_heapIndex = notInHeap;
+	_nextFree = noSlot;
+	_active = false;
+}
+
+void Task::init(JsValueRef func, int delay, JsValueRef thisArg, JsValueRef extraArgs, bool repeat)
 {
 	_func = func;
-	_delay = delay;
+	_period = delay > 0 ? delay * 1000000LL : 0;
+	_deadline = TaskScheduler::now() + _period;
 	_argCount = 1;
 	_args[0] = thisArg;
 	_args[1] = extraArgs;
 	_repeat = repeat;
-	_time = clock() / (double)(CLOCKS_PER_SEC / 1000);
+	_cancelled = false;
 	JsAddRef(_func, nullptr);
 	JsAddRef(_args[0], nullptr);
 	if (extraArgs != JS_INVALID_REFERENCE) {
-		JsErrorCode err = JsAddRef(_args[1], nullptr);
+		JsAddRef(_args[1], nullptr);
 		_argCount = 2;
 	}
 }
@@ -24,15 +44,41 @@ Task::Task(JsValueRef func, int delay, JsValueRef thisArg, JsValueRef extraArgs,
 JsValueRef Task::invoke()
 {
 	JsValueRef ret = JS_INVALID_REFERENCE;
-	JsCallFunction(_func, _args, _argCount, &ret);
+	if (JsCallFunction(_func, _args, _argCount, &ret) == JsErrorScriptException) {
+		// clear the exception, or every later call into the engine fails with JsErrorInExceptionState
+		JsValueRef exception, exceptionString;
+		const wchar_t *message;
+		size_t length;
+		JsGetAndClearException(&exception);
+		if (JsConvertValueToString(exception, &exceptionString) == JsNoError &&
+			JsStringToPointer(exceptionString, &message, &length) == JsNoError)
+			fwprintf(stderr, L"chakrahost: uncaught exception in task: %.*s\n", (int) length, message);
+		ret = JS_INVALID_REFERENCE;
+	}
 	return ret;
 }
 
-Task::~Task()
+// the next deadline follows from the previous one rather than from now, so intervals don't drift.
+// ticks that were missed entirely are skipped instead of being run back to back.
+void Task::reschedule(long long now)
+{
+	if (_period == 0) {
+		_deadline = now;
+		return;
+	}
+	_deadline += _period;
+	if (_deadline <= now)
+		_deadline += ((now - _deadline) / _period + 1) * _period;
+}
+
+void Task::release()
 {
 	JsRelease(_func, nullptr);
 	JsRelease(_args[0], nullptr);
 	if (_args[1] != JS_INVALID_REFERENCE) {
 		JsRelease(_args[1], nullptr);
 	}
+	_func = JS_INVALID_REFERENCE;
+	_args[0] = JS_INVALID_REFERENCE;
+	_args[1] = JS_INVALID_REFERENCE;
 }
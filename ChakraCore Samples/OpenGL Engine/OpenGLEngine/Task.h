@@ -1,17 +1,30 @@
 #pragma once
 #include "ChakraCore.h"
 
-// represent a task in Javascript
+// represent a task in Javascript. tasks live in TaskScheduler's pool and are reused, so they are
+// set up with init and torn down with release rather than constructed and deleted.
 class Task
 {
 public:
 	JsValueRef _func;
 	JsValueRef _args[2];
 	int _argCount;
-	int _delay;
+	long long _deadline;						// when the task is due, in nanoseconds of TaskScheduler::now()
+	long long _period;							// delay in nanoseconds, and the interval of a repeating task
 	bool _repeat;
-	int _time;
-	Task(JsValueRef func, int delay, JsValueRef thisArg, JsValueRef extraArgs, bool repeat = false);
+	bool _cancelled;							// cleared while it was running
+	// pool bookkeeping
+	unsigned _generation;						// bumped every time the slot is freed, so old handles go stale
+	unsigned _sequence;							// order of scheduling, for tasks with the same deadline
+	unsigned _index;							// slot in the pool
+	unsigned _heapIndex;						// position in the scheduler's heap, or notInHeap
+	unsigned _nextFree;							// next free slot while this one is free, or noSlot
+	bool _active;
+	static const unsigned notInHeap = 0xFFFFFFFF;
+	static const unsigned noSlot = 0xFFFFFFFF;
+	Task();
+	void init(JsValueRef func, int delay, JsValueRef thisArg, JsValueRef extraArgs, bool repeat = false);
 	JsValueRef invoke();						// invoke a task
-	~Task();
+	void reschedule(long long now);				// move a repeating task to its next deadline
+	void release();								// unpin the function and arguments
 };
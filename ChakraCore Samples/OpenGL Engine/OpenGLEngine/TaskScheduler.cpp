@@ -0,0 +1,269 @@
+#pragma once
+#include "TaskScheduler.h"
+#include <stdio.h>
+
+using namespace std::chrono;
+
+// handles are index + generation * 2^24; generations wrap at 2^29, so handles stay below 2^53 and
+// are exact in a double
+static const unsigned maxSlots = 1 << 24;
+static const unsigned maxGeneration = (1 << 29) - 1;
+static const double maxHandle = 9007199254740992.0;
+
+TaskScheduler::TaskScheduler()
+{
+	_slotCount = 0;
+	_firstFree = Task::noSlot;
+	_sequence = 0;
+	_reportTime = now();
+	_fired = 0;
+	_totalLateness = 0;
+	_maxLateness = 0;
+	_cpuTime = processCpuTime();
+	_microtasks = 0;
+	_passes = 0;
+	_allocations = 0;
+	_maxAllocations = 0;
+}
+
+// steady_clock never goes backwards and keeps counting while the process is idle; 64 bits of
+// nanoseconds last for centuries
+long long TaskScheduler::now()
+{
+	return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+// user and kernel time of the process, in 100 ns units
+ULONGLONG TaskScheduler::processCpuTime()
+{
+	FILETIME creation, exit, kernel, user;
+	if (!GetProcessTimes(GetCurrentProcess(), &creation, &exit, &kernel, &user))
+		return 0;
+	return (((ULONGLONG)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+		(((ULONGLONG)user.dwHighDateTime << 32) | user.dwLowDateTime);
+}
+
+Task& TaskScheduler::slot(unsigned index)
+{
+	return _slabs[index / slabSize][index % slabSize];
+}
+
+// ******************************
+//	 TaskScheduler - heap
+// ******************************
+
+bool TaskScheduler::earlier(unsigned a, unsigned b)
+{
+	Task& taskA = slot(a);
+	Task& taskB = slot(b);
+	if (taskA._deadline != taskB._deadline)
+		return taskA._deadline < taskB._deadline;
+	return (int)(taskA._sequence - taskB._sequence) < 0;
+}
+
+void TaskScheduler::place(unsigned position, unsigned index)
+{
+	_heap[position] = index;
+	slot(index)._heapIndex = position;
+}
+
+void TaskScheduler::siftUp(unsigned position)
+{
+	unsigned index = _heap[position];
+	while (position > 0) {
+		unsigned parent = (position - 1) / 2;
+		if (!earlier(index, _heap[parent]))
+			break;
+		place(position, _heap[parent]);
+		position = parent;
+	}
+	place(position, index);
+}
+
+void TaskScheduler::siftDown(unsigned position)
+{
+	unsigned index = _heap[position];
+	unsigned size = (unsigned)_heap.size();
+	for (;;) {
+		unsigned child = position * 2 + 1;
+		if (child >= size)
+			break;
+		if (child + 1 < size && earlier(_heap[child + 1], _heap[child]))
+			child++;
+		if (!earlier(_heap[child], index))
+			break;
+		place(position, _heap[child]);
+		position = child;
+	}
+	place(position, index);
+}
+
+void TaskScheduler::push(unsigned index)
+{
+	slot(index)._sequence = _sequence++;
+	_heap.push_back(index);
+	siftUp((unsigned)_heap.size() - 1);
+}
+
+// take the task at a heap position out of the heap
+void TaskScheduler::remove(unsigned position)
+{
+	unsigned index = _heap[position];
+	unsigned last = _heap.back();
+	_heap.pop_back();
+	slot(index)._heapIndex = Task::notInHeap;
+	if (position < _heap.size()) {
+		place(position, last);
+		siftDown(position);
+		siftUp(slot(last)._heapIndex);
+	}
+}
+
+// ******************************
+//	 TaskScheduler - pool
+// ******************************
+
+void TaskScheduler::free(unsigned index)
+{
+	Task& task = slot(index);
+	task.release();
+	task._active = false;
+	task._generation = task._generation < maxGeneration ? task._generation + 1 : 1;
+	task._nextFree = _firstFree;
+	_firstFree = index;
+}
+
+double TaskScheduler::add(JsValueRef func, int delay, JsValueRef thisArg, JsValueRef extraArgs, bool repeat)
+{
+	if (_firstFree == Task::noSlot) {
+		// out of free slots: add a slab and put its slots on the free list
+		if (_slotCount + slabSize > maxSlots)
+			return 0;
+		_slabs.emplace_back(new Task[slabSize]);
+		for (unsigned i = slabSize; i > 0; --i) {
+			Task& task = slot(_slotCount + i - 1);
+			task._index = _slotCount + i - 1;
+			task._nextFree = _firstFree;
+			_firstFree = task._index;
+		}
+		_slotCount += slabSize;
+	}
+	unsigned index = _firstFree;
+	Task& task = slot(index);
+	_firstFree = task._nextFree;
+	task._active = true;
+	task.init(func, delay, thisArg, extraArgs, repeat);
+	push(index);
+	return index + (double)task._generation * maxSlots;
+}
+
+bool TaskScheduler::cancel(double handle)
+{
+	if (!(handle > 0) || handle >= maxHandle)
+		return false;
+	unsigned long long value = (unsigned long long)handle;
+	if ((double)value != handle)
+		return false;
+	unsigned index = (unsigned)(value % maxSlots);
+	unsigned generation = (unsigned)(value / maxSlots);
+	if (index >= _slotCount)
+		return false;
+	Task& task = slot(index);
+	if (!task._active || task._generation != generation)
+		return false;
+	if (task._heapIndex == Task::notInHeap) {
+		// the task is running; finish frees it
+		task._cancelled = true;
+		return true;
+	}
+	remove(task._heapIndex);
+	free(index);
+	return true;
+}
+
+bool TaskScheduler::empty()
+{
+	return _heap.empty();
+}
+
+long long TaskScheduler::nextDeadline()
+{
+	return slot(_heap[0])._deadline;
+}
+
+Task* TaskScheduler::pop()
+{
+	Task* task = &slot(_heap[0]);
+	remove(0);
+	long long lateness = now() - task->_deadline;
+	if (lateness > 0) {
+		_totalLateness += lateness;
+		if (lateness > _maxLateness)
+			_maxLateness = lateness;
+	}
+	_fired++;
+	return task;
+}
+
+void TaskScheduler::finish(Task* task)
+{
+	if (task->_repeat && !task->_cancelled) {
+		task->reschedule(now());
+		push(task->_index);
+	}
+	else {
+		free(task->_index);
+	}
+}
+
+// ******************************
+//	 TaskScheduler - statistics
+// ******************************
+
+void TaskScheduler::countPass(unsigned long long allocations)
+{
+	_passes++;
+	_allocations += allocations;
+	if (allocations > _maxAllocations)
+		_maxAllocations = allocations;
+}
+
+void TaskScheduler::report(unsigned long long microtasks)
+{
+	long long currentTime = now();
+	long long elapsed = currentTime - _reportTime;
+	if (elapsed < reportInterval)
+		return;
+	ULONGLONG cpuTime = processCpuTime();
+	// cpu time is in 100 ns units
+	double cpuUse = (cpuTime - _cpuTime) * 100.0 * 100 / elapsed;
+	fwprintf(stderr, L"scheduler: cpu %.1f%%, %u tasks and %llu microtasks run, lateness %.3f ms average, %.3f ms max\n",
+		cpuUse, _fired, microtasks - _microtasks, _fired > 0 ? _totalLateness / 1e6 / _fired : 0.0, _maxLateness / 1e6);
+	fwprintf(stderr, L"scheduler: %u passes, %llu allocations (%.2f per pass, %llu max), %u task slots\n",
+		_passes, _allocations, _passes > 0 ? (double)_allocations / _passes : 0.0, _maxAllocations, _slotCount);
+	_microtasks = microtasks;
+	_reportTime = currentTime;
+	_cpuTime = cpuTime;
+	_fired = 0;
+	_totalLateness = 0;
+	_maxLateness = 0;
+	_passes = 0;
+	_allocations = 0;
+	_maxAllocations = 0;
+}
+
+void TaskScheduler::clear()
+{
+	for (unsigned index = 0; index < _slotCount; ++index) {
+		if (slot(index)._active) {
+			slot(index)._heapIndex = Task::notInHeap;
+			free(index);
+		}
+	}
+	_heap.clear();
+}
+
+TaskScheduler::~TaskScheduler()
+{
+	clear();
+}
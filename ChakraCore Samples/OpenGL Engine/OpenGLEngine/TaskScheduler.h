@@ -0,0 +1,63 @@
+#pragma once
+#include "Task.h"
+#include <windows.h>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+// tasks ordered by deadline in a binary min-heap, so finding the next due task is O(1) and
+// scheduling or cancelling one is O(log n). tasks with the same deadline run in the order they
+// were scheduled.
+//
+// tasks come from a pool of fixed-size slabs that never move, and freed tasks are reused, so once
+// the pool and heap have grown to fit the app no more memory is allocated. scripts refer to tasks
+// by handle: the slot index plus the slot's generation, which changes when the slot is reused, so
+// a stale handle can't cancel some other task.
+class TaskScheduler
+{
+private:
+	static const unsigned slabSize = 256;
+	vector<unique_ptr<Task[]>> _slabs;
+	unsigned _slotCount;
+	unsigned _firstFree;						// head of the free list, or Task::noSlot
+	vector<unsigned> _heap;						// slot indices
+	unsigned _sequence;
+	// statistics since the last report, times in nanoseconds
+	long long _reportTime;
+	unsigned _fired;
+	long long _totalLateness;
+	long long _maxLateness;
+	ULONGLONG _cpuTime;
+	unsigned long long _microtasks;
+	unsigned _passes;
+	unsigned long long _allocations;
+	unsigned long long _maxAllocations;
+	static ULONGLONG processCpuTime();
+	Task& slot(unsigned index);
+	bool earlier(unsigned a, unsigned b);
+	void place(unsigned position, unsigned index);
+	void siftUp(unsigned position);
+	void siftDown(unsigned position);
+	void push(unsigned index);
+	void remove(unsigned position);
+	void free(unsigned index);
+public:
+	static const long long reportInterval = 5000000000LL;	// how often statistics are reported, in ns
+	TaskScheduler();
+	static long long now();							// monotonic time in nanoseconds
+	// schedule a task and return its handle, or 0 if there are too many tasks
+	double add(JsValueRef func, int delay, JsValueRef thisArg, JsValueRef extraArgs, bool repeat = false);
+	bool cancel(double handle);						// cancel a task by handle; stale handles are ignored
+	bool empty();
+	long long nextDeadline();						// deadline of the earliest task
+	Task* pop();									// take the earliest task off the heap, counting how late it is
+	void finish(Task* task);						// after a popped task ran: reschedule or free it
+	void countPass(unsigned long long allocations);	// heap allocations during one pass of the loop
+	void report(unsigned long long microtasks);		// print cpu use, tasks and microtasks run (given as a
+													// running total), timer lateness and allocations
+													// every few seconds
+	void clear();									// drop every task, before the runtime goes away
+	~TaskScheduler();
+};
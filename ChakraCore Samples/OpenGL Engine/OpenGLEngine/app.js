@@ -23,7 +23,7 @@ class Ball {
         this.radius = radius;
         this.color = color;
         this.velocity = 0; 
-        this.timestamp = Date.now();
+        this.timestamp = performance.now();
         this.circle = this.createCircle(this.center, this.radius, this.color);      // the ball
         canvas.addShape(this.circle);
     }
@@ -40,14 +40,13 @@ class Ball {
         return circle;
     }
 
-    // update the circle's current position and velocity
-    update() {
+    // update the circle's current position and velocity to the frame's time
+    update(newTimestamp) {
         // update only if the ball has not stopped on the ground
         if ((Math.abs(this.center.y - this.radius - groundLevel) > epislon) || (Math.abs(this.velocity > epislon))) {
             // remove the old circle
             canvas.removeShape(this.circle);
             // approximate the circle's current position and velocity at this time
-            let newTimestamp = Date.now();
             let timeElapsed = newTimestamp - this.timestamp;
             this.velocity += timeElapsed / 1000 * acceleration;
             this.center.y += this.velocity * timeElapsed;
@@ -75,11 +74,11 @@ canvas.setMouseClickCallback((pos) => {
 });
 
 // draw a frame of all balls
-function mainloop() {
+function mainloop(timestamp) {
     for (let ball of balls) {
-        ball.update();
+        ball.update(timestamp);
     }
-    canvas.render();
+    requestAnimationFrame(mainloop);
 }
 
-setInterval(mainloop, 0);
+requestAnimationFrame(mainloop);
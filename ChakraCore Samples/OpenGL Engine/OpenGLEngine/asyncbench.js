@@ -0,0 +1,64 @@
+// async/await frame benchmark
+// Run with `OpenGLEngine.exe asyncbench.js`. Each frame updates a set of entities with async
+// functions that await several times, the way frame code using promises does, and the frame isn't
+// over until every promise job it queued has run.
+
+'use strict';
+
+const entities = 200,
+    awaitsPerUpdate = 10,
+    warmupFrames = 30,
+    frames = 300;
+
+let state = new Float64Array(entities);
+
+async function step(index, value) {
+    return value * 0.5 + index;
+}
+
+async function update(index) {
+    let value = state[index];
+    for (let i = 0; i < awaitsPerUpdate; i++) {
+        value = await step(index, value);
+    }
+    state[index] = value;
+}
+
+async function frame() {
+    let updates = [];
+    for (let i = 0; i < entities; i++) {
+        updates.push(update(i));
+    }
+    await Promise.all(updates);
+}
+
+let frameTimes = [];
+
+function runFrame(index) {
+    let start = performance.now();
+    frame().then(() => {
+        // all of the frame's promise jobs ran before the next task, so this is the whole frame
+        if (index >= warmupFrames) {
+            frameTimes.push(performance.now() - start);
+        }
+        if (index + 1 < warmupFrames + frames) {
+            setTimeout(() => runFrame(index + 1), 0);
+        }
+        else {
+            report();
+        }
+    });
+}
+
+function report() {
+    frameTimes.sort((a, b) => a - b);
+    let total = frameTimes.reduce((sum, value) => sum + value, 0);
+    let mean = total / frameTimes.length;
+    let awaits = entities * awaitsPerUpdate;
+    console.log(`${frames} frames, ${entities} entities x ${awaitsPerUpdate} awaits: ` +
+        `frame mean ${mean.toFixed(3)} ms, p50 ${frameTimes[Math.floor(frames / 2)].toFixed(3)} ms, ` +
+        `p99 ${frameTimes[Math.floor(frames * 0.99)].toFixed(3)} ms, ` +
+        `${(mean * 1e6 / awaits).toFixed(0)} ns per await`);
+}
+
+runFrame(0);
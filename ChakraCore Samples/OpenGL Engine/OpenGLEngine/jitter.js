@@ -0,0 +1,49 @@
+// Timer jitter harness
+// Run with `OpenGLEngine.exe jitter.js`. Measures how far setInterval callbacks land from where
+// they should, for 1 ms, 16 ms and 100 ms intervals, one after another.
+
+'use strict';
+
+// interval in ms and number of callbacks to measure for it
+const runs = [
+    { interval: 1, samples: 2000 },
+    { interval: 16, samples: 300 },
+    { interval: 100, samples: 50 }
+];
+
+function percentile(sorted, p) {
+    return sorted[Math.min(sorted.length - 1, Math.floor(sorted.length * p / 100))];
+}
+
+function report(interval, times) {
+    // jitter: how far each gap between callbacks is from the interval
+    let jitter = [];
+    for (let i = 1; i < times.length; i++) {
+        jitter.push(Math.abs(times[i] - times[i - 1] - interval));
+    }
+    jitter.sort((a, b) => a - b);
+    let mean = jitter.reduce((sum, value) => sum + value, 0) / jitter.length;
+    // drift: how far the last callback is from where the first one says it should be
+    let drift = times[times.length - 1] - times[0] - (times.length - 1) * interval;
+    console.log(`${interval} ms: ${times.length} callbacks, jitter mean ${mean.toFixed(3)} ms, ` +
+        `p50 ${percentile(jitter, 50).toFixed(3)} ms, p99 ${percentile(jitter, 99).toFixed(3)} ms, ` +
+        `max ${jitter[jitter.length - 1].toFixed(3)} ms, drift ${drift.toFixed(3)} ms`);
+}
+
+function measure(index) {
+    if (index === runs.length) {
+        return;
+    }
+    let run = runs[index];
+    let times = [];
+    let handle = setInterval(() => {
+        times.push(performance.now());
+        if (times.length === run.samples) {
+            clearInterval(handle);
+            report(run.interval, times);
+            measure(index + 1);
+        }
+    }, run.interval);
+}
+
+measure(0);
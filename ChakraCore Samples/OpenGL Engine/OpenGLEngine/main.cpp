@@ -1,8 +1,9 @@
 #include "ChakraCoreHost.h"
 
-int main() 
+// OpenGLEngine [script] - runs app.js unless another script is given
+int wmain(int argc, wchar_t* argv[])
 {
-	ChakraCoreHost host = ChakraCoreHost();
-	host.runScript(host.loadScript(L"app.js"));
+	ChakraCoreHost host;
+	host.runScript(host.loadScript(argc > 1 ? argv[1] : L"app.js"));
 	return 0;
 }